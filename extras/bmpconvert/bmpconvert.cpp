@@ -0,0 +1,268 @@
+// Batch bitmap converter
+//
+// Converts a directory of BMP files to the native format on a PC, using the firmware's
+// own transcoder, so images can be checked and prepared before an event rather than
+// finding out on the stick that one of them won't play. Each converted file is read
+// back with the firmware's readBmpInfo(), which is the check the stick makes when it
+// opens a file, and the results are reported with the time each one took.
+//
+// The transcoder keeps its state in globals, as there's only ever one upload at a time
+// on the stick, so the files are shared out between worker processes (one per core by
+// default) rather than threads. Input files are memory mapped and fed to the transcoder
+// in one go.
+//
+// Build with make in this directory (see the Makefile for the firmware files it uses).
+//
+// Usage: bmpconvert [-j workers] [-t] [-v] <input directory> <output directory>
+// The converted files go in <output directory>/bmp, ready to be copied to data/bmp or
+// uploaded. -t tiles every image, as the "Tile uploads" setting does.
+
+#include "pixelstick.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#define MAX_WORKERS 64
+
+void beginTranscode(const char *path);
+bool transcodeChunk(const uint8_t *buf, size_t len);
+uint16_t endTranscode();
+void readBmpInfo(const char *path, FileInfo &info);
+
+struct Result
+{
+  uint32_t index;   // File in the list
+  uint16_t status;  // Bitmap file status, VALID if it converted and reads back
+  uint16_t width;
+  uint16_t height;
+  uint8_t codec;
+  uint32_t inBytes;
+  uint32_t outBytes;
+  uint32_t micros;  // Time taken to convert it
+};
+
+std::vector<std::string> inputs;
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Convert one file, checking it reads back as the stick would read it
+void convertFile(const std::string &dir, uint32_t index, Result &r)
+{
+  std::string name = inputs[index];
+  std::string source = dir + "/" + name;
+  std::string path = "/bmp/" + name;
+  FileInfo info;
+  struct stat st;
+  double start = now();
+  int fd;
+
+  memset(&r, 0, sizeof(r));
+  r.index = index;
+  if (path.size() >= sizeof(info.path) || (fd = open(source.c_str(), O_RDONLY)) < 0)
+  {
+    r.status = OPEN_ERROR;
+    return;
+  }
+  fstat(fd, &st);
+  r.inBytes = st.st_size;
+  void *data = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    r.status = OPEN_ERROR;
+    return;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  beginTranscode(path.c_str());
+  transcodeChunk((const uint8_t *)data, st.st_size);
+  r.status = endTranscode();
+  munmap(data, st.st_size);
+  r.micros = (now() - start) * 1e6;
+  if (r.status != VALID)
+    return;
+
+  readBmpInfo(path.c_str(), info);
+  r.status = info.status;
+  if (info.fileType != FILE_NATIVE)
+    r.status |= BAD_SIGNATURE;
+  r.width = info.bmpWidth;
+  r.height = info.bmpHeight;
+  r.codec = info.compMethod;
+  r.outBytes = info.fileSize;
+}
+
+/// Convert every workers'th file, starting with first, and send the results back down the pipe
+void worker(const std::string &dir, uint32_t first, uint32_t workers, int out)
+{
+  Result r;
+
+  for (uint32_t i = first; i < inputs.size(); i += workers)
+  {
+    convertFile(dir, i, r);
+    if (write(out, &r, sizeof(r)) != sizeof(r))
+      break;
+  }
+  close(out);
+}
+
+bool isBmp(const char *name)
+{
+  size_t len = strlen(name);
+  return len > 4 && strcasecmp(name + len - 4, ".bmp") == 0;
+}
+
+const char *codecName(uint8_t codec)
+{
+  switch (codec)
+  {
+  case CODEC_NONE:
+    return "none";
+  case CODEC_ROWS:
+    return "rows";
+  case CODEC_TILES:
+    return "tiles";
+  }
+  return "?";
+}
+
+int usage()
+{
+  fprintf(stderr, "Usage: bmpconvert [-j workers] [-t] [-v] <input directory> <output directory>\n");
+  return 2;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t workers = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:tv")) != -1)
+  {
+    switch (opt)
+    {
+    case 'j':
+      workers = atoi(optarg);
+      break;
+    case 't':
+      getConfig().tileUploads = true;
+      break;
+    case 'v':
+      hostVerbose = true;
+      break;
+    default:
+      return usage();
+    }
+  }
+  if (argc - optind != 2)
+    return usage();
+  std::string dir = argv[optind];
+  hostRoot = argv[optind + 1];
+
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+  {
+    perror(dir.c_str());
+    return 1;
+  }
+  for (struct dirent *e; (e = readdir(d));)
+  {
+    if (isBmp(e->d_name))
+      inputs.push_back(e->d_name);
+  }
+  closedir(d);
+  std::sort(inputs.begin(), inputs.end());
+  if (inputs.empty())
+  {
+    fprintf(stderr, "No bitmaps in %s\n", dir.c_str());
+    return 1;
+  }
+  workers = std::max(1U, std::min(workers, std::min((uint32_t)inputs.size(), (uint32_t)MAX_WORKERS)));
+
+  // Start the workers, each with its own pipe for the results
+  double start = now();
+  int pipes[MAX_WORKERS];
+  for (uint32_t w = 0; w < workers; w++)
+  {
+    int fds[2];
+    if (pipe(fds) < 0)
+    {
+      perror("pipe");
+      return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+      perror("fork");
+      return 1;
+    }
+    if (pid == 0)
+    {
+      close(fds[0]);
+      for (uint32_t i = 0; i < w; i++)
+        close(pipes[i]);
+      worker(dir, w, workers, fds[1]);
+      _exit(0);
+    }
+    close(fds[1]);
+    pipes[w] = fds[0];
+  }
+
+  std::vector<Result> results(inputs.size());
+  std::vector<bool> done(inputs.size());
+  for (uint32_t w = 0; w < workers; w++)
+  {
+    Result r;
+    while (read(pipes[w], &r, sizeof(r)) == sizeof(r))
+    {
+      if (r.index < results.size())
+      {
+        results[r.index] = r;
+        done[r.index] = true;
+      }
+    }
+    close(pipes[w]);
+  }
+  while (wait(NULL) > 0)
+    ;
+  double wall = now() - start;
+
+  // Report, in the order of the file names
+  uint64_t inTotal = 0, outTotal = 0, cpuMicros = 0;
+  uint32_t failed = 0;
+  printf("%-32s %9s %9s %6s %11s %5s %8s  %s\n", "File", "In", "Out", "Ratio", "Size", "Codec", "ms", "Status");
+  for (uint32_t i = 0; i < inputs.size(); i++)
+  {
+    Result &r = results[i];
+    if (!done[i])
+      r.status = OPEN_ERROR; // The worker died
+    inTotal += r.inBytes;
+    outTotal += r.outBytes;
+    cpuMicros += r.micros;
+    if (r.status != VALID)
+    {
+      failed++;
+      printf("%-32s %9u %9s %6s %11s %5s %8.1f  error %u\n", inputs[i].c_str(), r.inBytes, "-", "-", "-", "-",
+             r.micros / 1000.0, r.status);
+      continue;
+    }
+    char size[16];
+    snprintf(size, sizeof(size), "%ux%u", r.width, r.height);
+    printf("%-32s %9u %9u %5.1f%% %11s %5s %8.1f  ok\n", inputs[i].c_str(), r.inBytes, r.outBytes,
+           r.inBytes ? 100.0 * r.outBytes / r.inBytes : 0, size, codecName(r.codec), r.micros / 1000.0);
+  }
+  printf("\n%zu files, %u failed, %u workers\n", inputs.size(), failed, workers);
+  printf("%.2f MB in, %.2f MB out, %.3f s (%.3f s converting)\n", inTotal / 1e6, outTotal / 1e6, wall, cpuMicros / 1e6);
+  printf("%.1f MB/s, %.1f files/s\n", wall > 0 ? inTotal / 1e6 / wall : 0, wall > 0 ? inputs.size() / wall : 0);
+  return failed ? 1 : 0;
+}
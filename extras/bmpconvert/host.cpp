@@ -0,0 +1,175 @@
+#include "pixelstick.h"
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Host versions of the Arduino and LittleFS bits the bitmap code uses. The stand-ins
+// for the parts of the firmware a host program doesn't include are in stubs.cpp, so
+// other host programs can bring their own.
+
+std::string hostRoot = ".";
+bool hostVerbose;
+uint64_t hostReadBytes;
+uint32_t hostReadMicros;
+HostESP ESP;
+HostSerial Serial;
+HostFS LittleFS;
+Config hostConfig;
+
+void HostSerial::print(const char *s)
+{
+  if (hostVerbose)
+    fputs(s, stderr);
+}
+
+void HostSerial::print(unsigned long n)
+{
+  if (hostVerbose)
+    fprintf(stderr, "%lu", n);
+}
+
+void HostSerial::println(const char *s)
+{
+  if (hostVerbose)
+    fprintf(stderr, "%s\n", s);
+}
+
+void HostSerial::println(unsigned long n)
+{
+  if (hostVerbose)
+    fprintf(stderr, "%lu\n", n);
+}
+
+void HostSerial::printf(const char *format, ...)
+{
+  va_list args;
+
+  if (!hostVerbose)
+    return;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+unsigned long micros()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+/// Busy waits, as the stick does, so short delays are accurate
+void delayMicroseconds(unsigned long us)
+{
+  unsigned long start = micros();
+  while (micros() - start < us)
+    ;
+}
+
+void yield()
+{
+}
+
+long random(long howbig)
+{
+  return howbig ? rand() % howbig : 0;
+}
+
+size_t hostStrlcpy(char *dst, const char *src, size_t size)
+{
+  size_t len = strlen(src);
+
+  if (size)
+  {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return len;
+}
+
+size_t File::size() const
+{
+  struct stat st;
+  fflush(f);
+  return f && fstat(fileno(f), &st) == 0 ? st.st_size : 0;
+}
+
+void File::close()
+{
+  if (f)
+    fclose(f);
+  f = NULL;
+}
+
+/// Where a file system path is on the host
+std::string hostPath(const char *path)
+{
+  return hostRoot + path;
+}
+
+File HostFS::open(const char *path, const char *mode)
+{
+  std::string full = hostPath(path);
+
+  if (mode[0] == 'w')
+  { // Make the directories it goes in, as LittleFS does
+    for (size_t i = 1; (i = full.find('/', i)) != std::string::npos; i++)
+      mkdir(full.substr(0, i).c_str(), 0777);
+  }
+  std::string m = std::string(mode) + "b";
+  return File(fopen(full.c_str(), m.c_str()));
+}
+
+bool HostFS::exists(const char *path)
+{
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool HostFS::remove(const char *path)
+{
+  return ::remove(hostPath(path).c_str()) == 0;
+}
+
+bool HostFS::rename(const char *from, const char *to)
+{
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool HostFS::info(FSInfo &info)
+{
+  memset(&info, 0, sizeof(info));
+  info.blockSize = 4096;
+  return true;
+}
+
+Dir HostFS::openDir(const char *path)
+{
+  return Dir(opendir(hostPath(path).c_str()));
+}
+
+/// Move on to the next file, skipping directories
+bool Dir::next()
+{
+  struct dirent *entry;
+
+  while (d && (entry = readdir(d)))
+  {
+    if (entry->d_type == DT_DIR)
+      continue;
+    name = entry->d_name;
+    return true;
+  }
+  return false;
+}
+
+Config &getConfig()
+{
+  return hostConfig;
+}
@@ -0,0 +1,158 @@
+#ifndef HOST_H
+#define HOST_H
+
+// Host build support
+//
+// Just enough of the Arduino core, FastLED (see hostled.h) and LittleFS for the
+// firmware's bitmap code (transcode.cpp, codec.cpp, files.cpp, gamma.cpp and power.cpp)
+// to be built on a PC, so the batch converter converts images exactly as an upload does.
+// LittleFS paths are mapped onto a directory on the host (see hostRoot). Included by
+// pixelstick.h when PIXELSTICK_HOST is defined.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <string>
+#include <type_traits>
+#include "hostled.h"
+
+#define PROGMEM
+#define F(s) s
+#define FPSTR(s) s
+typedef uint8_t byte;
+#define memcpy_P memcpy
+#define strlcpy hostStrlcpy // Not in every C library
+
+size_t hostStrlcpy(char *dst, const char *src, size_t size);
+
+extern std::string hostRoot; // Directory the file system is kept in
+extern bool hostVerbose;     // Show what the firmware code prints
+extern uint64_t hostReadBytes; // Bytes asked for from files, for the host checks
+extern uint32_t hostReadMicros; // Time each file read takes on top of the host's own, to stand in for the flash
+
+unsigned long millis();
+unsigned long micros();
+void delayMicroseconds(unsigned long us);
+void yield();
+long random(long howbig);
+
+struct HostESP
+{
+  uint32_t getFreeHeap() { return 40000; } // About what the stick has once it's running
+};
+extern HostESP ESP;
+
+class String : public std::string
+{
+public:
+  String() {}
+  String(const char *s) : std::string(s) {}
+  String(const std::string &s) : std::string(s) {}
+  template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+  explicit String(T value) : std::string(std::to_string(value)) {}
+  String &operator+=(const char *s)
+  {
+    append(s);
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    push_back(c);
+    return *this;
+  }
+  String &operator+=(const std::string &s)
+  {
+    append(s);
+    return *this;
+  }
+  template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+  String &operator+=(T value)
+  {
+    append(std::to_string(value));
+    return *this;
+  }
+  bool startsWith(const char *s) const { return compare(0, strlen(s), s) == 0; }
+  bool endsWith(const char *s) const { return size() >= strlen(s) && compare(size() - strlen(s), npos, s) == 0; }
+};
+
+struct HostSerial
+{
+  void print(const char *s);
+  void print(unsigned long n);
+  void println(const char *s = "");
+  void println(unsigned long n);
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+extern HostSerial Serial;
+
+enum SeekMode
+{
+  SeekSet = SEEK_SET,
+  SeekCur = SEEK_CUR,
+  SeekEnd = SEEK_END
+};
+
+class File
+{
+public:
+  File() : f(NULL) {}
+  File(FILE *file) : f(file) {}
+  size_t read(uint8_t *buf, size_t len)
+  {
+    hostReadBytes += len;
+    if (hostReadMicros)
+      delayMicroseconds(hostReadMicros);
+    return f ? fread(buf, 1, len, f) : 0;
+  }
+  size_t write(const uint8_t *buf, size_t len) { return f ? fwrite(buf, 1, len, f) : 0; }
+  bool seek(uint32_t pos, SeekMode mode) { return f && fseek(f, pos, mode) == 0; }
+  size_t position() const { return f ? ftell(f) : 0; }
+  size_t size() const;
+  void close();
+  operator bool() const { return f != NULL; }
+
+private:
+  FILE *f;
+};
+
+class Dir
+{
+public:
+  Dir(DIR *dir = NULL) : d(dir) {}
+  Dir(const Dir &) = delete;
+  Dir(Dir &&other) : d(other.d), name(other.name) { other.d = NULL; }
+  ~Dir()
+  {
+    if (d)
+      closedir(d);
+  }
+  bool next();
+  String fileName() const { return name; }
+
+private:
+  DIR *d;
+  String name;
+};
+
+struct FSInfo
+{
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+};
+
+struct HostFS
+{
+  File open(const char *path, const char *mode);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  bool rename(const char *from, const char *to);
+  bool info(FSInfo &info);
+  Dir openDir(const char *path);
+};
+extern HostFS LittleFS;
+
+#endif
@@ -0,0 +1,263 @@
+#include "pixelstick.h"
+
+// Host versions of the FastLED functions in hostled.h too big to be inline, and the
+// palettes FastLED comes with
+
+CRGB &nblend(CRGB &existing, const CRGB &overlay, fract8 amountOfOverlay)
+{
+  if (amountOfOverlay == 0)
+    return existing;
+  if (amountOfOverlay == 255)
+    return existing = overlay;
+  return existing.setRGB(blend8(existing.r, overlay.r, amountOfOverlay), blend8(existing.g, overlay.g, amountOfOverlay),
+                         blend8(existing.b, overlay.b, amountOfOverlay));
+}
+
+CRGB blend(const CRGB &p1, const CRGB &p2, fract8 amountOfP2)
+{
+  CRGB nu(p1);
+  return nblend(nu, p2, amountOfP2);
+}
+
+void fill_solid(CRGB *leds, int count, const CRGB &colour)
+{
+  for (int i = 0; i < count; i++)
+    leds[i] = colour;
+}
+
+HostStrip hostStrip;
+CFastLED FastLED;
+
+void CFastLED::show(uint8_t scale)
+{
+  if (!controller || !controller->leds)
+    return;
+  int count = controller->ledCount < HOST_STRIP_MAX ? controller->ledCount : HOST_STRIP_MAX;
+  for (int i = 0; i < count; i++)
+    hostStrip.leds[i] = CRGB(controller->leds[i]).nscale8(scale);
+  hostStrip.shows++;
+  hostStrip.clocked += count;
+}
+
+void CFastLED::clear(bool writeData)
+{
+  if (controller && controller->leds)
+    fill_solid(controller->leds, controller->ledCount, CRGB::Black);
+  if (writeData)
+    show(0);
+}
+
+uint16_t rand16seed = 1337; // RAND16_SEED
+
+CRGB::CRGB(const CHSV &hsv)
+{
+  hsv2rgb_rainbow(hsv, *this);
+}
+
+CRGB &CRGB::operator=(const CHSV &hsv)
+{
+  hsv2rgb_rainbow(hsv, *this);
+  return *this;
+}
+
+/// FastLED's default HSV conversion: eight hue sections of 32 with yellow boosted
+/// (Y1), and the saturation and value applied with scale8
+void hsv2rgb_rainbow(const CHSV &hsv, CRGB &rgb)
+{
+  uint8_t hue = hsv.h;
+  uint8_t sat = hsv.s;
+  uint8_t val = hsv.v;
+  uint8_t offset8 = (hue & 0x1F) << 3;
+  uint8_t third = scale8(offset8, 256 / 3);         // Max 85
+  uint8_t twothirds = scale8(offset8, 256 * 2 / 3); // Max 170
+  uint8_t r, g, b;
+
+  switch (hue >> 5)
+  {
+  case 0: // Red to orange
+    r = 255 - third;
+    g = third;
+    b = 0;
+    break;
+  case 1: // Orange to yellow
+    r = 171;
+    g = 85 + third;
+    b = 0;
+    break;
+  case 2: // Yellow to green
+    r = 171 - twothirds;
+    g = 170 + third;
+    b = 0;
+    break;
+  case 3: // Green to aqua
+    r = 0;
+    g = 255 - third;
+    b = third;
+    break;
+  case 4: // Aqua to blue
+    r = 0;
+    g = 171 - twothirds;
+    b = 85 + twothirds;
+    break;
+  case 5: // Blue to purple
+    r = third;
+    g = 0;
+    b = 255 - third;
+    break;
+  case 6: // Purple to pink
+    r = 85 + third;
+    g = 0;
+    b = 171 - third;
+    break;
+  default: // Pink to red
+    r = 170 + third;
+    g = 0;
+    b = 85 - third;
+    break;
+  }
+
+  if (sat != 255)
+  {
+    if (sat == 0)
+      r = g = b = 255;
+    else
+    {
+      uint8_t desat = scale8_video(255 - sat, 255 - sat);
+      uint8_t satscale = 255 - desat;
+      r = scale8(r, satscale) + desat;
+      g = scale8(g, satscale) + desat;
+      b = scale8(b, satscale) + desat;
+    }
+  }
+  if (val != 255)
+  {
+    val = scale8_video(val, val);
+    if (val == 0)
+      r = g = b = 0;
+    else
+    {
+      r = scale8(r, val);
+      g = scale8(g, val);
+      b = scale8(b, val);
+    }
+  }
+  rgb.setRGB(r, g, b);
+}
+
+void fill_rainbow(CRGB *leds, int count, uint8_t initialhue, uint8_t deltahue)
+{
+  CHSV hsv(initialhue, 240, 255);
+
+  for (int i = 0; i < count; i++, hsv.h += deltahue)
+    leds[i] = hsv;
+}
+
+void fill_gradient_RGB(CRGB *leds, uint16_t startpos, CRGB startcolor, uint16_t endpos, CRGB endcolor)
+{
+  if (endpos < startpos)
+  {
+    uint16_t t = endpos;
+    CRGB tc = endcolor;
+    endcolor = startcolor;
+    endpos = startpos;
+    startpos = t;
+    startcolor = tc;
+  }
+
+  saccum87 rdistance87 = (endcolor.r - startcolor.r) << 7;
+  saccum87 gdistance87 = (endcolor.g - startcolor.g) << 7;
+  saccum87 bdistance87 = (endcolor.b - startcolor.b) << 7;
+  uint16_t pixeldistance = endpos - startpos;
+  int16_t divisor = pixeldistance ? pixeldistance : 1;
+  saccum87 rdelta87 = (rdistance87 / divisor) * 2;
+  saccum87 gdelta87 = (gdistance87 / divisor) * 2;
+  saccum87 bdelta87 = (bdistance87 / divisor) * 2;
+  accum88 r88 = startcolor.r << 8;
+  accum88 g88 = startcolor.g << 8;
+  accum88 b88 = startcolor.b << 8;
+
+  for (uint16_t i = startpos; i <= endpos; i++)
+  {
+    leds[i] = CRGB(r88 >> 8, g88 >> 8, b88 >> 8);
+    r88 += rdelta87;
+    g88 += gdelta87;
+    b88 += bdelta87;
+  }
+}
+
+void fill_gradient_RGB(CRGB *leds, uint16_t num, const CRGB &c1, const CRGB &c2, const CRGB &c3, const CRGB &c4)
+{
+  uint16_t onethird = num / 3;
+  uint16_t twothirds = num * 2 / 3;
+  uint16_t last = num - 1;
+
+  fill_gradient_RGB(leds, 0, c1, onethird, c2);
+  fill_gradient_RGB(leds, onethird, c2, twothirds, c3);
+  fill_gradient_RGB(leds, twothirds, c3, last, c4);
+}
+
+CRGB ColorFromPalette(const CRGBPalette16 &pal, uint8_t index, uint8_t brightness, TBlendType blendType)
+{
+  uint8_t hi4 = index >> 4;
+  uint8_t lo4 = index & 0x0F;
+  const CRGB &entry = pal[hi4];
+  uint8_t red1 = entry.r;
+  uint8_t green1 = entry.g;
+  uint8_t blue1 = entry.b;
+
+  if (lo4 && blendType != NOBLEND)
+  {
+    const CRGB &next = pal[(hi4 + 1) & 0x0F];
+    uint8_t f2 = lo4 << 4;
+    uint8_t f1 = 255 - f2;
+    red1 = scale8(red1, f1) + scale8(next.r, f2);
+    green1 = scale8(green1, f1) + scale8(next.g, f2);
+    blue1 = scale8(blue1, f1) + scale8(next.b, f2);
+  }
+
+  if (brightness != 255)
+  {
+    if (brightness)
+    {
+      brightness++; // Adjust for rounding
+      red1 = scale8(red1, brightness);
+      green1 = scale8(green1, brightness);
+      blue1 = scale8(blue1, brightness);
+    }
+    else
+      red1 = green1 = blue1 = 0;
+  }
+  return CRGB(red1, green1, blue1);
+}
+
+extern const TProgmemRGBPalette16 CloudColors_p = {
+    0x0000FF, 0x00008B, 0x00008B, 0x00008B, 0x00008B, 0x00008B, 0x00008B, 0x00008B,
+    0x0000FF, 0x00008B, 0x87CEEB, 0x87CEEB, 0xADD8E6, 0xFFFFFF, 0xADD8E6, 0x87CEEB};
+
+extern const TProgmemRGBPalette16 LavaColors_p = {
+    0x000000, 0x800000, 0x000000, 0x800000, 0x8B0000, 0x8B0000, 0x800000, 0x8B0000,
+    0x8B0000, 0x8B0000, 0xFF0000, 0xFFA500, 0xFFFFFF, 0xFFA500, 0xFF0000, 0x8B0000};
+
+extern const TProgmemRGBPalette16 OceanColors_p = {
+    0x191970, 0x00008B, 0x191970, 0x000080, 0x00008B, 0x0000CD, 0x2E8B57, 0x008080,
+    0x5F9EA0, 0x0000FF, 0x008B8B, 0x6495ED, 0x7FFFD4, 0x2E8B57, 0x00FFFF, 0x87CEFA};
+
+extern const TProgmemRGBPalette16 ForestColors_p = {
+    0x006400, 0x006400, 0x556B2F, 0x006400, 0x008000, 0x228B22, 0x6B8E23, 0x008000,
+    0x2E8B57, 0x66CDAA, 0x32CD32, 0x9ACD32, 0x90EE90, 0x7CFC00, 0x66CDAA, 0x228B22};
+
+extern const TProgmemRGBPalette16 RainbowColors_p = {
+    0xFF0000, 0xD52A00, 0xAB5500, 0xAB7F00, 0xABAB00, 0x56D500, 0x00FF00, 0x00D52A,
+    0x00AB55, 0x0056AA, 0x0000FF, 0x2A00D5, 0x5500AB, 0x7F0081, 0xAB0055, 0xD5002B};
+
+extern const TProgmemRGBPalette16 RainbowStripeColors_p = {
+    0xFF0000, 0x000000, 0xAB5500, 0x000000, 0xABAB00, 0x000000, 0x00FF00, 0x000000,
+    0x00AB55, 0x000000, 0x0000FF, 0x000000, 0x5500AB, 0x000000, 0xAB0055, 0x000000};
+
+extern const TProgmemRGBPalette16 PartyColors_p = {
+    0x5500AB, 0x84007C, 0xB5004B, 0xE5001B, 0xE81700, 0xB84700, 0xAB7700, 0xABAB00,
+    0xAB5500, 0xDD2200, 0xF2000E, 0xC2003E, 0x8F0071, 0x5F00A1, 0x2F00D0, 0x0007F9};
+
+extern const TProgmemRGBPalette16 HeatColors_p = {
+    0x000000, 0x330000, 0x660000, 0x990000, 0xCC0000, 0xFF0000, 0xFF3300, 0xFF6600,
+    0xFF9900, 0xFFCC00, 0xFFFF00, 0xFFFF33, 0xFFFF66, 0xFFFF99, 0xFFFFCC, 0xFFFFFF};
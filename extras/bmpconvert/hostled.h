@@ -0,0 +1,320 @@
+#ifndef HOSTLED_H
+#define HOSTLED_H
+
+// Host build support: FastLED
+//
+// The parts of FastLED the firmware uses, for host builds. The maths is FastLED's own C
+// code (lib8tion with FASTLED_SCALE8_FIXED and FASTLED_BLEND_FIXED, as the ESP8266 gets
+// it), so the host checks can hold the firmware's shortcuts up against what they stand
+// in for, and the presets draw on a PC what they draw on the stick. The beat functions
+// take the time from get_millisecond_timer(), as pixelstick.h has them do on the stick.
+// show() doesn't drive a strip, it captures what the strip would be left showing, so a
+// check can see what the LEDs look like after the firmware has sent only some of them.
+// Included by host.h.
+
+#include <stdint.h>
+
+typedef uint8_t fract8;
+typedef uint16_t accum88;
+typedef int16_t saccum87;
+
+#define FL_PROGMEM
+
+uint32_t get_millisecond_timer(); // The beat functions' clock (USE_GET_MILLISECOND_TIMER)
+
+inline uint8_t scale8(uint8_t i, uint8_t scale) { return ((uint16_t)i * (1 + (uint16_t)scale)) >> 8; }
+inline uint8_t scale8_video(uint8_t i, uint8_t scale) { return (((uint16_t)i * scale) >> 8) + (i && scale ? 1 : 0); }
+inline uint16_t scale16(uint16_t i, uint16_t scale) { return ((uint32_t)i * (1 + (uint32_t)scale)) >> 16; }
+
+inline uint8_t qadd8(uint8_t i, uint8_t j)
+{
+  uint16_t t = i + j;
+  return t > 255 ? 255 : t;
+}
+
+inline uint8_t qsub8(uint8_t i, uint8_t j)
+{
+  int16_t t = i - j;
+  return t < 0 ? 0 : t;
+}
+
+inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t amountOfB)
+{
+  uint16_t partial = (a << 8) | b;
+  partial += b * amountOfB;
+  partial -= a * amountOfB;
+  return partial >> 8;
+}
+
+inline uint8_t triwave8(uint8_t in)
+{
+  if (in & 0x80)
+    in = 255 - in;
+  return in << 1;
+}
+
+inline int16_t sin16(uint16_t theta)
+{
+  static const uint16_t base[] = {0, 6393, 12539, 18204, 23170, 27245, 30273, 32137};
+  static const uint8_t slope[] = {49, 48, 44, 38, 31, 23, 14, 4};
+
+  uint16_t offset = (theta & 0x3FFF) >> 3; // 0..2047
+  if (theta & 0x4000)
+    offset = 2047 - offset;
+  uint8_t section = offset / 256; // 0..7
+  uint8_t secoffset8 = (uint8_t)offset / 2;
+  int16_t y = (uint16_t)(slope[section] * secoffset8) + base[section];
+  return theta & 0x8000 ? -y : y;
+}
+
+inline uint8_t sin8(uint8_t theta)
+{
+  static const uint8_t interleave[] = {0, 49, 49, 41, 90, 27, 117, 10};
+
+  uint8_t offset = theta & 0x40 ? 255 - theta : theta;
+  offset &= 0x3F; // 0..63
+  uint8_t secoffset = offset & 0x0F; // 0..15
+  if (theta & 0x40)
+    secoffset++;
+  uint8_t section = offset >> 4; // 0..3
+  uint8_t mx = (interleave[section * 2 + 1] * secoffset) >> 4;
+  int8_t y = mx + interleave[section * 2];
+  if (theta & 0x80)
+    y = -y;
+  return y + 128;
+}
+
+inline uint8_t cos8(uint8_t theta) { return sin8(theta + 64); }
+
+extern uint16_t rand16seed;
+
+inline uint8_t random8()
+{
+  rand16seed = (rand16seed * 2053) + 13849;
+  return (uint8_t)(rand16seed & 0xFF) + (uint8_t)(rand16seed >> 8);
+}
+inline uint8_t random8(uint8_t lim) { return (random8() * lim) >> 8; }
+inline uint8_t random8(uint8_t min, uint8_t lim) { return random8(lim - min) + min; }
+inline uint16_t random16()
+{
+  rand16seed = (rand16seed * 2053) + 13849;
+  return rand16seed;
+}
+inline uint16_t random16(uint16_t lim) { return ((uint32_t)lim * random16()) >> 16; }
+inline void random16_set_seed(uint16_t seed) { rand16seed = seed; }
+inline uint16_t random16_get_seed() { return rand16seed; }
+inline void random16_add_entropy(uint16_t entropy) { rand16seed += entropy; }
+
+inline uint16_t beat88(accum88 beats_per_minute_88, uint32_t timebase = 0)
+{
+  return ((get_millisecond_timer() - timebase) * beats_per_minute_88 * 280) >> 16;
+}
+inline uint16_t beat16(accum88 beats_per_minute, uint32_t timebase = 0)
+{
+  if (beats_per_minute < 256)
+    beats_per_minute <<= 8;
+  return beat88(beats_per_minute, timebase);
+}
+inline uint8_t beat8(accum88 beats_per_minute, uint32_t timebase = 0) { return beat16(beats_per_minute, timebase) >> 8; }
+
+inline uint16_t beatsin88(accum88 beats_per_minute_88, uint16_t lowest = 0, uint16_t highest = 65535, uint32_t timebase = 0,
+                          uint16_t phase_offset = 0)
+{
+  uint16_t beatsin = sin16(beat88(beats_per_minute_88, timebase) + phase_offset) + 32768;
+  return lowest + scale16(beatsin, highest - lowest);
+}
+inline uint16_t beatsin16(accum88 beats_per_minute, uint16_t lowest = 0, uint16_t highest = 65535, uint32_t timebase = 0,
+                          uint16_t phase_offset = 0)
+{
+  uint16_t beatsin = sin16(beat16(beats_per_minute, timebase) + phase_offset) + 32768;
+  return lowest + scale16(beatsin, highest - lowest);
+}
+inline uint8_t beatsin8(accum88 beats_per_minute, uint8_t lowest = 0, uint8_t highest = 255, uint32_t timebase = 0,
+                        uint8_t phase_offset = 0)
+{
+  uint8_t beatsin = sin8(beat8(beats_per_minute, timebase) + phase_offset);
+  return lowest + scale8(beatsin, highest - lowest);
+}
+
+struct CHSV
+{
+  union
+  {
+    struct
+    {
+      uint8_t h, s, v;
+    };
+    uint8_t raw[3];
+  };
+  CHSV() {}
+  CHSV(uint8_t ih, uint8_t is, uint8_t iv) : h(ih), s(is), v(iv) {}
+};
+
+struct CRGB
+{
+  union
+  {
+    struct
+    {
+      uint8_t r, g, b;
+    };
+    uint8_t raw[3];
+  };
+
+  enum HTMLColorCode : uint32_t
+  {
+    Aqua = 0x00FFFF,
+    Black = 0x000000,
+    Blue = 0x0000FF,
+    FairyLight = 0xFFE42D,
+    Gray = 0x808080,
+    Green = 0x008000,
+    Red = 0xFF0000,
+    White = 0xFFFFFF,
+    Yellow = 0xFFFF00
+  };
+
+  CRGB() {}
+  CRGB(uint8_t ir, uint8_t ig, uint8_t ib) : r(ir), g(ig), b(ib) {}
+  CRGB(uint32_t colour) : r(colour >> 16), g(colour >> 8), b(colour) {}
+  CRGB(HTMLColorCode colour) : CRGB((uint32_t)colour) {}
+  CRGB(const CHSV &hsv);
+  CRGB &operator=(const CHSV &hsv);
+
+  uint8_t &operator[](uint8_t x) { return raw[x]; }
+  const uint8_t &operator[](uint8_t x) const { return raw[x]; }
+
+  CRGB &setRGB(uint8_t nr, uint8_t ng, uint8_t nb)
+  {
+    r = nr;
+    g = ng;
+    b = nb;
+    return *this;
+  }
+  CRGB &operator+=(const CRGB &rhs)
+  {
+    return setRGB(qadd8(r, rhs.r), qadd8(g, rhs.g), qadd8(b, rhs.b));
+  }
+  CRGB &operator-=(const CRGB &rhs)
+  {
+    return setRGB(qsub8(r, rhs.r), qsub8(g, rhs.g), qsub8(b, rhs.b));
+  }
+  CRGB &nscale8(uint8_t scale) { return setRGB(scale8(r, scale), scale8(g, scale), scale8(b, scale)); }
+  CRGB &nscale8_video(uint8_t scale)
+  {
+    return setRGB(scale8_video(r, scale), scale8_video(g, scale), scale8_video(b, scale));
+  }
+  CRGB &fadeToBlackBy(uint8_t fade) { return nscale8(255 - fade); }
+  uint8_t getAverageLight() const { return scale8(r, 85) + scale8(g, 85) + scale8(b, 85); }
+  explicit operator bool() const { return r || g || b; }
+};
+
+inline bool operator==(const CRGB &lhs, const CRGB &rhs) { return lhs.r == rhs.r && lhs.g == rhs.g && lhs.b == rhs.b; }
+inline bool operator!=(const CRGB &lhs, const CRGB &rhs) { return !(lhs == rhs); }
+
+inline CRGB operator+(const CRGB &lhs, const CRGB &rhs) { return CRGB(lhs) += rhs; }
+inline CRGB operator-(const CRGB &lhs, const CRGB &rhs) { return CRGB(lhs) -= rhs; }
+
+CRGB &nblend(CRGB &existing, const CRGB &overlay, fract8 amountOfOverlay);
+CRGB blend(const CRGB &p1, const CRGB &p2, fract8 amountOfP2);
+void fill_solid(CRGB *leds, int count, const CRGB &colour);
+void fill_rainbow(CRGB *leds, int count, uint8_t initialhue, uint8_t deltahue = 5);
+void fill_gradient_RGB(CRGB *leds, uint16_t startpos, CRGB startcolor, uint16_t endpos, CRGB endcolor);
+void fill_gradient_RGB(CRGB *leds, uint16_t num, const CRGB &c1, const CRGB &c2, const CRGB &c3, const CRGB &c4);
+void hsv2rgb_rainbow(const CHSV &hsv, CRGB &rgb);
+
+#define HOST_STRIP_MAX 1024 // Longest strip the capture can hold
+
+/// What the strip is showing. show() clocks LEDs out into it as the strip would latch
+/// them, with the brightness applied, and leaves the LEDs past the ones sent as they were.
+struct HostStrip
+{
+  CRGB leds[HOST_STRIP_MAX];
+  uint32_t shows;   // Times show() has sent anything
+  uint32_t clocked; // LEDs sent in all
+};
+
+extern HostStrip hostStrip;
+
+/// The controller addLeds() gives back. setLeds() sets how many LEDs are sent, as it
+/// does on the stick.
+class CLEDController
+{
+public:
+  CLEDController &setLeds(CRGB *data, int count)
+  {
+    leds = data;
+    ledCount = count;
+    return *this;
+  }
+  int size() const { return ledCount; }
+  CRGB *leds = nullptr;
+  int ledCount = 0;
+};
+
+/// FastLED's global, driving the one controller the firmware has, into hostStrip
+class CFastLED
+{
+public:
+  CLEDController &addLeds(CLEDController *controller, CRGB *data, int count)
+  {
+    this->controller = controller;
+    return controller->setLeds(data, count);
+  }
+  void setBrightness(uint8_t scale) { brightness = scale; }
+  uint8_t getBrightness() const { return brightness; }
+  void show(uint8_t scale);
+  void show() { show(brightness); }
+  void clear(bool writeData = false); // Only clears the LEDs the controller was last set to send
+private:
+  CLEDController *controller = nullptr;
+  uint8_t brightness = 255;
+};
+
+extern CFastLED FastLED;
+
+typedef const uint32_t TProgmemRGBPalette16[16];
+
+enum TBlendType
+{
+  NOBLEND = 0,
+  LINEARBLEND = 1
+};
+
+struct CRGBPalette16
+{
+  CRGB entries[16];
+
+  CRGBPalette16() {}
+  CRGBPalette16(const CRGB &c00, const CRGB &c01, const CRGB &c02, const CRGB &c03, const CRGB &c04, const CRGB &c05,
+                const CRGB &c06, const CRGB &c07, const CRGB &c08, const CRGB &c09, const CRGB &c10, const CRGB &c11,
+                const CRGB &c12, const CRGB &c13, const CRGB &c14, const CRGB &c15)
+      : entries{c00, c01, c02, c03, c04, c05, c06, c07, c08, c09, c10, c11, c12, c13, c14, c15}
+  {
+  }
+  CRGBPalette16(const TProgmemRGBPalette16 &rhs)
+  {
+    for (uint8_t i = 0; i < 16; i++)
+      entries[i] = CRGB(rhs[i]);
+  }
+  CRGBPalette16(const CRGB &c1, const CRGB &c2, const CRGB &c3, const CRGB &c4)
+  {
+    fill_gradient_RGB(entries, 16, c1, c2, c3, c4);
+  }
+
+  CRGB &operator[](uint8_t x) { return entries[x]; }
+  const CRGB &operator[](uint8_t x) const { return entries[x]; }
+};
+
+CRGB ColorFromPalette(const CRGBPalette16 &pal, uint8_t index, uint8_t brightness = 255, TBlendType blendType = LINEARBLEND);
+
+extern const TProgmemRGBPalette16 CloudColors_p;
+extern const TProgmemRGBPalette16 LavaColors_p;
+extern const TProgmemRGBPalette16 OceanColors_p;
+extern const TProgmemRGBPalette16 ForestColors_p;
+extern const TProgmemRGBPalette16 RainbowColors_p;
+extern const TProgmemRGBPalette16 RainbowStripeColors_p;
+extern const TProgmemRGBPalette16 PartyColors_p;
+extern const TProgmemRGBPalette16 HeatColors_p;
+
+#endif
@@ -0,0 +1,26 @@
+#include "pixelstick.h"
+
+// Firmware the converter doesn't need - there's no index, cache, raw store or playback on a PC
+
+void updateBmpIndex(const char *) {}
+void dropCacheEntries(const char *) {}
+void rawStoreImport(const char *) {}
+uint32_t rawStoreFind(const char *, uint32_t) { return 0; }
+bool rawStoreRead(uint32_t, uint8_t *, uint32_t) { return false; }
+bool findBmpIndex(const char *, FileInfo &) { return false; }
+uint16_t readIndexPage(uint16_t, void (*)(const FileInfo &info, String &s), String &) { return 0; }
+uint16_t getBmpIndexCount() { return 0; }
+bool readRowStream(uint8_t *, uint16_t) { return false; }
+
+RowStreamStats rowStreamStats;
+FrameStats frameStats;
+
+RowStreamStats &getRowStreamStats()
+{
+  return rowStreamStats;
+}
+
+FrameStats &getFrameStats()
+{
+  return frameStats;
+}
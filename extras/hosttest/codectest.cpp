@@ -0,0 +1,202 @@
+// Row codec checks
+//
+// Codes rows of every kind the transcoder sees - random, flat, gradients, rows that
+// nearly match the one before, and rows picked to make RLE or LZ come out bigger than
+// the row itself - checking that the encoder never writes past the end of its buffers
+// and that every row decodes to what went in. Then times decoding a stick-sized image
+// coded each way, against just copying the raw rows.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+
+#define GUARD 64     // Bytes after each buffer that mustn't be touched
+#define GUARD_BYTE 0xA5
+#define BENCH_ROWS 2000
+
+uint16_t encodeRle(const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out);
+uint16_t encodeLz(const uint8_t *prev, const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out);
+uint16_t encodeRow(const uint8_t *prev, const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out, uint8_t *scratch);
+bool decodeRow(const uint8_t *prev, uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes);
+
+// The decoder reads from the read-ahead buffer on the stick - here it's a block of memory
+const uint8_t *streamData;
+uint32_t streamLeft;
+
+bool readRowStream(uint8_t *buf, uint16_t len)
+{
+  if (len > streamLeft)
+    return false;
+  memcpy(buf, streamData, len);
+  streamData += len;
+  streamLeft -= len;
+  return true;
+}
+
+uint8_t prev[MAX_BMP_WIDTH * 3];
+uint8_t row[MAX_BMP_WIDTH * 3];
+uint8_t decoded[MAX_BMP_WIDTH * 3];
+uint8_t out[ROW_CODE_MAX + GUARD];
+uint8_t scratch[ROW_CODE_MAX + GUARD];
+
+bool guardIntact(const uint8_t *buf, uint16_t from, uint16_t to)
+{
+  for (uint16_t i = from; i < to; i++)
+    if (buf[i] != GUARD_BYTE)
+      return false;
+  return true;
+}
+
+/// Code row, check nothing was written out of bounds and decode it again
+void roundTrip(const char *name, uint16_t rowBytes, uint8_t pixelBytes)
+{
+  memset(out, GUARD_BYTE, sizeof(out));
+  memset(scratch, GUARD_BYTE, sizeof(scratch));
+  uint16_t len = encodeRow(prev, row, rowBytes, pixelBytes, out, scratch);
+  CHECK(len <= rowBytes + 1, "%s: %u bytes coded to %u", name, rowBytes, len);
+  CHECK(guardIntact(out, rowBytes + 1, sizeof(out)), "%s: wrote past the end of out", name);
+  CHECK(guardIntact(scratch, rowBytes, sizeof(scratch)), "%s: wrote past the end of scratch", name);
+
+  // Each encoder on its own must stay inside the row too
+  memset(scratch, GUARD_BYTE, sizeof(scratch));
+  uint16_t rle = encodeRle(row, rowBytes, pixelBytes, scratch);
+  CHECK(rle <= rowBytes && guardIntact(scratch, rowBytes, sizeof(scratch)), "%s: RLE overran (%u)", name, rle);
+  memset(scratch, GUARD_BYTE, sizeof(scratch));
+  uint16_t lz = encodeLz(prev, row, rowBytes, pixelBytes, scratch);
+  CHECK(lz <= rowBytes && guardIntact(scratch, rowBytes, sizeof(scratch)), "%s: LZ overran (%u)", name, lz);
+
+  streamData = out;
+  streamLeft = len;
+  memset(decoded, 0, sizeof(decoded));
+  CHECK(decodeRow(prev, decoded, rowBytes, pixelBytes), "%s: didn't decode", name);
+  CHECK(memcmp(decoded, row, rowBytes) == 0, "%s: decoded row differs", name);
+  CHECK(streamLeft == 0, "%s: %u bytes left over", name, streamLeft);
+}
+
+void checkRows(uint16_t width, uint8_t pixelBytes)
+{
+  uint16_t rowBytes = width * pixelBytes;
+  char name[64];
+
+  snprintf(name, sizeof(name), "random %ux%u", width, pixelBytes);
+  for (uint16_t i = 0; i < rowBytes; i++)
+    prev[i] = hostRandom(), row[i] = hostRandom();
+  roundTrip(name, rowBytes, pixelBytes);
+
+  snprintf(name, sizeof(name), "flat %ux%u", width, pixelBytes);
+  memset(row, 0x42, rowBytes);
+  roundTrip(name, rowBytes, pixelBytes);
+
+  snprintf(name, sizeof(name), "gradient %ux%u", width, pixelBytes);
+  for (uint16_t i = 0; i < rowBytes; i++)
+    row[i] = i / pixelBytes * 255 / width;
+  roundTrip(name, rowBytes, pixelBytes);
+
+  // The previous row with every 4th byte changed: matches of three, each costing three
+  // bytes plus a literal - the row that used to overflow the encoder's buffer
+  snprintf(name, sizeof(name), "every 4th byte %ux%u", width, pixelBytes);
+  for (uint16_t i = 0; i < rowBytes; i++)
+    prev[i] = hostRandom();
+  memcpy(row, prev, rowBytes);
+  for (uint16_t i = 3; i < rowBytes; i += 4)
+    row[i] ^= 0xFF;
+  roundTrip(name, rowBytes, pixelBytes);
+
+  // Pairs of pixels then a different one: RLE spends two count bytes on every three pixels
+  snprintf(name, sizeof(name), "AAB %ux%u", width, pixelBytes);
+  for (uint16_t p = 0; p < width; p++)
+    for (uint8_t b = 0; b < pixelBytes; b++)
+      row[p * pixelBytes + b] = p % 3 == 2 ? 0x55 : p / 3 * 7 + b;
+  roundTrip(name, rowBytes, pixelBytes);
+
+  snprintf(name, sizeof(name), "nearly the same %ux%u", width, pixelBytes);
+  memcpy(row, prev, rowBytes);
+  for (uint8_t n = 0; n < 8; n++)
+    row[hostRandom() % rowBytes] = hostRandom();
+  roundTrip(name, rowBytes, pixelBytes);
+}
+
+/// Decode an image of BENCH_ROWS coded rows, returning the microseconds per row
+double benchDecode(const uint8_t *coded, uint32_t codedBytes, uint16_t rowBytes, uint8_t pixelBytes)
+{
+  uint32_t checksum = 0;
+  double start = hostSeconds();
+
+  streamData = coded;
+  streamLeft = codedBytes;
+  memset(prev, 0, rowBytes);
+  for (uint32_t r = 0; r < BENCH_ROWS; r++)
+  {
+    if (pixelBytes)
+    {
+      CHECK(decodeRow(prev, decoded, rowBytes, pixelBytes), "benchmark row %u didn't decode", r);
+    }
+    else
+      readRowStream(decoded, rowBytes); // Raw rows, for comparison
+    memcpy(prev, decoded, rowBytes);
+    checksum += decoded[r % rowBytes];
+  }
+  hostKeep(checksum);
+  return (hostSeconds() - start) * 1e6 / BENCH_ROWS;
+}
+
+/// Time decoding a painting-like image: a pattern that drifts along the strip with some noise
+void benchmark(uint16_t width)
+{
+  uint16_t rowBytes = width * 3;
+  uint8_t *raw = (uint8_t *)malloc((uint32_t)BENCH_ROWS * rowBytes);
+  uint8_t *coded = (uint8_t *)malloc((uint32_t)BENCH_ROWS * ROW_CODE_MAX);
+  uint32_t codedBytes = 0;
+  uint32_t counts[3] = {0, 0, 0};
+
+  memset(prev, 0, rowBytes);
+  for (uint32_t r = 0; r < BENCH_ROWS; r++)
+  {
+    uint8_t *p = raw + r * rowBytes;
+    for (uint16_t i = 0; i < width; i++)
+    {
+      uint8_t band = (i + r / 4) / 16;
+      p[i * 3] = band * 40;
+      p[i * 3 + 1] = band & 1 ? 200 : 0;
+      p[i * 3 + 2] = hostRandom() % 64 == 0 ? hostRandom() : 255 - band * 40;
+    }
+    uint16_t len = encodeRow(prev, p, rowBytes, 3, coded + codedBytes, scratch);
+    counts[coded[codedBytes]]++;
+    codedBytes += len;
+    memcpy(prev, p, rowBytes);
+  }
+
+  double rawMicros = benchDecode(raw, (uint32_t)BENCH_ROWS * rowBytes, rowBytes, 0);
+  double codedMicros = benchDecode(coded, codedBytes, rowBytes, 3);
+  printf("  %3u px: %5.1f%% of raw size (%u raw, %u RLE, %u LZ rows), %.2f us/row decoding vs %.2f us/row copying\n",
+         width, 100.0 * codedBytes / BENCH_ROWS / rowBytes, counts[ROW_RAW], counts[ROW_RLE], counts[ROW_LZ],
+         codedMicros, rawMicros);
+  free(raw);
+  free(coded);
+}
+
+int main()
+{
+  static const uint16_t widths[] = {1, 2, 3, 43, 127, 128, 129, NUM_LEDS, 300, MAX_BMP_WIDTH};
+
+  for (uint16_t w : widths)
+    for (uint8_t pixelBytes = 1; pixelBytes <= 3; pixelBytes++)
+      checkRows(w, pixelBytes);
+  for (uint32_t n = 0; n < 20000; n++)
+  { // Random mixes of runs, repeats and noise
+    uint8_t pixelBytes = 1 + hostRandom() % 3;
+    uint16_t width = 1 + hostRandom() % MAX_BMP_WIDTH;
+    uint16_t rowBytes = width * pixelBytes;
+    for (uint16_t i = 0; i < rowBytes; i++)
+    {
+      uint8_t kind = hostRandom() % 4;
+      row[i] = kind == 0 ? hostRandom() : kind == 1 ? prev[i] : i >= pixelBytes ? row[i - pixelBytes] : 0;
+    }
+    roundTrip("random mix", rowBytes, pixelBytes);
+    memcpy(prev, row, rowBytes);
+  }
+
+  printf("Decoding %u rows of RGB888\n", BENCH_ROWS);
+  benchmark(NUM_LEDS);
+  benchmark(MAX_BMP_WIDTH);
+  return hostTestResult("codec");
+}
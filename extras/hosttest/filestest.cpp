@@ -0,0 +1,57 @@
+// Bitmap header checks
+//
+// readBmpInfo() is what the stick relies on to refuse a file it can't play, so it must
+// turn down a native file whose header has been cut short (an upload that was stopped
+// part way, or a full file system) rather than play from whatever was on the stack.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+#include <unistd.h>
+
+void readBmpInfo(const char *path, FileInfo &info);
+
+/// Write the first length bytes of header to path
+void writeHeader(const char *path, const NativeHeader &header, size_t length)
+{
+  File f = LittleFS.open(path, "w");
+  f.write((const uint8_t *)&header, length);
+  f.close();
+}
+
+int main()
+{
+  char root[] = "/tmp/filestestXXXXXX";
+  NativeHeader header;
+  FileInfo info;
+
+  CHECK(mkdtemp(root), "can't make a directory to work in");
+  hostRoot = root;
+
+  memset(&header, 0, sizeof(header));
+  header.signature = NATIVE_SIGNATURE;
+  header.version = NATIVE_VERSION;
+  header.pixelFormat = PIXEL_RGB888;
+  header.width = NUM_LEDS;
+  header.height = 10;
+  header.dataOffset = sizeof(header);
+  header.codec = CODEC_NONE;
+
+  writeHeader("/bmp/whole.bmp", header, sizeof(header));
+  readBmpInfo("/bmp/whole.bmp", info);
+  CHECK(info.status == VALID, "whole header: status %u", info.status);
+  CHECK(info.bmpWidth == NUM_LEDS && info.bmpHeight == 10, "whole header: %ux%u", info.bmpWidth, info.bmpHeight);
+
+  // Anything from just the signature to one byte short
+  for (size_t length = sizeof(header.signature); length < sizeof(header); length++)
+  {
+    writeHeader("/bmp/short.bmp", header, length);
+    readBmpInfo("/bmp/short.bmp", info);
+    CHECK(info.status != VALID, "%zu of %zu header bytes read as valid", length, sizeof(header));
+  }
+
+  LittleFS.remove("/bmp/whole.bmp");
+  LittleFS.remove("/bmp/short.bmp");
+  rmdir((hostRoot + "/bmp").c_str());
+  rmdir(root);
+  return hostTestResult("files");
+}
@@ -0,0 +1,178 @@
+// Fixed colour checks
+//
+// For every number of colours from 1 to MAX_COLOURS, with random colours: bands cover
+// the whole strip in order, each within one LED of the same length, and are exactly
+// where they always were when the LEDs divide evenly; gradients match FastLED's 2, 3
+// and 4 colour gradients (and the old 5 colour one) exactly, starting each colour at
+// the same LED and ending within a level or two of the last; interleaved colours take
+// turns. Then that the frame is drawn again when, and only when, something that shows
+// changes, and what that saves.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+
+#define BENCH_FRAMES 20000
+
+const CRGB *getFixedFrame(uint32_t &load);
+uint32_t pixelLoad(const CRGB &c);
+
+RGBColour colours[MAX_COLOURS];
+CRGB cols[MAX_COLOURS];
+CRGB expect[NUM_LEDS];
+
+void randomColours()
+{
+  for (uint8_t i = 0; i < MAX_COLOURS; i++)
+  {
+    uint32_t r = hostRandom();
+    colours[i][0] = r;
+    colours[i][1] = r >> 8;
+    colours[i][2] = r >> 16;
+    cols[i] = CRGB(colours[i][0], colours[i][1], colours[i][2]);
+  }
+}
+
+const CRGB *draw(uint8_t count, bool gradient, bool interleave)
+{
+  uint32_t load;
+
+  getConfig().coloursUsed = count;
+  getConfig().gradient = gradient;
+  getConfig().interleave = interleave;
+  const CRGB *frame = getFixedFrame(load);
+  uint32_t sum = 0;
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    sum += pixelLoad(frame[i]);
+  CHECK(load == sum, "%u colours: load %u, not %u", count, load, sum);
+  return frame;
+}
+
+void checkBands(uint8_t count)
+{
+  const CRGB *frame = draw(count, false, false);
+  uint16_t shortest = NUM_LEDS, longest = 0;
+  uint16_t i = 0;
+
+  for (uint8_t band = 0; band < count; band++)
+  { // Colours are random, so a band runs while the LEDs are its colour
+    uint16_t start = i;
+    while (i < NUM_LEDS && frame[i] == cols[band])
+      i++;
+    CHECK(i > start, "%u colours: band %u is missing", count, band);
+    shortest = i - start < shortest ? i - start : shortest;
+    longest = i - start > longest ? i - start : longest;
+  }
+  CHECK(i == NUM_LEDS, "%u colours: LEDs from %u aren't in a band", count, i);
+  CHECK(longest - shortest <= 1, "%u colours: bands are %u to %u LEDs", count, shortest, longest);
+  if (NUM_LEDS % count == 0)
+    for (i = 0; i < NUM_LEDS; i++)
+      CHECK(frame[i] == cols[i / (NUM_LEDS / count)], "%u colours: LED %u isn't where it was", count, i);
+}
+
+/// What FastLED's own gradients gave, as the fixed colours used to be drawn
+void referenceGradient(uint8_t count)
+{
+  switch (count)
+  {
+  case 1:
+    fill_solid(expect, NUM_LEDS, cols[0]);
+    break;
+  case 2:
+    fill_gradient_RGB(expect, 0, cols[0], NUM_LEDS - 1, cols[1]);
+    break;
+  case 3:
+    fill_gradient_RGB(expect, 0, cols[0], NUM_LEDS / 2, cols[1]);
+    fill_gradient_RGB(expect, NUM_LEDS / 2, cols[1], NUM_LEDS - 1, cols[2]);
+    break;
+  case 4:
+    fill_gradient_RGB(expect, NUM_LEDS, cols[0], cols[1], cols[2], cols[3]);
+    break;
+  default: // Five, a quarter of the strip for each step
+    for (uint8_t i = 0; i < count - 1; i++)
+      fill_gradient_RGB(expect, i * NUM_LEDS / 4, cols[i], i == 3 ? NUM_LEDS - 1 : (i + 1) * NUM_LEDS / 4, cols[i + 1]);
+    break;
+  }
+}
+
+void checkGradient(uint8_t count)
+{
+  const CRGB *frame = draw(count, true, false);
+
+  referenceGradient(count);
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    if (frame[i] != expect[i])
+    {
+      CHECK(false, "%u colour gradient: LED %u is %02X%02X%02X, not %02X%02X%02X", count, i, frame[i].r, frame[i].g, frame[i].b,
+            expect[i].r, expect[i].g, expect[i].b);
+      break;
+    }
+  for (uint8_t i = 0; i < count - 1; i++)
+  {
+    uint16_t at = i * NUM_LEDS / (count - 1);
+    CHECK(frame[at] == cols[i], "%u colour gradient: colour %u isn't at LED %u", count, i, at);
+  }
+  // FastLED's steps are rounded down, so the last LED can fall a little short
+  const CRGB &last = frame[NUM_LEDS - 1], &end = cols[count - 1];
+  CHECK(abs(last.r - end.r) <= 2 && abs(last.g - end.g) <= 2 && abs(last.b - end.b) <= 2,
+        "%u colour gradient doesn't end on the last colour", count);
+}
+
+void checkInterleave(uint8_t count)
+{
+  const CRGB *frame = draw(count, false, true);
+
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    CHECK(frame[i] == cols[i % count], "%u colours interleaved: LED %u is the wrong colour", count, i);
+}
+
+/// The frame is kept while nothing that shows changes, and drawn again as soon as
+/// something does
+void checkRedraw()
+{
+  CRGB before[NUM_LEDS];
+
+  randomColours();
+  memcpy(before, draw(2, false, false), sizeof(before));
+  colours[4][0]++; // Not in use
+  CHECK(!memcmp(before, draw(2, false, false), sizeof(before)), "frame changed for a colour that isn't used");
+  colours[1][2]++;
+  cols[1].b++;
+  CHECK(draw(2, false, false)[NUM_LEDS - 1] == cols[1], "frame wasn't drawn again when a colour changed");
+  CHECK(draw(2, true, false)[NUM_LEDS / 2] != before[NUM_LEDS / 2], "frame wasn't drawn again for a gradient");
+  CHECK(draw(2, true, true)[1] == cols[1], "frame wasn't drawn again when interleaved");
+  CHECK(draw(3, true, true)[2] == cols[2], "frame wasn't drawn again for another colour");
+  CHECK(draw(0, false, false)[NUM_LEDS - 1] == cols[0], "no colours isn't one colour");
+  CHECK(draw(MAX_COLOURS + 3, false, true)[MAX_COLOURS] == cols[0], "more colours than there are isn't all of them");
+}
+
+int main()
+{
+  for (uint8_t pass = 0; pass < 20; pass++)
+  {
+    randomColours();
+    for (uint8_t count = 1; count <= MAX_COLOURS; count++)
+    {
+      checkBands(count);
+      checkGradient(count);
+      checkInterleave(count);
+    }
+  }
+  checkRedraw();
+  printf("Bands, gradients and interleaving right for 1-%u colours\n", MAX_COLOURS);
+
+  uint32_t load;
+  draw(MAX_COLOURS, true, false);
+  double start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++)
+    hostKeep(getFixedFrame(load)[n % NUM_LEDS].r);
+  double kept = (hostSeconds() - start) * 1e6 / BENCH_FRAMES;
+  start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++)
+  {
+    colours[n % MAX_COLOURS][n % 3]++;
+    hostKeep(getFixedFrame(load)[n % NUM_LEDS].r);
+  }
+  double drawn = (hostSeconds() - start) * 1e6 / BENCH_FRAMES;
+  printf("%u colour gradient: %.2f us a frame kept vs %.2f us drawn again\n", MAX_COLOURS, kept, drawn);
+  return hostTestResult("fixed");
+}
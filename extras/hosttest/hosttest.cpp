@@ -0,0 +1,54 @@
+#include "hosttest.h"
+#include <stdarg.h>
+#include <time.h>
+
+// Support for the host checks
+
+#define MAX_REPORTED 20 // Failures printed before the rest are just counted
+
+uint32_t failures;
+uint32_t randomState = 2463534242U;
+volatile uint32_t kept;
+
+void hostTestFail(const char *file, int line, const char *format, ...)
+{
+  va_list args;
+
+  if (failures++ >= MAX_REPORTED)
+    return;
+  fprintf(stderr, "%s:%d: ", file, line);
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+/// Report how the check went. Returns the exit status for main().
+int hostTestResult(const char *name)
+{
+  if (failures)
+    printf("%s: %u FAILED\n", name, failures);
+  else
+    printf("%s: ok\n", name);
+  return failures ? 1 : 0;
+}
+
+uint32_t hostRandom()
+{ // xorshift32
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+double hostSeconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void hostKeep(uint32_t value)
+{
+  kept += value;
+}
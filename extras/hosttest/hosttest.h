@@ -0,0 +1,26 @@
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+// Host checks
+//
+// Each check is a small program built from the firmware's own source and the host
+// shim in extras/bmpconvert. It prints what it measures, reports each failure with
+// CHECK() and exits non-zero if anything failed (see hostTestResult()).
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CHECK(cond, ...)                    \
+  do                                        \
+  {                                         \
+    if (!(cond))                            \
+      hostTestFail(__FILE__, __LINE__, __VA_ARGS__); \
+  } while (0)
+
+void hostTestFail(const char *file, int line, const char *format, ...) __attribute__((format(printf, 3, 4)));
+int hostTestResult(const char *name);
+uint32_t hostRandom();                    // Repeatable random numbers
+double hostSeconds();                     // Monotonic clock
+void hostKeep(uint32_t value);            // Stops a benchmark being optimised away
+
+#endif
@@ -0,0 +1,135 @@
+// Bitmap index checks
+//
+// Builds the index for a library of bitmaps, deletes and uploads files so blank records
+// are reused, reloads it as at start up, and checks every file can be found, with how
+// much of the index file each lookup reads.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+#include <unistd.h>
+#include <set>
+
+#define LIBRARY_SIZE 300
+#define REMOVED 50
+#define ADDED 60
+
+void initBmpIndex();
+void updateBmpIndex(const char *path);
+void removeFromBmpIndex(const char *path);
+bool findBmpIndex(const char *path, FileInfo &info);
+uint16_t readIndexPage(uint16_t start, void (*fn)(const FileInfo &info, String &s), String &s);
+uint16_t getBmpIndexCount();
+
+// files.cpp reports on playback, which isn't built here
+RowStreamStats rowStreamStats;
+FrameStats frameStats;
+RowStreamStats &getRowStreamStats() { return rowStreamStats; }
+FrameStats &getFrameStats() { return frameStats; }
+
+std::set<std::string> library; // What should be in the index
+std::set<std::string> listed;
+
+void bmpPath(char *path, uint16_t n)
+{
+  snprintf(path, sizeof(FileInfo::path), "/bmp/image%03u.bmp", n);
+}
+
+/// A native bitmap n pixels wide, so each file can be told apart
+void writeBitmap(uint16_t n)
+{
+  char path[sizeof(FileInfo::path)];
+  NativeHeader header;
+
+  memset(&header, 0, sizeof(header));
+  header.signature = NATIVE_SIGNATURE;
+  header.version = NATIVE_VERSION;
+  header.pixelFormat = PIXEL_INDEXED8;
+  header.width = n + 1;
+  header.height = 1;
+  header.dataOffset = sizeof(header);
+  bmpPath(path, n);
+  File f = LittleFS.open(path, "w");
+  f.write((uint8_t *)&header, sizeof(header));
+  f.close();
+  library.insert(path);
+}
+
+void listFile(const FileInfo &info, String &)
+{
+  listed.insert(info.path);
+}
+
+/// Look up everything that should be there, and something that shouldn't
+void checkLookups(const char *when)
+{
+  FileInfo info;
+  uint64_t readBefore = hostReadBytes;
+  double start = hostSeconds();
+
+  for (const std::string &path : library)
+  {
+    bool found = findBmpIndex(path.c_str(), info);
+    CHECK(found && strcmp(info.path, path.c_str()) == 0 && info.bmpWidth == atoi(path.c_str() + 10) + 1,
+          "%s: %s not found", when, path.c_str());
+  }
+  double micros = (hostSeconds() - start) * 1e6 / library.size();
+  uint64_t bytes = (hostReadBytes - readBefore) / library.size();
+  CHECK(!findBmpIndex("/bmp/missing.bmp", info), "%s: found a file that isn't there", when);
+  CHECK(getBmpIndexCount() == library.size(), "%s: %u files in the index, not %zu", when, getBmpIndexCount(), library.size());
+
+  String s;
+  uint16_t start16 = 0;
+  listed.clear();
+  while ((start16 = readIndexPage(start16, listFile, s)))
+    ;
+  CHECK(listed == library, "%s: the listing has %zu files, not %zu", when, listed.size(), library.size());
+  printf("  %-22s %3zu files, %6.1f us and %5lu bytes of index read per lookup\n", when, library.size(), micros,
+         (unsigned long)bytes);
+}
+
+int main()
+{
+  char root[] = "/tmp/indextestXXXXXX";
+  char path[sizeof(FileInfo::path)];
+
+  CHECK(mkdtemp(root), "can't make a directory to work in");
+  hostRoot = root;
+
+  for (uint16_t n = 0; n < LIBRARY_SIZE; n++)
+    writeBitmap(n);
+  initBmpIndex();
+  checkLookups("built");
+
+  for (uint16_t n = 0; n < LIBRARY_SIZE; n += LIBRARY_SIZE / REMOVED)
+  {
+    bmpPath(path, n);
+    LittleFS.remove(path);
+    removeFromBmpIndex(path);
+    library.erase(path);
+  }
+  checkLookups("after deleting");
+
+  for (uint16_t n = LIBRARY_SIZE; n < LIBRARY_SIZE + ADDED; n++)
+  {
+    writeBitmap(n);
+    bmpPath(path, n);
+    updateBmpIndex(path);
+  }
+  bmpPath(path, 1);
+  updateBmpIndex(path); // Replacing a file mustn't add it twice
+  checkLookups("after uploading");
+  File index = LittleFS.open("/bmpindex.dat", "r");
+  uint32_t records = (index.size() - 6) / sizeof(FileInfo);
+  index.close();
+  CHECK(records == LIBRARY_SIZE + ADDED - REMOVED, "%u records - the deleted ones weren't reused", records);
+
+  initBmpIndex(); // As at start up
+  checkLookups("reloaded");
+
+  for (const std::string &p : library)
+    LittleFS.remove(p.c_str());
+  LittleFS.remove("/bmpindex.dat");
+  rmdir((hostRoot + "/bmp").c_str());
+  rmdir(root);
+  return hostTestResult("index");
+}
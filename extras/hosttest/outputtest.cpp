@@ -0,0 +1,232 @@
+// LED output checks
+//
+// The firmware only sends the LEDs up to the last one lit now or by the last frame, and
+// skips frames the LEDs are already showing. Each frame here is sent through sendLeds()
+// into the host's capture of the strip (see HostStrip in hostled.h), and the whole strip
+// has to end up showing what it would if every LED had been sent, at the brightness the
+// power limiter picks: for random frames of every length, a moving dot, all black, the
+// last LED on its own, repeats and changes of brightness. Then that unchanged frames are
+// skipped until the keepalive time, that a frame with one LED lit is sent after any
+// other, that a shorter frame still turns off the LEDs the last one lit, and that
+// switching off clears LEDs that weren't sent. Then what sending fewer LEDs saves, with
+// each LED taking 30us to clock out with the interrupts off.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+
+#define FRAMES 20000
+#define BENCH_FRAMES 2000
+#define LED_MICROS 30 // 24 bits at 800kHz
+
+extern CLEDController *ledController;
+
+void sendLeds(bool always);
+void showLeds();
+void showFrame();
+void clearLeds();
+uint8_t limitBrightness(uint8_t brightness, const CRGB *leds, uint16_t lit);
+
+CRGB leds[NUM_LEDS] __attribute__((aligned(4)));
+CRGB expect[NUM_LEDS];
+
+CRGB randomColour()
+{
+  uint32_t r = hostRandom();
+  return r & 0x03000000 ? CRGB(r) : CRGB::Black; // Some LEDs in the middle of a frame are off
+}
+
+/// Send the frame as the firmware does, and check the strip shows it as if every LED had
+/// been sent. Returns the number of LEDs sent.
+uint32_t send(bool always, const char *what, unsigned arg)
+{
+  uint8_t brightness = limitBrightness(FastLED.getBrightness(), leds, NUM_LEDS);
+  uint32_t clocked = hostStrip.clocked;
+
+  sendLeds(always);
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    expect[i] = CRGB(leds[i]).nscale8(brightness);
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    if (hostStrip.leds[i] != expect[i])
+    {
+      CHECK(false, "%s (%u): LED %u is showing %02X%02X%02X, not %02X%02X%02X", what, arg, i, hostStrip.leds[i].r,
+            hostStrip.leds[i].g, hostStrip.leds[i].b, expect[i].r, expect[i].g, expect[i].b);
+      break;
+    }
+  return hostStrip.clocked - clocked;
+}
+
+void checkFrames()
+{
+  static const uint16_t keepalives[] = {0, 20, 60000};
+
+  for (uint32_t frame = 0; frame < FRAMES; frame++)
+  {
+    uint32_t r = hostRandom();
+    uint16_t length = r % (NUM_LEDS + 1);
+    const char *what;
+
+    if (frame % 500 == 0)
+      getConfig().keepaliveMillis = keepalives[(r >> 16) % 3];
+    switch ((r >> 8) % 8)
+    {
+    case 0:
+      fill_solid(leds, NUM_LEDS, CRGB::Black);
+      what = "all black";
+      break;
+    case 1:
+      for (uint16_t i = 0; i < NUM_LEDS; i++)
+        leds[i] = i < length ? randomColour() : CRGB(CRGB::Black);
+      what = "lit to a random length";
+      break;
+    case 2:
+      fill_solid(leds, NUM_LEDS, CRGB::Black);
+      leds[length % NUM_LEDS] = CRGB::Red;
+      what = "a dot";
+      break;
+    case 3:
+      for (uint16_t i = 0; i < NUM_LEDS; i++)
+        leds[i] = randomColour();
+      what = "random";
+      break;
+    case 4:
+      fill_solid(leds, NUM_LEDS, CRGB::Black);
+      leds[NUM_LEDS - 1] = CRGB(0, 0, 1);
+      what = "the last LED";
+      break;
+    case 5:
+      what = "the same again";
+      break;
+    case 6:
+      FastLED.setBrightness(r >> 24);
+      what = "another brightness";
+      break;
+    default:
+      fill_solid(leds, NUM_LEDS, CRGB::White); // More than the supply can give
+      what = "white";
+      break;
+    }
+    send(r & 0x10000, what, frame);
+  }
+  FastLED.setBrightness(DEFAULT_BRIGHTNESS);
+}
+
+/// Whether a frame was sent
+bool sent(bool always)
+{
+  uint32_t shows = hostStrip.shows;
+
+  send(always, "keepalive", 0);
+  return hostStrip.shows != shows;
+}
+
+void checkKeepalive()
+{
+  fill_solid(leds, NUM_LEDS, CRGB::Black);
+  fill_solid(leds, 10, CRGB::Blue);
+  getConfig().keepaliveMillis = 60000;
+  CHECK(sent(false), "a new frame wasn't sent");
+  CHECK(!sent(false), "an unchanged frame was sent again");
+  CHECK(sent(true), "showLeds() didn't send an unchanged frame");
+  leds[3].g++;
+  CHECK(sent(false), "a changed frame wasn't sent");
+  FastLED.setBrightness(DEFAULT_BRIGHTNESS / 2);
+  CHECK(sent(false), "a frame wasn't sent at a new brightness");
+  FastLED.setBrightness(DEFAULT_BRIGHTNESS);
+  CHECK(sent(false), "a frame wasn't sent at the old brightness");
+  getConfig().keepaliveMillis = 5;
+  CHECK(!sent(false), "an unchanged frame was sent within the keepalive time");
+  delayMicroseconds(6000);
+  CHECK(sent(false), "an unchanged frame wasn't sent after the keepalive time");
+  getConfig().keepaliveMillis = 0;
+  CHECK(sent(false), "an unchanged frame wasn't sent with no keepalive time");
+}
+
+/// Every frame with one LED lit after every other one, which all differ in just two
+/// LEDs, has to be sent
+void checkOneLed()
+{
+  getConfig().keepaliveMillis = 60000;
+  for (uint16_t first = 0; first < NUM_LEDS; first++)
+    for (uint16_t second = 0; second < NUM_LEDS; second++)
+    {
+      fill_solid(leds, NUM_LEDS, CRGB::Black);
+      leds[first] = CRGB::Red;
+      send(false, "one LED", first);
+      leds[first] = CRGB::Black;
+      leds[second] = CRGB::Red;
+      send(false, "then another", second);
+    }
+}
+
+void checkLength()
+{
+  getConfig().keepaliveMillis = 0;
+  fill_solid(leds, NUM_LEDS, CRGB::Green);
+  CHECK(send(false, "length", 0) == NUM_LEDS, "a whole frame wasn't sent");
+  fill_solid(leds + 10, NUM_LEDS - 10, CRGB::Black);
+  CHECK(send(false, "length", 1) == NUM_LEDS, "the LEDs lit by the last frame weren't turned off");
+  CHECK(send(false, "length", 2) == 10, "more LEDs than are lit were sent");
+  fill_solid(leds, NUM_LEDS, CRGB::Black);
+  CHECK(send(false, "length", 3) == 10, "the last LEDs lit weren't turned off");
+  CHECK(send(false, "length", 4) == 0, "LEDs were sent when none are lit");
+
+  // Whatever is in the frame when the LEDs are switched off, not just what was sent
+  leds[2] = CRGB::Red;
+  send(false, "length", 5);
+  fill_solid(leds, NUM_LEDS, CRGB::Red);
+  clearLeds();
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    CHECK(!hostStrip.leds[i], "LED %u is still lit after switching off", i);
+}
+
+/// LEDs sent and the time taken for frames of one kind, with every frame sent
+void benchmark(const char *name, void (*draw)(uint32_t frame))
+{
+  uint32_t clocked = hostStrip.clocked;
+  double spent = 0;
+
+  getConfig().keepaliveMillis = 0;
+  for (uint32_t frame = 0; frame < BENCH_FRAMES; frame++)
+  {
+    draw(frame);
+    double start = hostSeconds();
+    sendLeds(false);
+    spent += hostSeconds() - start;
+  }
+  double sent = (double)(hostStrip.clocked - clocked) / BENCH_FRAMES;
+  printf("  %-22s %5.1f LEDs, %6.0f us to clock out vs %u us, sendLeds() %.2f us\n", name, sent, sent * LED_MICROS,
+         NUM_LEDS * LED_MICROS, spent * 1e6 / BENCH_FRAMES);
+}
+
+int main()
+{
+  CLEDController controller;
+
+  ledController = &FastLED.addLeds(&controller, leds, NUM_LEDS);
+  FastLED.setBrightness(DEFAULT_BRIGHTNESS);
+  clearLeds();
+  checkFrames();
+  checkKeepalive();
+  checkOneLed();
+  checkLength();
+  printf("Strip shows every LED of %u frames as if they had all been sent\n", FRAMES);
+
+  printf("A frame of %u LEDs, sending the lit ones:\n", NUM_LEDS);
+  benchmark("whole strip", [](uint32_t) {
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+      leds[i] = CRGB(hostRandom() | 0x010101);
+  });
+  benchmark("60 pixel bitmap", [](uint32_t) {
+    fill_solid(leds, NUM_LEDS, CRGB::Black);
+    for (uint16_t i = 0; i < 60; i++)
+      leds[i] = CRGB(hostRandom() | 0x010101);
+  });
+  benchmark("moving dot", [](uint32_t frame) {
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+      leds[i].fadeToBlackBy(64);
+    uint16_t at = frame % (NUM_LEDS * 2);
+    leds[at < NUM_LEDS ? at : NUM_LEDS * 2 - 1 - at] = CRGB::White;
+  });
+  benchmark("off", [](uint32_t) { fill_solid(leds, NUM_LEDS, CRGB::Black); });
+  return hostTestResult("output");
+}
@@ -0,0 +1,170 @@
+// Palette and rainbow table checks
+//
+// The presets look colours up from palettes expanded to 256 entries and from a table of
+// the rainbow's colours, rather than calling ColorFromPalette() and fill_rainbow() for
+// every LED. This checks the tables hold every colour FastLED gives (see hostled.h), for
+// every palette and every index, and that the presets that use them draw exactly what
+// they drew with FastLED's calls: bpm (the brightness is applied to the table's colours,
+// and every brightness comes up), rainbow at every hue, and fire and water. Then times
+// the lookups against the calls they replaced.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+
+#define BENCH_FRAMES 5000
+
+extern const CRGBPalette16 palettes[];
+extern const uint8_t paletteNum;
+extern byte heat[];
+extern const PresetClock *renderClock;
+
+const CRGB *getPaletteColours(uint8_t index);
+void rainbowInit();
+void rainbow(const PresetContext &ctx);
+void bpm(const PresetContext &ctx);
+void fire(const PresetContext &ctx);
+void fireInit();
+void water(const PresetContext &ctx);
+void waterInit();
+
+CRGB leds[NUM_LEDS] __attribute__((aligned(4)));
+CRGB expect[NUM_LEDS];
+
+/// Compare what a preset drew with what FastLED gives
+void compare(const char *preset, unsigned arg)
+{
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    if (leds[i] != expect[i])
+    {
+      CHECK(false, "%s (%u): LED %u is %02X%02X%02X, not %02X%02X%02X", preset, arg, i, leds[i].r, leds[i].g, leds[i].b,
+            expect[i].r, expect[i].g, expect[i].b);
+      return;
+    }
+}
+
+void checkPalettes()
+{
+  for (uint8_t pass = 0; pass < 2; pass++)
+    for (uint8_t p = 0; p < paletteNum; p++)
+    { // Twice round, so each palette is expanded again after the others
+      const CRGB *colours = getPaletteColours(p);
+      for (uint16_t i = 0; i < 256; i++)
+      {
+        CRGB c = ColorFromPalette(palettes[p], i, 255, LINEARBLEND);
+        CHECK(colours[i] == c, "palette %u index %u is %02X%02X%02X, not %02X%02X%02X", p, i, colours[i].r, colours[i].g,
+              colours[i].b, c.r, c.g, c.b);
+      }
+    }
+}
+
+void checkBpm()
+{
+  bool seen[256] = {};
+  uint16_t brightnesses = 0;
+  PresetClock clock = {};
+
+  renderClock = &clock; // For beatsin8(), as renderPreset() would set it
+  for (uint8_t p = 0; p < paletteNum; p++)
+    for (uint16_t frame = 0; frame < 200; frame++)
+    {
+      clock.now = frame * 37;
+      PresetContext ctx = {palettes[p], getPaletteColours(p), {30 + frame}, clock.now, 37, (uint8_t)(frame * 3)};
+      uint8_t beat = beatsin8(ctx.parms[0], 64, 255);
+      for (uint16_t i = 0; i < NUM_LEDS; i++)
+      {
+        uint8_t brightness = beat - ctx.hue + (i * 10);
+        expect[i] = ColorFromPalette(ctx.palette, ctx.hue + (i * 2), brightness);
+        brightnesses += !seen[brightness];
+        seen[brightness] = true;
+      }
+      bpm(ctx);
+      compare("bpm", p);
+    }
+  renderClock = NULL;
+  CHECK(brightnesses == 256, "bpm only tried %u brightnesses", brightnesses);
+}
+
+void checkRainbow()
+{
+  rainbowInit();
+  for (uint16_t hue = 0; hue < 256; hue++)
+  {
+    PresetContext ctx = {palettes[0], getPaletteColours(0), {}, 0, 0, (uint8_t)hue};
+    fill_rainbow(expect, NUM_LEDS, hue, 255 / NUM_LEDS);
+    rainbow(ctx);
+    compare("rainbow", hue);
+  }
+}
+
+/// Fire or water for a while, each frame against the heat it drew from looked up in
+/// FastLED's palette
+void checkHeat(const char *name, void (*draw)(const PresetContext &), void (*init)(), const CRGBPalette16 &palette, bool up)
+{
+  init();
+  random16_set_seed(1234);
+  for (uint16_t frame = 0; frame < 500; frame++)
+  {
+    PresetContext ctx = {palettes[0], getPaletteColours(0), {90, 150}, frame * 20u, 20, 0};
+    draw(ctx);
+    for (uint16_t j = 0; j < NUM_LEDS; j++)
+      expect[up ? j : NUM_LEDS - 1 - j] = ColorFromPalette(palette, scale8(heat[j], 190));
+    compare(name, frame);
+  }
+}
+
+/// Time a preset drawn from the tables and the FastLED calls it used to make
+template <typename Tables, typename Fastled>
+void benchmark(const char *name, Tables tables, Fastled fastled)
+{
+  double start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++)
+  {
+    tables(n);
+    hostKeep(leds[n % NUM_LEDS].g);
+  }
+  double tableTime = (hostSeconds() - start) * 1e6 / BENCH_FRAMES;
+
+  start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++)
+  {
+    fastled(n);
+    hostKeep(leds[n % NUM_LEDS].g);
+  }
+  double fastledTime = (hostSeconds() - start) * 1e6 / BENCH_FRAMES;
+  printf("  %-22s %6.2f us a frame vs %6.2f us, %.1fx\n", name, tableTime, fastledTime, fastledTime / tableTime);
+}
+
+int main()
+{
+  checkPalettes();
+  checkBpm();
+  checkRainbow();
+  checkHeat("fire", fire, fireInit, CRGBPalette16(CRGB::Black, CRGB::Red, CRGB::Yellow, CRGB::White), false);
+  checkHeat("water", water, waterInit, CRGBPalette16(CRGB::Black, CRGB::Blue, CRGB::Aqua, CRGB::White), true);
+  printf("Tables match FastLED for %u palettes, bpm, rainbow, fire and water\n", paletteNum);
+
+  printf("%u LEDs, tables vs FastLED:\n", NUM_LEDS);
+  benchmark(
+      "bpm",
+      [](uint32_t n) {
+        PresetContext ctx = {palettes[2], getPaletteColours(2), {120}, n, 1, (uint8_t)n};
+        bpm(ctx);
+      },
+      [](uint32_t n) {
+        for (uint16_t i = 0; i < NUM_LEDS; i++)
+          leds[i] = ColorFromPalette(palettes[2], n + (i * 2), 64 - n + (i * 10));
+      });
+  benchmark(
+      "rainbow",
+      [](uint32_t n) {
+        PresetContext ctx = {palettes[0], getPaletteColours(0), {}, n, 1, (uint8_t)n};
+        rainbow(ctx);
+      },
+      [](uint32_t n) { fill_rainbow(leds, NUM_LEDS, n, 255 / NUM_LEDS); });
+
+  double start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++)
+    hostKeep(getPaletteColours(n & 1 ? 3 : 4)[n & 0xFF].r);
+  printf("  expanding a palette    %6.2f us, once when it changes\n", (hostSeconds() - start) * 1e6 / BENCH_FRAMES);
+  return hostTestResult("palette");
+}
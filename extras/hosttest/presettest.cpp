@@ -0,0 +1,124 @@
+// Motion preset checks
+//
+// Every preset is drawn through renderPreset() on a clock of its own, from the start
+// and with a fixed seed, and then drawn again the same way after the live random
+// numbers and the other presets have moved on and with the frames drawn at a different
+// pace. The frames have to come out the same both times, the live random numbers have
+// to be left as they were, and each frame's load has to be what the LEDs draw. The
+// presets that use random numbers have to draw something else from another seed. Then
+// times a frame of each preset.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+
+#define FRAMES 600        // Ten seconds at 60 frames a second
+#define FRAME_MICROS 16667
+#define BENCH_FRAMES 2000
+
+extern PresetInfo presetList[];
+extern const uint8_t presetNum;
+
+void startPresetClock(PresetClock &clock, uint32_t start, uint16_t seed);
+uint32_t renderPreset(PresetInfo &preset, PresetClock &clock, uint32_t now, const int *parms = NULL);
+uint32_t pixelLoad(const CRGB &c);
+
+CRGB leds[NUM_LEDS] __attribute__((aligned(4)));
+uint32_t frameHashes[FRAMES];
+
+uint32_t hashLeds()
+{
+  uint32_t hash = 2166136261u;
+
+  for (uint16_t i = 0; i < NUM_LEDS * 3; i++)
+    hash = (hash ^ ((uint8_t *)leds)[i]) * 16777619u;
+  return hash;
+}
+
+/// Draw a preset from the start, as a bake does, keeping a hash of each frame. Returns
+/// a hash of them all.
+uint32_t drawPreset(uint8_t index, uint16_t seed, bool dawdle)
+{
+  PresetInfo &preset = presetList[index];
+  PresetClock clock;
+  uint32_t all = 0;
+
+  if (preset.init)
+    preset.init();
+  fill_solid(leds, NUM_LEDS, CRGB::Black);
+  startPresetClock(clock, 0, seed);
+  for (uint16_t frame = 0; frame < FRAMES; frame++)
+  {
+    uint16_t liveSeed = random16_get_seed();
+    uint32_t load = renderPreset(preset, clock, (uint64_t)frame * FRAME_MICROS / 1000);
+    CHECK(random16_get_seed() == liveSeed, "%s: frame %u changed the live random numbers", preset.name.c_str(), frame);
+
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+      sum += pixelLoad(leds[i]);
+    CHECK(load == sum, "%s: frame %u's load is %u, not %u", preset.name.c_str(), frame, load, sum);
+
+    frameHashes[frame] = hashLeds();
+    all = (all ^ frameHashes[frame]) * 16777619u;
+    if (dawdle && frame % 7 == 0)
+      delayMicroseconds(300); // The preset's clock, not the real one, sets the time
+  }
+  if (preset.teardown)
+    preset.teardown();
+  return all;
+}
+
+void checkPreset(uint8_t index)
+{
+  PresetInfo &preset = presetList[index];
+  uint32_t first[FRAMES];
+
+  uint32_t hash = drawPreset(index, 1234, false);
+  memcpy(first, frameHashes, sizeof(first));
+
+  random16_set_seed(random16_get_seed() ^ 0x5A5A);
+  for (uint8_t i = 0; i < 20; i++)
+    random8();
+  drawPreset((index + 1) % presetNum, 999, false); // Leave another preset's state behind
+  CHECK(drawPreset(index, 1234, true) == hash, "%s drew different frames the second time", preset.name.c_str());
+  for (uint16_t frame = 0; frame < FRAMES; frame++)
+    if (frameHashes[frame] != first[frame])
+    {
+      CHECK(false, "%s: frame %u came out different the second time", preset.name.c_str(), frame);
+      break;
+    }
+
+  bool changes = false;
+  for (uint16_t frame = 1; frame < FRAMES; frame++)
+    changes |= frameHashes[frame] != frameHashes[0];
+  CHECK(changes, "%s doesn't move", preset.name.c_str());
+  bool seeded = drawPreset(index, 4321, false) != hash;
+  printf("  %-22s %08X%s\n", preset.name.c_str(), hash, seeded ? ", different from another seed" : "");
+  if (preset.name == "Confetti" || preset.name == "Fire" || preset.name == "Twinkles")
+    CHECK(seeded, "%s doesn't follow the seed", preset.name.c_str());
+}
+
+void benchmark(uint8_t index)
+{
+  PresetInfo &preset = presetList[index];
+  PresetClock clock;
+
+  if (preset.init)
+    preset.init();
+  startPresetClock(clock, 0, 1);
+  double start = hostSeconds();
+  for (uint32_t frame = 0; frame < BENCH_FRAMES; frame++)
+    hostKeep(renderPreset(preset, clock, frame * FRAME_MICROS / 1000));
+  printf("  %-22s %6.2f us a frame\n", preset.name.c_str(), (hostSeconds() - start) * 1e6 / BENCH_FRAMES);
+}
+
+int main()
+{
+  printf("%u presets, %u frames each from seed 1234:\n", presetNum, FRAMES);
+  for (uint8_t i = 0; i < presetNum; i++)
+    checkPreset(i);
+
+  printf("Drawing a frame of %u LEDs:\n", NUM_LEDS);
+  for (uint8_t i = 0; i < presetNum; i++)
+    benchmark(i);
+  return hostTestResult("preset");
+}
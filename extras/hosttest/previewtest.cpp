@@ -0,0 +1,274 @@
+// Bitmap preview checks
+//
+// Random images of every depth the stick accepts (24 and 32-bit, 16-bit 565 and 555, 8
+// and 4-bit indexed, stored bottom-up and top-down, and tiled) are uploaded through the
+// transcoder, and the native file is sent back as a BMP by writePreview(). The preview
+// has to be exactly the size it said it would be, be a BMP the right way up, and have
+// every pixel the colour the stick plays for the original: exactly the original colour
+// for indexed and 16-bit images, and one that gamma corrects to the same level for 24
+// and 32-bit ones. A file that isn't native (one copied to data/bmp) isn't previewed,
+// and a native file that has been cut short still gives a preview of the promised size.
+// Then times a preview.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+#include <unistd.h>
+#include <vector>
+
+#define BENCH_PREVIEWS 20
+
+extern const uint8_t gamma8[];
+
+void beginTranscode(const char *path);
+bool transcodeChunk(const uint8_t *buf, size_t len);
+uint16_t endTranscode();
+void readBmpInfo(const char *path, FileInfo &info);
+uint32_t previewSize(const FileInfo &info);
+bool writePreview(const FileInfo &info, void (*write)(const uint8_t *buf, size_t len));
+uint32_t get32(const uint8_t *p);
+
+/// A BMP to upload, and the colours the stick plays for it, top row first
+struct Image
+{
+  uint16_t width;
+  uint16_t height;
+  uint16_t bits;
+  bool bitfields; // 16-bit 565 with masks, rather than 555
+  bool topDown;
+  std::vector<uint8_t> bmp;
+  std::vector<CRGB> expect;
+};
+
+std::vector<uint8_t> preview;
+
+void put16(std::vector<uint8_t> &v, uint16_t value)
+{
+  v.push_back(value);
+  v.push_back(value >> 8);
+}
+
+void put32(std::vector<uint8_t> &v, uint32_t value)
+{
+  put16(v, value);
+  put16(v, value >> 16);
+}
+
+/// Scale a 5 or 6-bit colour to 8 bits, as the stick does when it plays it
+uint8_t widen(uint16_t value, uint8_t bits)
+{
+  return value * 255 / ((1 << bits) - 1);
+}
+
+void makeImage(Image &image)
+{
+  uint16_t colours = image.bits <= 8 ? 1 << image.bits : 0;
+  uint32_t stride = ((uint32_t)image.width * image.bits + 31) / 32 * 4;
+  uint32_t offset = 54 + (image.bitfields ? 12 : 0) + colours * 4;
+  std::vector<uint8_t> &v = image.bmp;
+  CRGB palette[256];
+
+  v.clear();
+  put16(v, 0x4D42);
+  put32(v, offset + stride * image.height);
+  put32(v, 0);
+  put32(v, offset);
+  put32(v, 40);
+  put32(v, image.width);
+  put32(v, image.topDown ? -(int32_t)image.height : image.height);
+  put16(v, 1);
+  put16(v, image.bits);
+  put32(v, image.bitfields ? 3 : 0);
+  put32(v, stride * image.height);
+  put32(v, 2835);
+  put32(v, 2835);
+  put32(v, colours);
+  put32(v, 0);
+  if (image.bitfields)
+  {
+    put32(v, 0xF800);
+    put32(v, 0x07E0);
+    put32(v, 0x001F);
+  }
+  for (uint16_t i = 0; i < colours; i++)
+  {
+    palette[i] = CRGB(hostRandom());
+    v.push_back(palette[i].b);
+    v.push_back(palette[i].g);
+    v.push_back(palette[i].r);
+    v.push_back(0);
+  }
+
+  image.expect.assign((size_t)image.width * image.height, CRGB::Black);
+  for (uint16_t row = 0; row < image.height; row++)
+  {
+    uint16_t y = image.topDown ? row : image.height - 1 - row; // From the top
+    size_t start = v.size();
+    for (uint16_t x = 0; x < image.width; x++)
+    {
+      CRGB &c = image.expect[(size_t)y * image.width + x];
+      uint32_t r = hostRandom();
+      uint16_t value = r;
+      switch (image.bits)
+      {
+      case 4:
+        if (x & 1)
+          v.back() |= r & 0x0F;
+        else
+          v.push_back((r & 0x0F) << 4);
+        c = palette[r & 0x0F];
+        break;
+      case 8:
+        v.push_back(r);
+        c = palette[r & 0xFF];
+        break;
+      case 16:
+        if (!image.bitfields) // 555, which is played as 565
+          value = ((value & 0x7C00) << 1) | ((widen((value >> 5) & 0x1F, 5) >> 2) << 5) | (value & 0x1F);
+        put16(v, image.bitfields ? value : r & 0x7FFF);
+        c = CRGB(widen(value >> 11, 5), widen((value >> 5) & 0x3F, 6), widen(value & 0x1F, 5));
+        break;
+      default:
+        c = CRGB(r);
+        v.push_back(c.b);
+        v.push_back(c.g);
+        v.push_back(c.r);
+        if (image.bits == 32)
+          v.push_back(r >> 24);
+        break;
+      }
+    }
+    while (v.size() - start < stride)
+      v.push_back(0);
+  }
+}
+
+/// Upload the image and read back what the stick makes of it
+bool upload(const char *path, const Image &image, FileInfo &info)
+{
+  beginTranscode(path);
+  transcodeChunk(image.bmp.data(), image.bmp.size());
+  uint16_t status = endTranscode();
+  CHECK(status == VALID, "%s: upload failed with status %u", path, status);
+  readBmpInfo(path, info);
+  return status == VALID && info.status == VALID;
+}
+
+bool makePreview(const FileInfo &info)
+{
+  preview.clear();
+  return writePreview(info, [](const uint8_t *buf, size_t len) { preview.insert(preview.end(), buf, buf + len); });
+}
+
+void checkImage(const char *name, uint16_t width, uint16_t height, uint16_t bits, bool bitfields, bool topDown, bool tiled)
+{
+  Image image = {width, height, bits, bitfields, topDown, {}, {}};
+  FileInfo info;
+
+  makeImage(image);
+  getConfig().tileUploads = tiled;
+  if (!upload("/bmp/preview.bmp", image, info))
+    return;
+  CHECK(info.fileType == FILE_NATIVE, "%s: wasn't converted", name);
+  CHECK((info.compMethod == CODEC_TILES) == (tiled || width > MAX_BMP_WIDTH), "%s: stored with codec %u", name,
+        info.compMethod);
+
+  uint32_t size = previewSize(info);
+  CHECK(makePreview(info), "%s: preview failed", name);
+  CHECK(preview.size() == size, "%s: preview is %zu bytes, not %u", name, preview.size(), size);
+  if (preview.size() != size || size < 54)
+    return;
+  const uint8_t *p = preview.data();
+  CHECK(p[0] == 'B' && p[1] == 'M' && get32(p + 2) == size, "%s: preview header is wrong", name);
+  CHECK(get32(p + 18) == width && get32(p + 22) == height && p[28] == 24, "%s: preview is %ux%u at %u bits", name,
+        get32(p + 18), get32(p + 22), p[28]);
+  uint32_t stride = (width * 3 + 3) & ~3;
+  for (uint16_t y = 0; y < height; y++)
+    for (uint16_t x = 0; x < width; x++)
+    {
+      const uint8_t *bgr = p + get32(p + 10) + (uint32_t)(height - 1 - y) * stride + x * 3;
+      CRGB shown(bgr[2], bgr[1], bgr[0]);
+      CRGB c = image.expect[(size_t)y * width + x];
+      bool same = bits >= 24 ? gamma8[shown.r] == gamma8[c.r] && gamma8[shown.g] == gamma8[c.g] && gamma8[shown.b] == gamma8[c.b]
+                             : shown == c;
+      if (!same)
+      {
+        CHECK(false, "%s: pixel %u,%u is %02X%02X%02X, not %02X%02X%02X", name, x, y, shown.r, shown.g, shown.b, c.r, c.g, c.b);
+        return;
+      }
+    }
+}
+
+/// A BMP copied to the file system isn't converted, and a native file cut short still
+/// gives a preview of the size that was promised
+void checkOthers()
+{
+  Image image = {NUM_LEDS, 40, 24, false, false, {}, {}};
+  FileInfo info;
+
+  makeImage(image);
+  File f = LittleFS.open("/bmp/copied.bmp", "w");
+  f.write(image.bmp.data(), image.bmp.size());
+  f.close();
+  readBmpInfo("/bmp/copied.bmp", info);
+  CHECK(info.status == VALID && !previewSize(info), "a BMP that wasn't uploaded would be converted");
+  LittleFS.remove("/bmp/copied.bmp");
+
+  getConfig().tileUploads = false;
+  if (!upload("/bmp/preview.bmp", image, info))
+    return;
+  std::vector<uint8_t> native(info.fileSize);
+  f = LittleFS.open("/bmp/preview.bmp", "r");
+  f.read(native.data(), native.size());
+  f.close();
+  f = LittleFS.open("/bmp/preview.bmp", "w");
+  f.write(native.data(), native.size() / 2);
+  f.close();
+  CHECK(!makePreview(info), "a file cut short previewed without an error");
+  CHECK(preview.size() == previewSize(info), "a file cut short gave %zu bytes, not %u", preview.size(), previewSize(info));
+}
+
+int main()
+{
+  char root[] = "/tmp/previewtestXXXXXX";
+
+  CHECK(mkdtemp(root), "can't make a directory to work in");
+  hostRoot = root;
+
+  for (uint8_t pass = 0; pass < 4; pass++)
+  {
+    uint16_t width = pass ? 1 + hostRandom() % MAX_BMP_WIDTH : NUM_LEDS;
+    uint16_t height = 1 + hostRandom() % 50;
+    checkImage("24-bit", width, height, 24, false, false, false);
+    checkImage("24-bit top-down", width, height, 24, false, true, false);
+    checkImage("32-bit", width, height, 32, false, false, false);
+    checkImage("16-bit 565", width, height, 16, true, false, false);
+    checkImage("16-bit 555", width, height, 16, false, true, false);
+    checkImage("8-bit", width, height, 8, false, false, false);
+    checkImage("4-bit", width, height, 4, false, false, false);
+    checkImage("24-bit tiled", width, height, 24, false, false, true);
+    checkImage("4-bit tiled", width, height, 4, false, true, true);
+    checkImage("16-bit tiled", width, height, 16, true, false, true);
+  }
+  checkImage("wide 24-bit", 1000, 37, 24, false, false, false);
+  checkImage("wide 8-bit", 777, 20, 8, false, true, false);
+  checkOthers();
+  printf("Previews play the same as the originals for every depth, row order and tiling\n");
+
+  Image image = {NUM_LEDS, 1000, 24, false, false, {}, {}};
+  FileInfo info;
+  makeImage(image);
+  getConfig().tileUploads = false;
+  if (upload("/bmp/preview.bmp", image, info))
+  {
+    double start = hostSeconds();
+    for (uint16_t n = 0; n < BENCH_PREVIEWS; n++)
+      makePreview(info);
+    double each = (hostSeconds() - start) / BENCH_PREVIEWS;
+    printf("Preview of a %ux%u image: %u bytes of native file sent as %zu, %.1f us a row\n", image.width, image.height,
+           info.fileSize, preview.size(), each * 1e6 / image.height);
+  }
+  LittleFS.remove("/bmp/preview.bmp");
+  rmdir((hostRoot + "/bmp").c_str());
+  rmdir(root);
+  return hostTestResult("preview");
+}
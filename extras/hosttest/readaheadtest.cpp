@@ -0,0 +1,175 @@
+// Read-ahead checks
+//
+// Plays bitmaps through the read-ahead buffer - small ones that end up in the RAM cache,
+// big ones that don't, rows that don't divide the buffer and looped images - and checks
+// every row comes out as it is in the file. Then, with each file read made to take as
+// long as a LittleFS read of the stick's flash, compares the time the row tick spends
+// getting a row from the buffer with reading each row from the file as it's needed.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+#include <unistd.h>
+#include <algorithm>
+
+#define HEADER_BYTES 70    // Where the image data starts, somewhere that isn't block aligned
+#define FLASH_MICROS 1500  // Time for one LittleFS read on the stick, whatever its size (about)
+#define BENCH_ROWS 500
+#define ROW_MICROS 3000    // Row time for the benchmark - the idle time is what's left of it
+
+bool openRowStream(const char *path, uint32_t start, uint32_t length);
+void closeRowStream();
+void serviceRowStream();
+void primeRowStream();
+bool readRowStream(uint8_t *buf, uint16_t len);
+RowStreamStats &getRowStreamStats();
+
+// The read-ahead code is built with the cache, but not the raw flash store
+bool looping;
+uint32_t rawStoreFind(const char *, uint32_t) { return 0; }
+bool rawStoreRead(uint32_t, uint8_t *, uint32_t) { return false; }
+
+uint8_t pixelByte(uint32_t row, uint32_t i)
+{
+  return row * 7 + i * 13 + (i >> 8);
+}
+
+/// Write a file of rows rows of rowBytes bytes after a header
+void writeImage(const char *path, uint16_t rowBytes, uint32_t rows)
+{
+  uint8_t header[HEADER_BYTES] = {0};
+  uint8_t row[MAX_BMP_WIDTH * 3];
+  File f = LittleFS.open(path, "w");
+
+  f.write(header, sizeof(header));
+  for (uint32_t r = 0; r < rows; r++)
+  {
+    for (uint16_t i = 0; i < rowBytes; i++)
+      row[i] = pixelByte(r, i);
+    f.write(row, rowBytes);
+  }
+  f.close();
+}
+
+/// Play the image through the read-ahead buffer, times times over, checking every row
+void checkPlayback(const char *path, uint16_t rowBytes, uint32_t rows, uint8_t times)
+{
+  uint8_t row[MAX_BMP_WIDTH * 3];
+
+  looping = times > 1;
+  CHECK(openRowStream(path, HEADER_BYTES, (uint32_t)rowBytes * rows), "%s didn't open", path);
+  primeRowStream();
+  for (uint32_t n = 0; n < rows * times; n++)
+  {
+    if (n == rows * times - rows / 2)
+      looping = false; // As when the switch stops a repeat part way through the last time
+    if (!readRowStream(row, rowBytes))
+    {
+      CHECK(false, "%s: ran out at row %u of %u", path, n, rows * times);
+      break;
+    }
+    bool same = true;
+    for (uint16_t i = 0; i < rowBytes; i++)
+      same = same && row[i] == pixelByte(n % rows, i);
+    CHECK(same, "%s (%u byte rows): row %u is wrong", path, rowBytes, n);
+    if (n % 3 != 2)
+      serviceRowStream(); // Leave it short of time now and then
+  }
+  CHECK(!readRowStream(row, rowBytes), "%s: more rows than there should be", path);
+  closeRowStream();
+}
+
+struct Timing
+{
+  double average;
+  uint32_t worst;
+};
+
+/// Time the row tick for BENCH_ROWS rows, read straight from the file or through the buffer
+Timing benchmark(const char *path, uint16_t rowBytes, bool readAhead)
+{
+  uint8_t row[MAX_BMP_WIDTH * 3];
+  File f;
+  uint64_t total = 0;
+  uint32_t worst = 0;
+
+  hostReadMicros = FLASH_MICROS;
+  if (readAhead)
+  {
+    looping = false;
+    openRowStream(path, HEADER_BYTES, (uint32_t)rowBytes * BENCH_ROWS);
+    primeRowStream(); // In the switch delay
+  }
+  else
+    f = LittleFS.open(path, "r");
+  for (uint32_t n = 0; n < BENCH_ROWS; n++)
+  {
+    unsigned long tick = micros();
+    if (readAhead)
+      readRowStream(row, rowBytes);
+    else
+    {
+      f.seek(HEADER_BYTES + n * rowBytes, SeekSet);
+      f.read(row, rowBytes);
+    }
+    uint32_t elapsed = micros() - tick;
+    total += elapsed;
+    worst = std::max(worst, elapsed);
+    hostKeep(row[n % rowBytes]);
+    // The rest of the row time is idle, which is when the buffer is topped up
+    if (readAhead)
+    {
+      while (micros() - tick < ROW_MICROS)
+      {
+        uint16_t before = getRowStreamStats().refills;
+        serviceRowStream();
+        if (getRowStreamStats().refills == before)
+          break; // Full
+      }
+    }
+  }
+  if (readAhead)
+    closeRowStream();
+  else
+    f.close();
+  hostReadMicros = 0;
+  return {(double)total / BENCH_ROWS, worst};
+}
+
+int main()
+{
+  char root[] = "/tmp/readaheadtestXXXXXX";
+
+  CHECK(mkdtemp(root), "can't make a directory to work in");
+  hostRoot = root;
+
+  writeImage("/bmp/small.bmp", NUM_LEDS * 3, 20);     // Fits in the cache
+  writeImage("/bmp/big.bmp", NUM_LEDS * 3, 300);      // Doesn't
+  writeImage("/bmp/odd.bmp", 7 * 3, 1000);            // Rows that don't divide the buffer
+  writeImage("/bmp/wide.bmp", MAX_BMP_WIDTH * 3, 40); // Rows a third of the buffer
+  checkPlayback("/bmp/small.bmp", NUM_LEDS * 3, 20, 1);
+  checkPlayback("/bmp/small.bmp", NUM_LEDS * 3, 20, 5); // From the cache this time
+  CHECK(getRowStreamStats().cachedBytes > 0, "small.bmp wasn't cached");
+  checkPlayback("/bmp/big.bmp", NUM_LEDS * 3, 300, 1);
+  checkPlayback("/bmp/big.bmp", NUM_LEDS * 3, 300, 3);
+  checkPlayback("/bmp/odd.bmp", 7 * 3, 1000, 2);
+  checkPlayback("/bmp/wide.bmp", MAX_BMP_WIDTH * 3, 40, 4);
+  CHECK(!openRowStream("/bmp/missing.bmp", 0, 100), "opened a file that isn't there");
+
+  writeImage("/bmp/bench.bmp", NUM_LEDS * 3, BENCH_ROWS);
+  Timing direct = benchmark("/bmp/bench.bmp", NUM_LEDS * 3, false);
+  Timing ahead = benchmark("/bmp/bench.bmp", NUM_LEDS * 3, true);
+  RowStreamStats &stats = getRowStreamStats();
+  printf("Row tick, %u rows of %u LEDs, %u us a flash read, %u us rows:\n", BENCH_ROWS, NUM_LEDS, FLASH_MICROS,
+         ROW_MICROS);
+  printf("  reading each row:   %7.1f us average, %5u us worst\n", direct.average, direct.worst);
+  printf("  read-ahead buffer:  %7.1f us average, %5u us worst, %u underruns, %u reads of %u bytes average\n",
+         ahead.average, ahead.worst, stats.underruns, stats.refills, stats.refills ? stats.bytesRead / stats.refills : 0);
+  CHECK(stats.underruns == 0, "the buffer ran dry with time to spare");
+
+  const char *files[] = {"/bmp/small.bmp", "/bmp/big.bmp", "/bmp/odd.bmp", "/bmp/wide.bmp", "/bmp/bench.bmp"};
+  for (const char *f : files)
+    LittleFS.remove(f);
+  rmdir((hostRoot + "/bmp").c_str());
+  rmdir(root);
+  return hostTestResult("readahead");
+}
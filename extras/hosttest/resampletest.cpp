@@ -0,0 +1,129 @@
+// Resampler checks
+//
+// For every image width up to MAX_BMP_WIDTH: each LED's weights add up to exactly 256
+// and only use pixels that are there, a flat row comes out flat, a row the width of
+// the strip comes out as it went in, and random rows come out within a level or two of
+// a floating point area average (wider images) or linear interpolation (narrower ones).
+// Then times resampling a row at a few widths. The stick has about 1 ms for a row at the
+// shortest row times, and is a good deal slower than a PC, so the number of taps (one
+// multiply-add per colour each) is given too.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+#include <math.h>
+
+#define BENCH_ROWS 20000
+#define TOLERANCE 2 // Levels the 8-bit weights can be out by
+
+struct ResampleLed
+{
+  uint16_t first;
+  uint8_t count;
+};
+
+extern ResampleLed resampleLeds[];
+extern uint16_t resampleWeights[];
+
+void setupResample(uint16_t width);
+void resampleRow(const CRGB *src, CRGB *dst);
+
+CRGB src[MAX_BMP_WIDTH];
+CRGB dst[NUM_LEDS];
+
+/// What LED i should be for a row of width pixels, worked out in floating point
+double reference(uint16_t width, uint16_t i, uint8_t CRGB::*channel)
+{
+  if (width > NUM_LEDS)
+  { // The average of the pixels the LED covers, by how much of each it covers
+    double start = (double)i * width / NUM_LEDS;
+    double end = (double)(i + 1) * width / NUM_LEDS;
+    double sum = 0;
+    for (uint16_t j = floor(start); j < end; j++)
+      sum += (fmin(end, j + 1) - fmax(start, j)) * (src[j].*channel);
+    return sum / (end - start);
+  }
+  double position = fmax(0, ((2.0 * i + 1) * width - NUM_LEDS) / (2.0 * NUM_LEDS));
+  uint16_t j = position;
+  if (j >= width - 1)
+    return src[width - 1].*channel;
+  double f = position - j;
+  return (1 - f) * (src[j].*channel) + f * (src[j + 1].*channel);
+}
+
+void checkWidth(uint16_t width, double &worstError)
+{
+  uint16_t tap = 0;
+
+  setupResample(width);
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+  {
+    uint16_t sum = 0;
+    for (uint8_t n = 0; n < resampleLeds[i].count; n++)
+      sum += resampleWeights[tap++];
+    CHECK(sum == 256, "width %u: LED %u's weights add up to %u", width, i, sum);
+    CHECK(resampleLeds[i].first + resampleLeds[i].count <= width, "width %u: LED %u reads past the end of the row", width, i);
+    CHECK(resampleLeds[i].count <= MAX_BMP_WIDTH / NUM_LEDS + 2, "width %u: LED %u has %u taps", width, i,
+          resampleLeds[i].count);
+  }
+
+  for (uint16_t j = 0; j < width; j++)
+    src[j] = CRGB(200, 17, 255);
+  resampleRow(src, dst);
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    CHECK(dst[i].r == 200 && dst[i].g == 17 && dst[i].b == 255, "width %u: a flat row isn't flat at LED %u", width, i);
+
+  for (uint8_t pass = 0; pass < 4; pass++)
+  {
+    for (uint16_t j = 0; j < width; j++)
+    { // Random, and smooth, rows
+      uint32_t r = hostRandom();
+      src[j] = pass & 1 ? CRGB(r, r >> 8, r >> 16) : CRGB(j * 255 / width, 255 - j * 255 / width, (j * 37) & 0xFF);
+    }
+    resampleRow(src, dst);
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+    {
+      double error = fmax(fabs(dst[i].r - reference(width, i, &CRGB::r)),
+                          fmax(fabs(dst[i].g - reference(width, i, &CRGB::g)), fabs(dst[i].b - reference(width, i, &CRGB::b))));
+      worstError = fmax(worstError, error);
+      CHECK(error <= TOLERANCE, "width %u: LED %u is %.2f levels out", width, i, error);
+    }
+  }
+  if (width == NUM_LEDS)
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+      CHECK(dst[i].r == src[i].r && dst[i].g == src[i].g && dst[i].b == src[i].b, "LED %u isn't copied straight", i);
+}
+
+void benchmark(uint16_t width)
+{
+  uint32_t taps = 0;
+
+  setupResample(width);
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    taps += resampleLeds[i].count;
+  for (uint16_t j = 0; j < width; j++)
+    src[j] = CRGB(hostRandom(), hostRandom(), hostRandom());
+  double start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_ROWS; n++)
+  {
+    src[n % width].r = n;
+    resampleRow(src, dst);
+    hostKeep(dst[n % NUM_LEDS].g);
+  }
+  printf("  %3u px: %3u taps, %.2f us a row\n", width, taps, (hostSeconds() - start) * 1e6 / BENCH_ROWS);
+}
+
+int main()
+{
+  double worstError = 0;
+
+  for (uint16_t width = 1; width <= MAX_BMP_WIDTH; width++)
+    checkWidth(width, worstError);
+  printf("Widths 1-%u: worst error %.2f levels\n", MAX_BMP_WIDTH, worstError);
+  printf("Resampling a row onto %u LEDs:\n", NUM_LEDS);
+  benchmark(36);
+  benchmark(100);
+  benchmark(NUM_LEDS);
+  benchmark(300);
+  benchmark(MAX_BMP_WIDTH);
+  return hostTestResult("resample");
+}
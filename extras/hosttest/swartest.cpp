@@ -0,0 +1,202 @@
+// Packed byte kernel checks
+//
+// Each of swar.cpp's kernels against the FastLED code it stands in for (see hostled.h),
+// for every pair of byte values in every byte of a word, every scale and blend amount,
+// and every count of LEDs left over after the last whole word. Then times both over a
+// strip's worth of LEDs. A PC has far more to spare than the stick, and the compiler may
+// vectorise the byte-at-a-time loops for it, so the ratio is what to look at rather than
+// the times.
+
+#include "pixelstick.h"
+#include "hosttest.h"
+
+#define LEDS ((256 * 12) / 3 + 3) // Every byte value at each of the 12 bytes of 4 LEDs, then some left over
+#define BENCH_FRAMES 20000
+
+void swarScale(CRGB *leds, uint16_t count, uint8_t scale);
+void swarFade(CRGB *leds, uint16_t count, uint8_t fade);
+void swarAdd(CRGB *dst, const CRGB *src, uint16_t count);
+void swarSub(CRGB *dst, const CRGB *src, uint16_t count);
+void swarBlend(CRGB *dst, const CRGB *src, uint16_t count, uint8_t amount);
+void swarBrightenOrDarken(CRGB *leds, uint16_t count, const uint8_t *brighter, uint8_t up, uint8_t down);
+
+CRGB values[LEDS] __attribute__((aligned(4))); // Each byte value at every byte of a word
+CRGB work[LEDS] __attribute__((aligned(4)));
+CRGB expect[LEDS];
+uint8_t flags[(LEDS + 7) / 8];
+
+/// Fill the LEDs so that bytes 12n to 12n+11 are all n, with random ones at the end
+void fillValues()
+{
+  uint8_t *bytes = (uint8_t *)values;
+
+  for (uint16_t i = 0; i < LEDS * 3; i++)
+    bytes[i] = i < 256 * 12 ? i / 12 : hostRandom();
+}
+
+bool isBrighter(uint16_t i) { return flags[i / 8] & (1 << (i & 7)); }
+
+/// Compare what a kernel gave with what FastLED gives
+void compare(const char *kernel, unsigned arg, uint16_t count)
+{
+  for (uint16_t i = 0; i < count; i++)
+    if (work[i] != expect[i])
+    {
+      CHECK(false, "%s(%u) of %u LEDs: LED %u is %02X%02X%02X, not %02X%02X%02X", kernel, arg, count, i, work[i].r, work[i].g,
+            work[i].b, expect[i].r, expect[i].g, expect[i].b);
+      return;
+    }
+}
+
+void checkScale(uint16_t count)
+{
+  for (uint16_t scale = 0; scale < 256; scale++)
+  {
+    for (uint16_t i = 0; i < count; i++)
+    {
+      work[i] = values[i];
+      expect[i] = CRGB(values[i]).nscale8(scale);
+    }
+    swarScale(work, count, scale);
+    compare("swarScale", scale, count);
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+      work[i] = values[i];
+      expect[i] = CRGB(values[i]).fadeToBlackBy(scale);
+    }
+    swarFade(work, count, scale);
+    compare("swarFade", scale, count);
+  }
+}
+
+/// Adds, subtracts and blends with dst all a, against src holding every value
+void checkPairs(uint16_t count)
+{
+  for (uint16_t a = 0; a < 256; a++)
+  {
+    for (uint16_t i = 0; i < count; i++)
+    {
+      work[i] = CRGB(a, a, a);
+      expect[i] = CRGB(a, a, a) + values[i];
+    }
+    swarAdd(work, values, count);
+    compare("swarAdd", a, count);
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+      work[i] = CRGB(a, a, a);
+      expect[i] = CRGB(a, a, a) - values[i];
+    }
+    swarSub(work, values, count);
+    compare("swarSub", a, count);
+
+    for (uint16_t amount = 0; amount < 256; amount++)
+    {
+      for (uint16_t i = 0; i < count; i++)
+      {
+        work[i] = CRGB(a, a, a);
+        expect[i] = blend(CRGB(a, a, a), values[i], amount);
+      }
+      swarBlend(work, values, count, amount);
+      compare("swarBlend", amount, count);
+    }
+  }
+}
+
+/// Brightening and darkening as twinkles.cpp used to do it, with random directions and
+/// then the other way round so every LED goes both ways
+void checkBrightenOrDarken(uint16_t count)
+{
+  for (uint8_t pass = 0; pass < 2; pass++)
+  {
+    for (uint16_t i = 0; i < sizeof(flags); i++)
+      flags[i] = pass ? ~flags[i] : hostRandom();
+    for (uint16_t up = 0; up < 256; up++)
+    {
+      uint8_t down = 255 - up;
+      for (uint16_t i = 0; i < count; i++)
+      {
+        work[i] = values[i];
+        if (isBrighter(i))
+          expect[i] = values[i] + CRGB(values[i]).nscale8(up);
+        else
+          expect[i] = CRGB(values[i]).nscale8(255 - down);
+      }
+      swarBrightenOrDarken(work, count, flags, up, down);
+      compare("swarBrightenOrDarken", up, count);
+    }
+  }
+}
+
+/// Time a kernel and the FastLED loop it replaces over a strip's worth of LEDs
+template <typename Swar, typename Fastled>
+void benchmark(const char *name, Swar swar, Fastled fastled)
+{
+  double start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++)
+  {
+    swar(n);
+    hostKeep(work[n % NUM_LEDS].g);
+  }
+  double swarTime = (hostSeconds() - start) * 1e6 / BENCH_FRAMES;
+
+  start = hostSeconds();
+  for (uint32_t n = 0; n < BENCH_FRAMES; n++)
+  {
+    fastled(n);
+    hostKeep(work[n % NUM_LEDS].g);
+  }
+  double fastledTime = (hostSeconds() - start) * 1e6 / BENCH_FRAMES;
+  printf("  %-18s %6.3f us a frame vs %6.3f us, %.1fx\n", name, swarTime, fastledTime, fastledTime / swarTime);
+}
+
+int main()
+{
+  fillValues();
+  checkScale(LEDS);
+  checkPairs(LEDS);
+  checkBrightenOrDarken(LEDS);
+  for (uint16_t count = 0; count <= 12; count++)
+  { // Every number of bytes left over, with random values
+    fillValues();
+    for (uint16_t i = 0; i < count; i++)
+      values[i] = CRGB(hostRandom());
+    checkScale(count);
+    checkPairs(count);
+    checkBrightenOrDarken(count);
+  }
+  printf("Kernels match FastLED for every byte pair, scale and amount\n");
+
+  printf("%u LEDs, packed kernels vs FastLED:\n", NUM_LEDS);
+  for (uint16_t i = 0; i < sizeof(flags); i++)
+    flags[i] = hostRandom();
+  benchmark(
+      "fade", [](uint32_t n) { swarFade(work, NUM_LEDS, 20 + (n & 1)); },
+      [](uint32_t n) {
+        for (uint16_t i = 0; i < NUM_LEDS; i++)
+          work[i].fadeToBlackBy(20 + (n & 1));
+      });
+  benchmark(
+      "blend", [](uint32_t n) { swarBlend(work, values, NUM_LEDS, 64 + (n & 1)); },
+      [](uint32_t n) {
+        for (uint16_t i = 0; i < NUM_LEDS; i++)
+          nblend(work[i], values[i], 64 + (n & 1));
+      });
+  benchmark(
+      "add", [](uint32_t n) { swarAdd(work, values + (n & 1) * 4, NUM_LEDS); },
+      [](uint32_t n) {
+        for (uint16_t i = 0; i < NUM_LEDS; i++)
+          work[i] += values[i + (n & 1) * 4];
+      });
+  benchmark(
+      "brighten/darken", [](uint32_t n) { swarBrightenOrDarken(work, NUM_LEDS, flags, 32 + (n & 1), 20); },
+      [](uint32_t n) {
+        for (uint16_t i = 0; i < NUM_LEDS; i++)
+          if (isBrighter(i))
+            work[i] += CRGB(work[i]).nscale8(32 + (n & 1));
+          else
+            work[i].nscale8(255 - 20);
+      });
+  return hostTestResult("swar");
+}
@@ -70,10 +70,10 @@ function startSocket() {
 
 // Made a separate function as it's easier to document the commands
 // Valid commands are:
-//    "B"           get a list of available BMP files
+//    "B<start>"    get a page of the list of available BMP files (start is optional)
 //    "C"           get the configuration data for initialisation
 //    "I"           get the user changes status ([I]nit end)
-//    "S"           get file system info
+//    "S<start>"    get file system info (start of the page of files is optional)
 //    "U0"          switch the LEDs off
 //    "U1"          switch the LEDs on
 //    "UA<ssid:pw>" update AP mode credentials
@@ -88,16 +88,31 @@ function startSocket() {
 //    "UJ<val>"     set number of colours used in fixed mode
 //    "UK<0|1>"     set gradient off/on
 //    "UL<val>"     set switch delay to value
-//    "UM<mode>"    set mode (fixed/preset/bitmap) 
+//    "UM<mode>"    set mode (fixed/preset/bitmap/text) 
 //    "UN<0|1>"     set interleave off/on
 //    "UO<index><name>" store a new fixed colour preset
 //    "UP<index>"   set the index for the presets
 //    "UQ<index>"   set the index for the palettes of the current preset
 //    "UR<colour><val>"     set Red channel for colour 0-4 to value
 //    "US"          save the current settings in the file system
-//    "UT<val>"     set the row refresh time
+//    "UT<val>"     set the row refresh time in ms (fractions allowed)
 //    "UU<n><val>"  set the value for parameter n
+//    "UV<0|1>"     set late frames to catch up/be dropped
+//    "UW<0|1>"     stop/run the cue list
+//    "UW<json>"    replace the cue list (see cues.cpp for the format)
 //    "UX<path>"    delete the specified file
+//    "UY<val>"     set the number of frames to blend from one bitmap row to the next
+//    "UZA<0|1>"    play tiled bitmaps a row/column at a time
+//    "UZV<val>"    move the viewport along a tiled bitmap's lines
+//    "UZT<0|1>"    store ordinary-width uploads as tiles too
+//    "UtT<text>"   set the message painted in text mode
+//    "UtS<val>"    set the size of the text
+//    "UtC<rrggbb>" set the colour of the text
+//    "Uk<val>"     set how often an unchanged frame is sent again in ms (0 sends every frame)
+//    "UbB<val>"    start baking val seconds of the current preset into /bmp/_<preset name>.bmp:
+//                  every browser is sent "UbP<percent>" as it goes, then "UbB<path>" or "UbE<error>"
+//    "UbC<path>"   check a baked bitmap: "bC0" up to date, "bC1" the preset has changed since,
+//                  "bC-1" not a baked preset
 function sendCmd(request) {
   // console.log(request);
   ws.send(request);
@@ -179,6 +194,9 @@ function updateComplete(data) {
     case 'M': // Change mode (mode is saved only if other settings also changed)
       updateSettings = false;
       break;
+    case 'W': // Cue list - not part of the settings
+      updateSettings = false;
+      break;
     case 'N': // Interleave  
       config.interleave = data[1] == '1' ? true : false;
       break;
@@ -203,6 +221,39 @@ function updateComplete(data) {
     case 'T': // Row display time  
       config.rowtime = data.substr(1);
       break;
+    case 'Y': // Frames to blend between bitmap rows
+      config.subrows = data.substr(1);
+      break;
+    case 't': // Text settings
+      if (data[1] == 'T')
+        config.text = data.substr(2);
+      else if (data[1] == 'S')
+        config.textscale = data.substr(2);
+      else if (data[1] == 'C')
+        config.textcolour = parseInt(data.substr(2), 16);
+      break;
+    case 'Z': // Tiled bitmap settings
+      if (data[1] == 'A')
+        config.scancolumns = data[2] == '1';
+      else if (data[1] == 'V')
+        config.viewport = data.substr(2);
+      else if (data[1] == 'T')
+        config.tileuploads = data[2] == '1';
+      break;
+    case 'b': // Baking a preset - not part of the settings
+      updateSettings = false;
+      if (data[1] == 'P')
+        document.getElementById("bakeprogress").innerHTML = data.substr(2) + "%";
+      else if (data[1] == 'B')
+        bakeDone(data.substr(2));
+      else if (data[1] == 'E') {
+        document.getElementById("bake").disabled = false;
+        document.getElementById("bakeprogress").innerHTML = "";
+        errorHandler("?" + data.substr(2));
+      }
+      else if (data[1] == 'C')
+        showBakeState(data.substr(2));
+      break;
     case 'U': // Preset parameter  
       config.presets[config.presetidx].parms[data[1]].values[2] = data.substr(2);
       break;
@@ -229,7 +280,7 @@ function updateComplete(data) {
 
 function setActivePage(navid) {
   if (document.getElementById(navid).classList.contains('active')) return; // Already active so do nothing
-  if (navid == "fixed" || navid == "preset" || navid == "bitmap") {
+  if (navid == "fixed" || navid == "preset" || navid == "bitmap" || navid == "text") {
     switch (navid) {
       case "fixed":
         config.mode = 0;
@@ -240,6 +291,9 @@ function setActivePage(navid) {
       case "bitmap":
         config.mode = 2;
         break;
+      case "text":
+        config.mode = 3;
+        break;
       default:
     }
     sendCmd("UM" + config.mode);
@@ -298,7 +352,7 @@ function setPowerSwitch() {
     y.disabled = false;
     w.disabled = false;
     looping = false;
-    document.getElementById("draw").innerHTML = "Draw";
+    document.getElementById("draw").innerHTML = document.getElementById("drawtext").innerHTML = "Draw";
   }
 }
 
@@ -630,6 +684,14 @@ function initPage(configString) {
   // Load the AP data
   document.getElementById("apssid").value = config.apssid;
   document.getElementById("appw").value = config.appw;
+  // Load the text settings
+  document.getElementById("message").value = config.text;
+  document.getElementById("textscale").value = config.textscale;
+  var c = config.textcolour.toString(16);
+  while (c.length < 6) {
+    c = "0" + c;
+  }
+  document.getElementById("textcolour").value = "#" + c;
   // Set the active page
   var page;
   switch (config.mode) {
@@ -642,6 +704,9 @@ function initPage(configString) {
     case 2:
       page = "bitmap";
       break;
+    case 3:
+      page = "text";
+      break;
     default:
       errorHandler("?Invalid mode: " + mode);
   }
@@ -654,6 +719,8 @@ function initPage(configString) {
 function fillBmpList(data) {
   // console.log("Filelist:", data)
   var files = data.split(":");
+  // If there are more files, the last item is ">" followed by where the next page starts
+  var next = files.length && files[files.length - 1][0] == ">" ? files.pop().substr(1) : "";
   filesel = document.getElementById("bitmaps");
   delsel = document.getElementById("delete");
   for (x of files) {
@@ -671,6 +738,8 @@ function fillBmpList(data) {
     delsel.add(dopt);
   }
   delsel.selectedIndex = -1;
+  if (next != "")
+    sendCmd("B" + next); // Get the next page
 }
 
 function setPreset() {
@@ -709,7 +778,7 @@ function drawBitmap() {
     btntext = "Draw";
   }
   sendCmd(s);
-  document.getElementById("draw").innerHTML = btntext;
+  document.getElementById("draw").innerHTML = document.getElementById("drawtext").innerHTML = btntext;
 }
 
 function setRepeat(state) {
@@ -727,6 +796,43 @@ function fillFileData(data) {
   document.getElementById("currentfile").innerHTML = s;
   showPreview();
   setDrawTime();
+  // Baked presets are called _<preset name>.bmp, so ask whether it needs baking again
+  document.getElementById("bakedrow").style.display = "none";
+  if (config.bmpfile.startsWith("/bmp/_"))
+    sendCmd("UbC" + config.bmpfile);
+}
+
+function showBakeState(stale) {
+  if (stale == "-1")
+    return; // Not a baked preset after all
+  document.getElementById("bakestate").innerHTML = stale == "1" ? "the preset has changed since - bake it again" : "up to date";
+  document.getElementById("bakedrow").style.display = "";
+}
+
+function bakePreset() {
+  document.getElementById("bake").disabled = true;
+  sendCmd("UbB" + document.getElementById("bakesecs").value);
+}
+
+// A bake has finished, so add the file to the lists if it's new, or update it if it's selected
+function bakeDone(path) {
+  document.getElementById("bake").disabled = false;
+  document.getElementById("bakeprogress").innerHTML = "done";
+  var filesel = document.getElementById("bitmaps");
+  for (opt of filesel.options) {
+    if (opt.value == path) {
+      if (config.bmpfile == path)
+        sendCmd("UF" + path);
+      return;
+    }
+  }
+  var name = path.substr(5); // Without the /bmp/
+  for (sel of [filesel, document.getElementById("delete")]) {
+    var opt = document.createElement("option");
+    opt.text = name;
+    opt.value = path;
+    sel.add(opt);
+  }
 }
 
 function showPreview() {
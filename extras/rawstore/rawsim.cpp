@@ -0,0 +1,323 @@
+// Raw flash store driver
+//
+// Runs the raw flash store's allocator on a PC, with a file standing in for the flash
+// (rawstore.cpp built with RAWSTORE_HOST). Bitmaps of random sizes are uploaded,
+// replaced and deleted as they would be over a season of use, the store is reloaded
+// from its directory now and then as after a restart, and every copy is read back and
+// checked against its file. It reports how fragmented the free space gets, how often
+// and how much the extents have to be slid down to make room, and how fast copies are
+// made and read back. The times are for the host's file system, so they show what the
+// allocator costs rather than how fast the flash is; the byte and erase counts are what
+// the flash would see.
+//
+// Build with make in this directory; RAWSTORE_SIZE=<bytes> on the make command line
+// tries a different size of store.
+//
+// Usage: rawsim [-n operations] [-s seed] [-v]
+
+#include "pixelstick.h"
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#define NAMES 48          // More bitmaps than there are directory entries
+#define MIN_ROWS 20       // Sizes of the bitmaps, as NUM_LEDS wide RGB888 rows
+#define MAX_ROWS 300
+#define READ_SIZE 1024    // Reads are the size the read-ahead buffer makes them
+#define DIRECTORY_SECTOR 4096
+
+void initRawStore();
+void rawStoreImport(const char *path);
+void rawStoreRemove(const char *path);
+uint32_t rawStoreFind(const char *path, uint32_t length);
+bool rawStoreRead(uint32_t offset, uint8_t *buf, uint32_t len);
+extern RawFlashStats rawFlashStats;
+
+struct Bitmap
+{
+  uint32_t length; // 0 if it hasn't been uploaded
+  uint32_t seed;   // Makes the contents of each upload different
+};
+
+Bitmap bitmaps[NAMES];
+uint32_t randomState = 1;
+uint32_t failures;
+
+struct Totals
+{
+  uint32_t uploads, stored, rejected, deletes, reloads, compactions, wastedCompactions;
+  uint64_t importBytes, movedBytes;
+  double importSeconds;
+  double fragmentationSum; // For the average over the run
+  double worstFragmentation;
+  uint32_t samples;
+} totals;
+
+uint32_t nextRandom()
+{ // xorshift32
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void bitmapPath(char *path, uint8_t n)
+{
+  snprintf(path, 32, "/bmp/bitmap%02u.bmp", n);
+}
+
+uint8_t contentByte(const Bitmap &b, uint32_t pos)
+{
+  return (pos * 2654435761U + b.seed) >> 13;
+}
+
+void fail(const char *what, const char *path)
+{
+  fprintf(stderr, "%s: %s\n", what, path);
+  failures++;
+}
+
+/// Where each stored copy is, so we can see when they have been moved
+void storedOffsets(uint32_t *offsets)
+{
+  char path[32];
+
+  for (uint8_t n = 0; n < NAMES; n++)
+  {
+    bitmapPath(path, n);
+    offsets[n] = bitmaps[n].length ? rawStoreFind(path, bitmaps[n].length) : 0;
+  }
+}
+
+/// 1 - largest free gap / total free space: 0 when the free space is all in one piece
+double fragmentation(uint32_t &freeBytes, uint32_t &largestGap)
+{
+  uint32_t offsets[NAMES];
+  std::vector<std::pair<uint32_t, uint32_t>> extents;
+
+  storedOffsets(offsets);
+  for (uint8_t n = 0; n < NAMES; n++)
+    if (offsets[n])
+      extents.push_back(std::make_pair(offsets[n], (bitmaps[n].length + DIRECTORY_SECTOR - 1) & ~(DIRECTORY_SECTOR - 1)));
+  std::sort(extents.begin(), extents.end());
+  uint32_t pos = DIRECTORY_SECTOR;
+  freeBytes = largestGap = 0;
+  extents.push_back(std::make_pair((uint32_t)RAWSTORE_SIZE, 0U));
+  for (auto &e : extents)
+  {
+    if (e.first < pos)
+      fail("Overlapping extents", "");
+    uint32_t gap = e.first > pos ? e.first - pos : 0;
+    freeBytes += gap;
+    largestGap = std::max(largestGap, gap);
+    pos = e.first + e.second;
+  }
+  return freeBytes ? 1.0 - (double)largestGap / freeBytes : 0;
+}
+
+void upload(uint8_t n)
+{
+  char path[32];
+  Bitmap &b = bitmaps[n];
+  uint32_t before[NAMES], after[NAMES];
+
+  bitmapPath(path, n);
+  b.length = NUM_LEDS * 3 * (MIN_ROWS + nextRandom() % (MAX_ROWS - MIN_ROWS + 1)) + sizeof(NativeHeader);
+  b.seed = nextRandom();
+  std::vector<uint8_t> data(b.length);
+  for (uint32_t i = 0; i < b.length; i++)
+    data[i] = contentByte(b, i);
+  File f = LittleFS.open(path, "w");
+  f.write(data.data(), b.length);
+  f.close();
+
+  storedOffsets(before);
+  rawStoreRemove(path); // As the upload does before it starts
+  double start = now();
+  rawStoreImport(path);
+  totals.importSeconds += now() - start;
+  storedOffsets(after);
+
+  totals.uploads++;
+  if (after[n])
+  {
+    totals.stored++;
+    totals.importBytes += b.length;
+  }
+  else
+    totals.rejected++;
+  bool compacted = false;
+  for (uint8_t i = 0; i < NAMES; i++)
+  {
+    if (i != n && before[i] && after[i] != before[i])
+    {
+      compacted = true;
+      totals.movedBytes += bitmaps[i].length;
+    }
+  }
+  totals.compactions += compacted;
+  totals.wastedCompactions += compacted && !after[n]; // Moved everything and still didn't fit
+}
+
+void remove(uint8_t n)
+{
+  char path[32];
+
+  bitmapPath(path, n);
+  LittleFS.remove(path);
+  rawStoreRemove(path);
+  bitmaps[n].length = 0;
+  totals.deletes++;
+}
+
+/// Read every stored copy back and check it. Returns the bytes read.
+uint64_t readBack()
+{
+  char path[32];
+  uint8_t buf[READ_SIZE];
+  uint64_t total = 0;
+
+  for (uint8_t n = 0; n < NAMES; n++)
+  {
+    Bitmap &b = bitmaps[n];
+    bitmapPath(path, n);
+    uint32_t offset = b.length ? rawStoreFind(path, b.length) : 0;
+    if (!b.length)
+    {
+      if (rawStoreFind(path, 0) || LittleFS.exists(path))
+        fail("Deleted bitmap still there", path);
+      continue;
+    }
+    if (!offset)
+      continue; // Wasn't room for it, so it plays from LittleFS
+    for (uint32_t pos = 0; pos < b.length; pos += READ_SIZE)
+    {
+      uint32_t len = std::min((uint32_t)READ_SIZE, b.length - pos);
+      if (!rawStoreRead(offset + pos, buf, len))
+      {
+        fail("Read failed", path);
+        break;
+      }
+      for (uint32_t i = 0; i < len; i++)
+        if (buf[i] != contentByte(b, pos + i))
+        {
+          fail("Copy doesn't match the file", path);
+          pos = b.length;
+          break;
+        }
+      total += len;
+    }
+  }
+  return total;
+}
+
+void usage()
+{
+  fprintf(stderr, "Usage: rawsim [-n operations] [-s seed] [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t operations = 5000;
+  char root[] = "/tmp/rawsimXXXXXX";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:v")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      operations = atoi(optarg);
+      break;
+    case 's':
+      randomState = std::max(1, atoi(optarg));
+      break;
+    case 'v':
+      hostVerbose = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (!mkdtemp(root) || chdir(root) != 0)
+  {
+    perror(root);
+    return 1;
+  }
+  hostRoot = root;
+  initRawStore();
+
+  for (uint32_t op = 0; op < operations; op++)
+  {
+    uint8_t n = nextRandom() % NAMES;
+    uint32_t kind = nextRandom() % 100;
+    if (kind < 60)
+      upload(n);
+    else if (kind < 95)
+    {
+      if (bitmaps[n].length)
+        remove(n);
+    }
+    else
+    {
+      initRawStore(); // As after a restart
+      totals.reloads++;
+    }
+    if (op % 10 == 9)
+    {
+      uint32_t freeBytes, largestGap;
+      double f = fragmentation(freeBytes, largestGap);
+      totals.fragmentationSum += f;
+      totals.worstFragmentation = std::max(totals.worstFragmentation, f);
+      totals.samples++;
+    }
+    if (op % 500 == 499)
+      readBack();
+  }
+
+  initRawStore();
+  double start = now();
+  uint64_t readBytes = readBack();
+  double readSeconds = now() - start;
+  uint32_t freeBytes, largestGap;
+  double f = fragmentation(freeBytes, largestGap);
+
+  printf("Store: %u KB, %u bitmap names, %u operations\n", RAWSTORE_SIZE / 1024, NAMES, operations);
+  printf("Uploads: %u (%u copied, %u didn't fit), %u deletes, %u reloads\n", totals.uploads, totals.stored,
+         totals.rejected, totals.deletes, totals.reloads);
+  printf("Fragmentation (1 - largest gap / free space): %.1f%% average, %.1f%% worst, %.1f%% at the end\n",
+         100 * totals.fragmentationSum / std::max(1U, totals.samples), 100 * totals.worstFragmentation, 100 * f);
+  printf("At the end: %u KB free, largest gap %u KB\n", freeBytes / 1024, largestGap / 1024);
+  printf("Compactions: %u (%u of them for uploads that still didn't fit), %.1f MB moved, %.2f bytes moved per byte copied\n",
+         totals.compactions, totals.wastedCompactions, totals.movedBytes / 1e6,
+         totals.importBytes ? (double)totals.movedBytes / totals.importBytes : 0);
+  printf("Flash: %.1f MB read, %.1f MB written, %u sectors erased (%.1f per copy)\n", rawFlashStats.readBytes / 1e6,
+         rawFlashStats.writtenBytes / 1e6, rawFlashStats.erases,
+         (double)rawFlashStats.erases / std::max(1U, totals.stored));
+  printf("Copying: %.1f MB/s including compaction; reading back: %.1f MB/s in %u byte reads\n",
+         totals.importSeconds ? totals.importBytes / 1e6 / totals.importSeconds : 0,
+         readSeconds ? readBytes / 1e6 / readSeconds : 0, READ_SIZE);
+
+  char path[32];
+  for (uint8_t n = 0; n < NAMES; n++)
+  {
+    bitmapPath(path, n);
+    LittleFS.remove(path);
+  }
+  unlink((std::string(root) + "/" RAWSTORE_IMAGE).c_str());
+  rmdir((std::string(root) + "/bmp").c_str());
+  rmdir(root);
+  if (failures)
+    printf("%u FAILED\n", failures);
+  return failures ? 1 : 0;
+}
@@ -1,15 +1,23 @@
 #ifndef PIXELSTICK_H
 #define PIXELSTICK_H
 
+#ifdef PIXELSTICK_HOST
+#include "host.h" // Building the bitmap code on a PC - see extras/bmpconvert
+#else
 #define FASTLED_ALLOW_INTERRUPTS 0
+#define USE_GET_MILLISECOND_TIMER // FastLED's beat functions take the time from the preset clock - see renderPreset()
+#include <stdint.h>
+uint32_t get_millisecond_timer();
 #include <FastLED.h>
 #include <Arduino.h>
 #include <LittleFS.h> // Include the LittleFS library
 #include <ArduinoJson.h>
 #include <WebSocketsServer.h>
+#endif
 
 #define USER_SWITCH D2
 #define NUM_LEDS 144
+#define MILLI_AMPS 4000 // Maximum current available to drive the LEDs (4000 allows 3A from the converter at max white)
 
 #define MAX_COLOURS 5    // Maximum number of colours in fixed colour mode
 #define MAX_FIXPRESETS 8 // If bigger than this, need to increase CONFIG_JSON_SIZE
@@ -17,6 +25,29 @@
 
 #define DEFAULT_BRIGHTNESS 36
 
+#define READAHEAD_SIZE 4096 // Size of the RAM ring buffer used to read ahead when playing bitmaps
+#define MAX_BMP_WIDTH 512   // Widest bitmap that can be played - rows are resampled to fit the LEDs
+#define MAX_SUBROWS 16      // Most frames that can be blended between two bitmap rows
+#define TILE_SIZE 16        // Width and height of the tiles in a tiled bitmap
+#define MAX_TILED_WIDTH 8192 // Widest bitmap that can be uploaded - anything wider than MAX_BMP_WIDTH is tiled
+#define TILE_CACHE_RESERVE 8192 // Free heap the tile cache has to leave for everything else
+
+#define BMP_CACHE_ENTRIES 4      // Number of images (or parts of images) that can be cached in RAM
+#define BMP_CACHE_MAX 16384      // Most RAM the bitmap cache can use
+#define BMP_CACHE_RESERVE 16384  // Free heap the bitmap cache has to leave for everything else
+#define BMP_PRELOAD_SIZE 4096    // Image data loaded into the cache while waiting for the switch delay
+
+#define MAX_CUES 16 // Most items in the cue list
+
+#define POWER_RED 80          // Power drawn by each colour of an LED at full brightness (mW)
+#define POWER_GREEN 55
+#define POWER_BLUE 75
+#define POWER_DARK 5          // Power drawn by an LED that is off (mW)
+#define POWER_WHITE (POWER_RED + POWER_GREEN + POWER_BLUE)
+#define POWER_PROFILE_MAX 512 // Most entries in a bitmap's power profile - tall images share each entry between several rows
+
+#define MAX_TEXT_SCALE 16 // Largest the text can be scaled - each glyph is 7 pixels high
+
 typedef unsigned char RGBColour[3];
 
 /// Structure to hold configuration data for the running code
@@ -25,7 +56,7 @@ typedef unsigned char RGBColour[3];
 struct Config
 {
   bool ledsOn;               // Current state of the LEDs
-  unsigned char mode;        // Fixed colour(s), presets or bitmap
+  unsigned char mode;        // Fixed colour(s), presets, bitmap or text
   unsigned char delay;       // Delay before display starts after user switch is pressed
   unsigned char brightness;  // Brightness
   unsigned char coloursUsed; // Number of colours used in fixed mode (1-5)
@@ -35,7 +66,16 @@ struct Config
   unsigned char presetIndex; // Current preset
   // Preset specific data goes here in the JSON version of the configuration
   // Palette specific data goes here in the JSON version of the configuration
-  unsigned int rowDisplayTime; // Delay before updating the LEDs with the next row of the bitmap
+  uint32_t rowDisplayMicros;   // Time between updates of the LEDs, e.g. each row of the bitmap (microseconds)
+  unsigned char latePolicy;    // What to do about frames that are drawn late
+  uint16_t keepaliveMillis;    // Longest an unchanged frame goes without being sent again (ms), 0 to send every frame
+  unsigned char subRows;       // Frames taken to blend from one bitmap row to the next (1 for no blending)
+  bool scanColumns;            // Play tiled bitmaps a column at a time rather than a row at a time
+  uint16_t viewport;           // First pixel of each line of a tiled bitmap shown on the LEDs
+  bool tileUploads;            // Tile all uploaded bitmaps, not just the ones too wide to play a row at a time
+  char text[64];               // Message painted in text mode
+  unsigned char textScale;     // Size of the text - each pixel of the font is painted textScale LEDs high and frames wide
+  uint32_t textColour;         // Colour of the text (0xRRGGBB)
   char bmpFile[32];            // Current bitmap
   char apssid[32];             // ESP8266 Access point SSID
   char appw[16];               // Wifi password for access point (8 characters minimum)
@@ -65,6 +105,100 @@ struct FileInfo
   uint16_t bitDepth;       // Bit depth of the image
   uint16_t compMethod;     // Compression method
   uint16_t status;         // Bitmap file status
+  uint8_t fileType;        // Windows BMP or native playback file
+  uint8_t pixelFormat;     // Layout of the pixels in each row
+  uint16_t rowBytes;       // Size of a row of pixels, not counting any padding or coding
+  uint32_t paletteOffset;  // Start address of the palette for indexed images
+  uint16_t paletteColours; // Number of colours in the palette
+  uint16_t powerStep;      // Rows covered by each entry of the power profile, 0 if there isn't one
+};
+
+/// Header for bitmaps converted to the native playback format when they are uploaded.
+/// The rows follow the header in the order they are played, unpadded. RGB888 rows are
+/// gamma corrected and in CRGB byte order so they can be copied straight into the LED
+/// array. Indexed images have their palette (RGB, 3 bytes per colour) straight after the
+/// header, and they and RGB565 images are gamma corrected through a lookup table as they
+/// are played. Rows may be compressed, in which case each one starts with a tag saying
+/// how it is coded. From version 3, row-coded files have a power profile between the
+/// palette and the rows: a byte for each powerStep rows, in playback order, giving the
+/// most power any of those rows draws (0-255, where 255 is every LED at full white).
+/// Files baked from a motion preset have NATIVE_BAKED set in their flags and a BakeInfo
+/// straight before the rows.
+struct NativeHeader
+{
+  uint16_t signature;  // NATIVE_SIGNATURE
+  uint8_t version;     // NATIVE_VERSION
+  uint8_t pixelFormat; // Layout of the pixels in each row
+  uint16_t width;      // Image width in pixels
+  uint16_t height;     // Image height in pixels
+  uint32_t dataOffset; // Start address of the first row in the file
+  uint8_t codec;       // How the rows are coded (version 2 onwards)
+  uint8_t flags;       // NATIVE_BAKED, or 0
+  uint16_t powerStep;  // Rows covered by each entry of the power profile, 0 if there isn't one (version 3 onwards)
+};
+
+/// What a baked file was drawn from, so it can be told whether the preset has been
+/// changed since
+struct BakeInfo
+{
+  uint32_t frameMicros;     // Time between frames - the row time it was baked for
+  uint16_t seed;            // Random numbers the preset was drawn with
+  int16_t parms[MAX_PARMS]; // Values of the preset's parameters
+  uint8_t presetIndex;      // The preset
+  int8_t paletteIndex;      // Its palette, -1 if it doesn't use one
+};
+
+/// Statistics for the bitmap read-ahead buffer, reset each time a bitmap is opened
+struct RowStreamStats
+{
+  uint32_t underruns;       // Number of times a row wasn't ready when it was needed
+  uint32_t refills;         // Number of reads from the file system
+  uint32_t bytesRead;       // Total bytes read from the file system
+  uint32_t refillMicros;    // Total time spent reading from the file system
+  uint32_t maxRefillMicros; // Longest single read from the file system
+  uint32_t rows;            // Number of rows drawn
+  uint32_t rowMicros;       // Total time spent getting rows ready for the LEDs, including decoding
+  uint32_t cachedBytes;     // Total bytes taken from the RAM cache instead of the file system
+};
+
+/// What the raw flash store has done to the flash, kept when it is built with
+/// RAWSTORE_HOST to try the allocator out on a PC
+struct RawFlashStats
+{
+  uint64_t readBytes;
+  uint64_t writtenBytes;
+  uint32_t erases; // Sectors erased
+};
+
+/// Image data cached in RAM
+struct CacheEntry
+{
+  char path[32];     // The bitmap file
+  uint32_t length;   // Size of the image data in the file
+  uint32_t capacity; // Number of bytes of the image data there is room for
+  uint32_t loaded;   // Number of bytes of the image data loaded so far
+  uint32_t lastUsed; // When the entry was last used, for throwing out the least recently used
+  bool locked;       // Being played, so it mustn't be thrown out
+  uint8_t *data;
+};
+
+/// Statistics for the frame scheduler, reset each time a new schedule is started
+struct FrameStats
+{
+  uint32_t frames;      // Number of frames drawn
+  uint32_t late;        // Number of frames drawn after the next one was already due
+  uint32_t dropped;     // Number of frames skipped to get back on schedule
+  uint32_t jitterTotal; // Total time frames were drawn after their deadline (microseconds)
+  uint32_t maxJitter;   // Longest time a frame was drawn after its deadline (microseconds)
+};
+
+/// An item in the cue list
+struct Cue
+{
+  unsigned char mode;  // MODE_FIXED, MODE_PRESET or MODE_BITMAP
+  unsigned char index; // Fixed colour preset or motion preset to show
+  uint32_t time;       // How long to show it for (ms) - 0 plays a bitmap once, or shows anything else until stopped
+  char bmpFile[32];    // Bitmap to play
 };
 
 struct Credentials
@@ -74,7 +208,37 @@ struct Credentials
 };
 
 // Typedefs and structures for preset data
-typedef void (*Preset)(); // Pointer to preset function
+/// Where a preset's time and random numbers come from. The live clock follows millis()
+/// and FastLED's random numbers; any other clock is moved on by whoever is drawing the
+/// frames and has a random number generator of its own, so it draws the same frames
+/// every time, at whatever frame rate it is given.
+struct PresetClock
+{
+  uint32_t now;       // Time of the frame being drawn (ms)
+  uint32_t last;      // Time of the preset's last frame
+  uint32_t hueMillis; // When the base colour last moved on
+  uint8_t hue;        // Rotating base colour
+  uint16_t seed;      // Random number generator state, if it isn't live
+  bool live;          // Driven by millis()
+};
+
+/// Everything a motion preset needs to draw a frame, worked out once per frame by
+/// renderPreset() so the presets don't have to keep looking it up for every LED. Presets
+/// take the time from here (or from FastLED's beat functions, which follow the clock
+/// they're drawn with) and random numbers from random8() and random16(), which give the
+/// clock's own numbers while the preset draws.
+struct PresetContext
+{
+  const CRGBPalette16 &palette; // The preset's palette (the first one if it doesn't use palettes)
+  const CRGB *colours;           // The palette expanded to 256 colours, so a colour is a single lookup
+  int parms[MAX_PARMS];         // Current values of the user parameters
+  uint32_t now;                 // Time of this frame (ms)
+  uint32_t delta;               // Time since the preset's last frame (ms), 0 for its first
+  uint8_t hue;                  // Rotating base colour
+};
+
+typedef void (*Preset)(const PresetContext &ctx); // Pointer to preset function
+typedef void (*PresetHook)();                     // Called when a preset starts or stops
 
 struct PresetParm // Structure for parameters user can change
 {
@@ -88,6 +252,8 @@ struct PresetInfo
   Preset presetfn;             // Preset function
   PresetParm parms[MAX_PARMS]; // Allow each preset up to three user parameters
   signed char paletteIndex;    // -1 if the preset doesn't use palettes
+  PresetHook init;             // Called before its first frame, if it needs it
+  PresetHook teardown;         // Called when another preset or mode takes over, if it needs it
 };
 
 // struct Palette
@@ -96,10 +262,37 @@ struct PresetInfo
 //   CRGBPalette16 palette;
 // };
 
+// Bitmap file types
+#define FILE_BMP 0
+#define FILE_NATIVE 1
+
+// Native playback format
+#define NATIVE_SIGNATURE 0x5350 // "PS"
+#define NATIVE_VERSION 3
+#define NATIVE_BAKED 0x01 // Baked from a motion preset
+#define PIXEL_RGB888 0   // 3 bytes per pixel in CRGB order
+#define PIXEL_RGB565 1   // 2 bytes per pixel, little-endian
+#define PIXEL_INDEXED8 2 // 1 byte per pixel, an index into the palette
+#define PIXEL_INDEXED4 3 // 2 pixels per byte, first pixel in the high nibble
+#define PIXEL_BGR888 4   // 24-bit BMP rows (BMP files only)
+#define PIXEL_RGB555 5   // 16-bit BMP rows (BMP files only)
+#define CODEC_NONE 0     // Rows stored as they are
+#define CODEC_ROWS 1     // Each row is tagged with one of the row codecs below
+#define CODEC_TILES 2    // Uncompressed TILE_SIZE x TILE_SIZE tiles, a band at a time from the first row
+#define ROW_RAW 0        // Row stored as it is
+#define ROW_RLE 1        // Runs of pixels
+#define ROW_LZ 2         // Copies from earlier in the row or the previous row
+#define ROW_CODE_MAX (MAX_BMP_WIDTH * 3 + 1) // Biggest coded row: a raw row and its tag
+
 // Display modes
 #define MODE_FIXED 0
 #define MODE_PRESET 1
 #define MODE_BITMAP 2
+#define MODE_TEXT 3
+
+// Late frame policies
+#define SCHEDULE_CATCHUP 0 // Draw missed frames straight away until we're back on schedule
+#define SCHEDULE_DROP 1    // Skip missed frames
 
 // Switch status codes
 enum Switch
@@ -126,6 +319,7 @@ enum WiFiStatus
 #define BAD_COMPRESSION 0x04
 #define BAD_SIGNATURE 0x08
 #define OPEN_ERROR 0x10
+#define BAD_SIZE 0x20
 
 Config &
 getConfig();
@@ -0,0 +1,254 @@
+#include "pixelstick.h"
+
+// Baked presets
+//
+// The motion presets work out every LED afresh each frame, and the busier ones (pride,
+// colour waves, TwinkleFox) take long enough over it to hold the frame rate down and
+// take time from the WiFi. A preset can be baked instead: drawn ahead of time, for a
+// number of seconds at the row time, into a native bitmap with a row for each frame,
+// which then plays like any other bitmap through the read-ahead buffer at whatever rate
+// the row time asks for. The frames are drawn with a clock of their own (see
+// renderPreset()), so it doesn't matter how long each one takes to draw, and from a
+// fixed seed, so baking the same preset again gives the same file. Each frame is
+// compressed as soon as it has been drawn and the coded rows are written out in blocks.
+// A bake takes a while, so it is drawn a batch of frames at a time from serviceLeds(),
+// keeping the WiFi and the web interface going, with its progress sent to the browsers.
+// Nothing else is drawn on the LEDs until it has finished.
+// What the preset was baked with is kept in the file, so the UI can tell when the
+// preset has been changed since.
+
+#define BAKE_WRITE_SIZE 4096 // Coded rows are written to the file system in blocks this big
+#define BAKE_SEED 11337      // Random number seed for every bake
+#define BAKE_ROW_BYTES (NUM_LEDS * 3)
+#define BAKE_BATCH_MILLIS 20 // Time spent drawing frames each time round the loop
+
+struct BakeBuffers
+{
+  CRGB saved[NUM_LEDS];               // What the LEDs are showing, while a batch is drawn
+  uint8_t prev[BAKE_ROW_BYTES];       // The previous frame, for the LZ codec and to carry on drawing from
+  uint8_t scratch[ROW_CODE_MAX];      // Working space for the encoder
+  uint8_t out[BAKE_WRITE_SIZE];       // Coded rows waiting to be written
+  uint8_t profile[POWER_PROFILE_MAX]; // Power profile
+};
+
+extern CRGB leds[];
+extern PresetInfo presetList[];
+extern const uint8_t presetNum;
+extern FileInfo currentFile;
+extern WebSocketsServer ws;
+
+void endPreset();
+void startPresetClock(PresetClock &clock, uint32_t start, uint16_t seed);
+uint32_t renderPreset(PresetInfo &preset, PresetClock &clock, uint32_t now, const int *parms = NULL);
+uint16_t encodeRow(const uint8_t *prev, const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out, uint8_t *scratch);
+void getBmpInfo(char *path);
+void updateBmpIndex(const char *path);
+void dropCacheEntries(const char *path);
+void rawStoreImport(const char *path);
+
+BakeBuffers *bakeBuf;                  // Only allocated while baking
+File bakeFile;
+char bakePath[sizeof(FileInfo::path)]; // The file being baked
+char bakeTempPath[sizeof(FileInfo::path)];
+BakeInfo bakeInfo;                     // What it's being baked with
+PresetClock bakeClock;
+int bakeParms[MAX_PARMS];
+uint32_t bakeFrames;                   // Frames to draw
+uint32_t bakeFrame;                    // Next frame to draw
+uint16_t bakePowerStep;
+uint16_t bakePowerEntries;
+uint16_t bakeOutLen;                   // Bytes waiting in out
+uint8_t bakePercent;                   // Progress last sent to the browsers
+uint32_t bakeStart;
+
+/// What baking a preset with its current settings would give
+void getBakeInfo(uint8_t index, BakeInfo &info)
+{
+  PresetInfo &preset = presetList[index];
+
+  memset(&info, 0, sizeof(info)); // So the padding compares equal too
+  info.frameMicros = getConfig().rowDisplayMicros;
+  info.seed = BAKE_SEED;
+  for (uint8_t i = 0; i < MAX_PARMS; i++)
+    info.parms[i] = preset.parms[i].values[2];
+  info.presetIndex = index;
+  info.paletteIndex = preset.paletteIndex;
+}
+
+bool baking()
+{
+  return bakeBuf != NULL;
+}
+
+/// Start baking the current preset, with its current parameters, for the given number of
+/// seconds at the row time. It goes in /bmp/_<preset name>.bmp, replacing any earlier
+/// bake, once serviceBake() has drawn all the frames. Returns NULL if it has started, or
+/// what's wrong if it can't be baked.
+const char *startBake(uint16_t seconds)
+{
+  uint8_t index = getConfig().presetIndex;
+  NativeHeader header;
+
+  if (baking())
+    return "Already baking a preset";
+  if (index >= presetNum)
+    return "No preset to bake";
+  PresetInfo &preset = presetList[index];
+  getBakeInfo(index, bakeInfo);
+  bakeFrames = bakeInfo.frameMicros ? (uint64_t)seconds * 1000000 / bakeInfo.frameMicros : 0;
+  if (bakeFrames == 0 || bakeFrames > 0xFFFF)
+    return "Can't bake that many frames";
+  bakePowerStep = (bakeFrames + POWER_PROFILE_MAX - 1) / POWER_PROFILE_MAX;
+  bakePowerEntries = (bakeFrames + bakePowerStep - 1) / bakePowerStep;
+
+  snprintf(bakePath, sizeof(bakePath), "/bmp/_%s.bmp", preset.name.c_str());
+  strlcpy(bakeTempPath, bakePath, sizeof(bakeTempPath));
+  strcpy(bakeTempPath + strlen(bakeTempPath) - 4, ".tmp"); // Swap the .bmp for .tmp
+  if (!(bakeBuf = (BakeBuffers *)malloc(sizeof(BakeBuffers))))
+    return "Not enough memory to bake the preset";
+  if (!(bakeFile = LittleFS.open(bakeTempPath, "w")))
+  {
+    Serial.print(F("Error opening file: "));
+    Serial.println(bakeTempPath);
+    free(bakeBuf);
+    bakeBuf = NULL;
+    return "Error creating the file";
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.signature = NATIVE_SIGNATURE;
+  header.version = NATIVE_VERSION;
+  header.pixelFormat = PIXEL_RGB888;
+  header.width = NUM_LEDS;
+  header.height = bakeFrames;
+  header.dataOffset = sizeof(header) + bakePowerEntries + sizeof(bakeInfo);
+  header.codec = CODEC_ROWS;
+  header.flags = NATIVE_BAKED;
+  header.powerStep = bakePowerStep;
+  memset(bakeBuf->profile, 0, sizeof(bakeBuf->profile));
+  bakeFile.write((uint8_t *)&header, sizeof(header));
+  bakeFile.write(bakeBuf->profile, bakePowerEntries); // Filled in once the frames have been drawn
+  bakeFile.write((uint8_t *)&bakeInfo, sizeof(bakeInfo));
+
+  // Draw the frames from the start, as if the preset had just been picked
+  endPreset(); // The live preset starts again afterwards
+  if (preset.init)
+    preset.init();
+  memset(bakeBuf->prev, 0, sizeof(bakeBuf->prev)); // The first frame is drawn over black
+  for (uint8_t i = 0; i < MAX_PARMS; i++)
+    bakeParms[i] = bakeInfo.parms[i];
+  startPresetClock(bakeClock, 0, bakeInfo.seed);
+  bakeFrame = 0;
+  bakeOutLen = 0;
+  bakePercent = 0;
+  bakeStart = millis();
+  return NULL;
+}
+
+/// Tidy up after the last frame, or an error, and tell the browsers how it went
+void endBake(bool ok)
+{
+  char s[sizeof(bakePath) + 4];
+  PresetInfo &preset = presetList[bakeInfo.presetIndex];
+
+  if (ok && bakeOutLen)
+    ok = bakeFile.write(bakeBuf->out, bakeOutLen) == bakeOutLen;
+  if (ok)
+    ok = bakeFile.seek(sizeof(NativeHeader), SeekSet) &&
+         bakeFile.write(bakeBuf->profile, bakePowerEntries) == bakePowerEntries;
+  bakeFile.close();
+  if (preset.teardown)
+    preset.teardown();
+  free(bakeBuf);
+  bakeBuf = NULL;
+
+  if (!ok)
+  {
+    Serial.println(F("Error writing the baked preset - the file system may be full"));
+    LittleFS.remove(bakeTempPath);
+    ws.broadcastTXT("UbEError writing the baked preset - the file system may be full");
+    return;
+  }
+  LittleFS.remove(bakePath);
+  LittleFS.rename(bakeTempPath, bakePath);
+  Serial.printf("Baked %s: %lu frames in %lu ms\n", bakePath, (unsigned long)bakeFrames,
+                (unsigned long)(millis() - bakeStart));
+  updateBmpIndex(bakePath);
+  dropCacheEntries(bakePath);
+  rawStoreImport(bakePath); // Replaces any copy of the old file
+  if (strcmp(bakePath, currentFile.path) == 0) // The selected file has been replaced
+    getBmpInfo(bakePath);
+  snprintf(s, sizeof(s), "UbB%s", bakePath);
+  ws.broadcastTXT(s);
+}
+
+/// Draw the next batch of frames of the bake, if there is one. Returns true if a bake is
+/// under way, in which case nothing else should be drawn.
+bool serviceBake()
+{
+  if (!baking())
+    return false;
+  PresetInfo &preset = presetList[bakeInfo.presetIndex];
+  int8_t livePalette = preset.paletteIndex;
+  uint32_t start = millis();
+  bool ok = true;
+
+  // The LEDs keep showing what they were, and the frames are drawn where the last batch left off
+  memcpy(bakeBuf->saved, leds, sizeof(bakeBuf->saved));
+  memcpy(leds, bakeBuf->prev, BAKE_ROW_BYTES);
+  preset.paletteIndex = bakeInfo.paletteIndex; // In case it's changed in the interface meanwhile
+  do
+  {
+    uint32_t load = renderPreset(preset, bakeClock, (uint64_t)bakeFrame * bakeInfo.frameMicros / 1000, bakeParms);
+    uint32_t level = (load + (uint32_t)NUM_LEDS * POWER_WHITE - 1) / ((uint32_t)NUM_LEDS * POWER_WHITE); // Rounded up
+    if (level > bakeBuf->profile[bakeFrame / bakePowerStep])
+      bakeBuf->profile[bakeFrame / bakePowerStep] = level;
+
+    if (bakeOutLen + ROW_CODE_MAX > BAKE_WRITE_SIZE)
+    {
+      ok = bakeFile.write(bakeBuf->out, bakeOutLen) == bakeOutLen;
+      bakeOutLen = 0;
+    }
+    bakeOutLen += encodeRow(bakeBuf->prev, (const uint8_t *)leds, BAKE_ROW_BYTES, 3, bakeBuf->out + bakeOutLen, bakeBuf->scratch);
+    memcpy(bakeBuf->prev, leds, BAKE_ROW_BYTES);
+    bakeFrame++;
+  } while (ok && bakeFrame < bakeFrames && millis() - start < BAKE_BATCH_MILLIS);
+  preset.paletteIndex = livePalette;
+  memcpy(leds, bakeBuf->saved, sizeof(bakeBuf->saved));
+
+  if (!ok || bakeFrame == bakeFrames)
+  {
+    endBake(ok);
+    return true;
+  }
+  uint8_t percent = (uint64_t)bakeFrame * 100 / bakeFrames;
+  if (percent != bakePercent)
+  {
+    char s[8];
+    bakePercent = percent;
+    snprintf(s, sizeof(s), "UbP%u", percent);
+    ws.broadcastTXT(s);
+  }
+  return true;
+}
+
+/// Check a baked file against the current settings of the preset it was baked from.
+/// Returns 0 if it is up to date, 1 if the preset's parameters, palette or the row time
+/// have changed since, or -1 if the file isn't a baked preset.
+int8_t bakeStale(const char *path)
+{
+  NativeHeader header;
+  BakeInfo baked, current;
+  File f;
+
+  if (!(f = LittleFS.open(path, "r")))
+    return -1;
+  bool found = f.read((uint8_t *)&header, sizeof(header)) == sizeof(header) && header.signature == NATIVE_SIGNATURE &&
+               (header.flags & NATIVE_BAKED) && header.dataOffset >= sizeof(header) + sizeof(baked) &&
+               f.seek(header.dataOffset - sizeof(baked), SeekSet) && f.read((uint8_t *)&baked, sizeof(baked)) == sizeof(baked);
+  f.close();
+  if (!found || baked.presetIndex >= presetNum)
+    return -1;
+  getBakeInfo(baked.presetIndex, current);
+  return memcmp(&baked, &current, sizeof(current)) != 0;
+}
@@ -0,0 +1,103 @@
+#include "pixelstick.h"
+
+// RAM cache for bitmap data
+//
+// Small images, and the first part of the image that is about to be played, are kept in
+// RAM so the read-ahead buffer can be filled without going near the flash. Entries are
+// filled as the image is read, so a short logo that is looped is only read from flash
+// once. When there isn't room for a new entry, the one that was used least recently is
+// thrown away. The cache never takes the free heap below BMP_CACHE_RESERVE.
+
+CacheEntry bmpCache[BMP_CACHE_ENTRIES];
+uint32_t cacheClock; // Bumped each time an entry is used, for working out which was used least recently
+
+uint32_t cacheSize()
+{
+  uint32_t size = 0;
+  for (uint8_t i = 0; i < BMP_CACHE_ENTRIES; i++)
+    size += bmpCache[i].capacity;
+  return size;
+}
+
+void freeCacheEntry(CacheEntry &entry)
+{
+  free(entry.data);
+  memset(&entry, 0, sizeof(entry));
+}
+
+/// Find the cached data for the image data of length bytes in path
+CacheEntry *findCacheEntry(const char *path, uint32_t length)
+{
+  for (uint8_t i = 0; i < BMP_CACHE_ENTRIES; i++)
+  {
+    CacheEntry &entry = bmpCache[i];
+    if (entry.data && entry.length == length && strcmp(entry.path, path) == 0)
+    {
+      entry.lastUsed = ++cacheClock;
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+/// Make a new, empty, entry with room for size bytes of the image data, throwing out the
+/// least recently used entries to make room. Returns NULL if it won't fit.
+CacheEntry *newCacheEntry(const char *path, uint32_t length, uint32_t size)
+{
+  if (size > BMP_CACHE_MAX)
+    return NULL;
+  while (true)
+  {
+    CacheEntry *oldest = NULL;
+    CacheEntry *unused = NULL;
+    for (uint8_t i = 0; i < BMP_CACHE_ENTRIES; i++)
+    {
+      CacheEntry &entry = bmpCache[i];
+      if (!entry.data)
+        unused = &entry;
+      else if (!entry.locked && (!oldest || entry.lastUsed < oldest->lastUsed))
+        oldest = &entry;
+    }
+    if (unused && cacheSize() + size <= BMP_CACHE_MAX && ESP.getFreeHeap() >= size + BMP_CACHE_RESERVE)
+    {
+      if (!(unused->data = (uint8_t *)malloc(size)))
+        return NULL;
+      strlcpy(unused->path, path, sizeof(unused->path));
+      unused->length = length;
+      unused->capacity = size;
+      unused->loaded = 0;
+      unused->lastUsed = ++cacheClock;
+      return unused;
+    }
+    if (!oldest)
+      return NULL; // Nothing left that we can throw out
+    freeCacheEntry(*oldest);
+  }
+}
+
+/// Forget anything cached for path - called when the file is replaced or deleted
+void dropCacheEntries(const char *path)
+{
+  for (uint8_t i = 0; i < BMP_CACHE_ENTRIES; i++)
+  {
+    CacheEntry &entry = bmpCache[i];
+    if (!entry.data || strcmp(entry.path, path) != 0)
+      continue;
+    if (entry.locked)
+    { // It's being played, so just make sure nothing more is taken from it
+      entry.loaded = 0;
+      entry.capacity = 0;
+      entry.path[0] = 0;
+    }
+    else
+      freeCacheEntry(entry);
+  }
+}
+
+/// Finished playing from this entry, so it can be thrown out if it needs to be
+void releaseCacheEntry(CacheEntry *entry)
+{
+  entry->locked = false;
+  if (!entry->path[0])
+    freeCacheEntry(*entry); // The file was replaced while it was being played
+}
@@ -0,0 +1,341 @@
+#include "pixelstick.h"
+
+// Bitmap library index
+//
+// The details of every bitmap in /bmp are kept in an index file, one fixed size record
+// per file, so listing the library or selecting a file doesn't mean opening and parsing
+// every bitmap. The index is updated a record at a time as files are uploaded and
+// deleted - deleted records are blanked and reused. Listings are sent a page at a time
+// so the memory they need doesn't depend on the number of files. If the index is
+// missing, or was written by a different version of the code, it is rebuilt at start up.
+// A hash of each path is kept in RAM, sorted, with the slot it is in, so finding a file
+// reads just its record rather than every record before it. If there isn't the memory
+// for the table the index is searched from the start instead.
+
+#define INDEX_SIGNATURE 0x4942 // "BI"
+#define INDEX_PAGE_SIZE 16     // Number of files in each page of a listing
+#define INDEX_TABLE_STEP 32    // Hash table entries allocated at a time
+
+const char INDEX_FILENAME[] PROGMEM = "/bmpindex.dat";
+
+struct IndexHeader
+{
+  uint16_t signature;  // INDEX_SIGNATURE
+  uint16_t recordSize; // Size of each record, so a change to FileInfo forces a rebuild
+  uint16_t files;      // Number of records in use
+};
+
+struct IndexEntry
+{
+  uint16_t hash; // pathHash() of the file's path
+  uint16_t slot; // Record it is in
+};
+
+void readBmpInfo(const char *path, FileInfo &info);
+
+IndexHeader indexHeader;
+IndexEntry *indexTable;   // Sorted by hash, NULL if we ran out of memory for it
+uint16_t indexEntries;    // Entries in the table
+uint16_t indexTableSize;  // Entries there is room for
+uint16_t indexSlots;      // Records in the file, in use or blank
+
+uint32_t recordOffset(uint16_t slot)
+{
+  return sizeof(IndexHeader) + (uint32_t)slot * sizeof(FileInfo);
+}
+
+/// FNV-1a, folded to 16 bits
+uint16_t pathHash(const char *path)
+{
+  uint32_t h = 2166136261;
+
+  while (*path)
+  {
+    h ^= (uint8_t)*path++;
+    h *= 16777619;
+  }
+  return h ^ (h >> 16);
+}
+
+/// Position of the first entry in the table with a hash of at least hash
+uint16_t findIndexEntry(uint16_t hash)
+{
+  uint16_t low = 0, high = indexEntries;
+
+  while (low < high)
+  {
+    uint16_t mid = (low + high) / 2;
+    if (indexTable[mid].hash < hash)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/// Start a new table, for an index with no files in it
+void clearIndexTable()
+{
+  indexEntries = 0;
+  if (!indexTable)
+  { // Try again - there may be the memory for it now
+    indexTableSize = INDEX_TABLE_STEP;
+    indexTable = (IndexEntry *)malloc(indexTableSize * sizeof(IndexEntry));
+  }
+}
+
+void addIndexEntry(const char *path, uint16_t slot)
+{
+  if (!indexTable)
+    return;
+  if (indexEntries == indexTableSize)
+  {
+    IndexEntry *bigger = (IndexEntry *)realloc(indexTable, (indexTableSize + INDEX_TABLE_STEP) * sizeof(IndexEntry));
+    if (!bigger)
+    {
+      Serial.println(F("Not enough memory for the bitmap index table"));
+      free(indexTable);
+      indexTable = NULL;
+      return;
+    }
+    indexTable = bigger;
+    indexTableSize += INDEX_TABLE_STEP;
+  }
+  uint16_t hash = pathHash(path);
+  uint16_t i = findIndexEntry(hash);
+  memmove(indexTable + i + 1, indexTable + i, (indexEntries - i) * sizeof(IndexEntry));
+  indexTable[i].hash = hash;
+  indexTable[i].slot = slot;
+  indexEntries++;
+}
+
+void removeIndexEntry(const char *path, uint16_t slot)
+{
+  if (!indexTable)
+    return;
+  uint16_t hash = pathHash(path);
+  for (uint16_t i = findIndexEntry(hash); i < indexEntries && indexTable[i].hash == hash; i++)
+  {
+    if (indexTable[i].slot == slot)
+    {
+      indexEntries--;
+      memmove(indexTable + i, indexTable + i + 1, (indexEntries - i) * sizeof(IndexEntry));
+      return;
+    }
+  }
+}
+
+/// Write the index from scratch by reading every bitmap in /bmp
+void buildBmpIndex()
+{
+  File index;
+  FileInfo info;
+  Dir dir = LittleFS.openDir("/bmp");
+
+  if (!(index = LittleFS.open(FPSTR(INDEX_FILENAME), "w")))
+  {
+    Serial.println(F("Error creating bitmap index"));
+    return;
+  }
+  indexHeader.signature = INDEX_SIGNATURE;
+  indexHeader.recordSize = sizeof(FileInfo);
+  indexHeader.files = 0;
+  clearIndexTable();
+  index.write((uint8_t *)&indexHeader, sizeof(indexHeader));
+  while (dir.next())
+  {
+    if (!dir.fileName().endsWith(".bmp"))
+      continue;
+    readBmpInfo(("/bmp/" + dir.fileName()).c_str(), info);
+    index.write((uint8_t *)&info, sizeof(info));
+    addIndexEntry(info.path, indexHeader.files);
+    indexHeader.files++;
+  }
+  indexSlots = indexHeader.files;
+  index.seek(0, SeekSet);
+  index.write((uint8_t *)&indexHeader, sizeof(indexHeader));
+  index.close();
+}
+
+/// Check the index is there and up to date, and rebuild it if not
+void initBmpIndex()
+{
+  File index = LittleFS.open(FPSTR(INDEX_FILENAME), "r");
+
+  memset(&indexHeader, 0, sizeof(indexHeader));
+  if (index)
+  {
+    index.read((uint8_t *)&indexHeader, sizeof(indexHeader));
+    if (indexHeader.signature == INDEX_SIGNATURE && indexHeader.recordSize == sizeof(FileInfo))
+    { // Load the table with one pass through the records
+      FileInfo info;
+      clearIndexTable();
+      for (indexSlots = 0; index.read((uint8_t *)&info, sizeof(info)) == sizeof(info); indexSlots++)
+        if (info.path[0])
+          addIndexEntry(info.path, indexSlots);
+    }
+    index.close();
+  }
+  if (indexHeader.signature != INDEX_SIGNATURE || indexHeader.recordSize != sizeof(FileInfo))
+  {
+    Serial.println(F("Building bitmap index"));
+    buildBmpIndex();
+  }
+}
+
+/// The first blank record, or the end of the file if there isn't one
+int16_t firstFreeSlot()
+{
+  if (indexEntries >= indexSlots)
+    return indexSlots;
+  uint8_t *used = (uint8_t *)calloc((indexSlots + 7) / 8, 1);
+  if (!used)
+    return indexSlots; // Let the file grow rather than fail
+  for (uint16_t i = 0; i < indexEntries; i++)
+    used[indexTable[i].slot / 8] |= 1 << (indexTable[i].slot % 8);
+  uint16_t slot = 0;
+  while (slot < indexSlots && (used[slot / 8] & (1 << (slot % 8))))
+    slot++;
+  free(used);
+  return slot;
+}
+
+/// Find the slot holding path. Returns -1 if it isn't there, and sets freeSlot to the
+/// first unused slot (which may be the end of the file).
+int16_t findIndexSlot(File &index, const char *path, int16_t &freeSlot)
+{
+  FileInfo info;
+  int16_t slot = 0;
+
+  if (indexTable)
+  {
+    uint16_t hash = pathHash(path);
+    for (uint16_t i = findIndexEntry(hash); i < indexEntries && indexTable[i].hash == hash; i++)
+    {
+      index.seek(recordOffset(indexTable[i].slot), SeekSet);
+      if (index.read((uint8_t *)&info, sizeof(info)) == sizeof(info) && strcmp(info.path, path) == 0)
+        return indexTable[i].slot;
+    }
+    freeSlot = firstFreeSlot();
+    return -1;
+  }
+  // No table, so look through the records
+  freeSlot = -1;
+  index.seek(recordOffset(0), SeekSet);
+  while (index.read((uint8_t *)&info, sizeof(info)) == sizeof(info))
+  {
+    if (strcmp(info.path, path) == 0)
+      return slot;
+    if (!info.path[0] && freeSlot < 0)
+      freeSlot = slot;
+    slot++;
+  }
+  if (freeSlot < 0)
+    freeSlot = slot;
+  return -1;
+}
+
+/// Add a new or replaced bitmap to the index
+void updateBmpIndex(const char *path)
+{
+  File index;
+  FileInfo info;
+  int16_t freeSlot;
+
+  if (!(index = LittleFS.open(FPSTR(INDEX_FILENAME), "r+")))
+  {
+    buildBmpIndex(); // The index has gone missing, so this will pick the file up anyway
+    return;
+  }
+  int16_t slot = findIndexSlot(index, path, freeSlot);
+  if (slot < 0)
+  {
+    slot = freeSlot;
+    if (slot == indexSlots)
+      indexSlots++;
+    addIndexEntry(path, slot);
+    indexHeader.files++;
+    index.seek(0, SeekSet);
+    index.write((uint8_t *)&indexHeader, sizeof(indexHeader));
+  }
+  readBmpInfo(path, info);
+  index.seek(recordOffset(slot), SeekSet);
+  index.write((uint8_t *)&info, sizeof(info));
+  index.close();
+}
+
+/// Take a deleted bitmap out of the index
+void removeFromBmpIndex(const char *path)
+{
+  File index;
+  FileInfo info;
+  int16_t freeSlot;
+
+  if (!(index = LittleFS.open(FPSTR(INDEX_FILENAME), "r+")))
+    return;
+  int16_t slot = findIndexSlot(index, path, freeSlot);
+  if (slot >= 0)
+  {
+    memset(&info, 0, sizeof(info));
+    index.seek(recordOffset(slot), SeekSet);
+    index.write((uint8_t *)&info, sizeof(info));
+    removeIndexEntry(path, slot);
+    indexHeader.files--;
+    index.seek(0, SeekSet);
+    index.write((uint8_t *)&indexHeader, sizeof(indexHeader));
+  }
+  index.close();
+}
+
+/// Get the details of a bitmap from the index. Returns false if it isn't there.
+bool findBmpIndex(const char *path, FileInfo &info)
+{
+  File index;
+  int16_t freeSlot;
+
+  if (!(index = LittleFS.open(FPSTR(INDEX_FILENAME), "r")))
+    return false;
+  int16_t slot = findIndexSlot(index, path, freeSlot);
+  if (slot >= 0)
+  {
+    index.seek(recordOffset(slot), SeekSet);
+    index.read((uint8_t *)&info, sizeof(info));
+  }
+  index.close();
+  return slot >= 0;
+}
+
+/// Read the next page of the index, starting at slot start. Calls fn for each bitmap
+/// and returns the slot to start the next page from, or 0 if there are no more.
+uint16_t readIndexPage(uint16_t start, void (*fn)(const FileInfo &info, String &s), String &s)
+{
+  File index;
+  FileInfo info;
+  uint16_t count = 0;
+  uint16_t slot = start;
+
+  if (!(index = LittleFS.open(FPSTR(INDEX_FILENAME), "r")))
+    return 0;
+  index.seek(recordOffset(start), SeekSet);
+  while (index.read((uint8_t *)&info, sizeof(info)) == sizeof(info))
+  {
+    if (info.path[0])
+    {
+      if (count == INDEX_PAGE_SIZE)
+      { // There's at least one more, so this is where the next page starts
+        index.close();
+        return slot;
+      }
+      fn(info, s);
+      count++;
+    }
+    slot++;
+  }
+  index.close();
+  return 0;
+}
+
+uint16_t getBmpIndexCount()
+{
+  return indexHeader.files;
+}
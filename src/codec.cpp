@@ -0,0 +1,250 @@
+#include "pixelstick.h"
+
+// Row codecs for the native playback format
+//
+// Each row is stored with a one byte tag saying how it has been coded:
+//   ROW_RAW - the row as it is
+//   ROW_RLE - runs of pixels: a count byte n, then either (n & 0x80) one pixel repeated
+//             (n & 0x7F) + 1 times, or n + 1 literal pixels. Pixels are whole bytes, so
+//             for 4-bit images a "pixel" is a pair of pixels.
+//   ROW_LZ  - bytes copied from earlier in the row or from the row before: a count byte n,
+//             then either (n & 0x80) a 16-bit distance back and (n & 0x7F) + 3 bytes to
+//             copy, or n + 1 literal bytes
+// The encoder tries each and keeps the smallest, so no row is ever more than one byte
+// bigger than it was. RLE and LZ can both come out bigger than the row itself (literals
+// cost a count byte for every 128, and a row of short matches costs more than it saves),
+// so each gives up as soon as it gets as big as the row, which also keeps them inside
+// the output buffer. The LZ window is the previous row plus the current row, so the
+// decoder only ever needs two rows of RAM, whatever the size of the image.
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7F + LZ_MIN_MATCH)
+#define LZ_HASH_SIZE 256
+
+bool readRowStream(uint8_t *buf, uint16_t len);
+
+/// Get byte i of the window, where negative indexes are in the previous row
+inline uint8_t windowByte(const uint8_t *prev, const uint8_t *row, int16_t i, uint16_t rowBytes)
+{
+  return i < 0 ? prev[rowBytes + i] : row[i];
+}
+
+/// Returns the number of bytes written to out, or rowBytes if the coded row wouldn't be
+/// any smaller than the row, in which case out has at most rowBytes bytes written to it.
+uint16_t encodeRle(const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out)
+{
+  uint16_t pixels = rowBytes / pixelBytes;
+  uint16_t len = 0;
+  uint16_t i = 0;
+
+  while (i < pixels)
+  {
+    uint16_t run = 1;
+    while (i + run < pixels && run < 128 &&
+           memcmp(row + i * pixelBytes, row + (i + run) * pixelBytes, pixelBytes) == 0)
+      run++;
+    if (run > 1)
+    {
+      if (len + 1 + pixelBytes > rowBytes)
+        return rowBytes;
+      out[len++] = 0x80 | (run - 1);
+      memcpy(out + len, row + i * pixelBytes, pixelBytes);
+      len += pixelBytes;
+      i += run;
+      continue;
+    }
+    // Collect literal pixels until the next run of at least two
+    uint16_t count = 1;
+    while (i + count < pixels && count < 128 &&
+           !(i + count + 1 < pixels &&
+             memcmp(row + (i + count) * pixelBytes, row + (i + count + 1) * pixelBytes, pixelBytes) == 0))
+      count++;
+    if (len + 1 + count * pixelBytes > rowBytes)
+      return rowBytes;
+    out[len++] = count - 1;
+    memcpy(out + len, row + i * pixelBytes, count * pixelBytes);
+    len += count * pixelBytes;
+    i += count;
+  }
+  return len;
+}
+
+/// As encodeRle(), returns rowBytes if the coded row wouldn't be any smaller
+uint16_t encodeLz(const uint8_t *prev, const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out)
+{
+  int16_t hashTable[LZ_HASH_SIZE]; // Last position each 3-byte sequence was seen
+  uint16_t len = 0;
+  uint16_t literalStart = 0;
+  uint16_t i = 0;
+
+  for (uint16_t h = 0; h < LZ_HASH_SIZE; h++)
+    hashTable[h] = INT16_MIN;
+
+  while (i < rowBytes)
+  {
+    uint16_t bestLength = 0;
+    uint16_t bestDistance = 0;
+    if (i + LZ_MIN_MATCH <= rowBytes)
+    {
+      uint8_t h = (row[i] * 31 + row[i + 1] * 7 + row[i + 2]) & (LZ_HASH_SIZE - 1);
+      // Candidates: the same pixel in the previous row, the previous pixel and the last hash match
+      int16_t candidates[3] = {(int16_t)(i - rowBytes), (int16_t)(i - pixelBytes), hashTable[h]};
+      hashTable[h] = i;
+      for (uint8_t c = 0; c < 3; c++)
+      {
+        int16_t from = candidates[c];
+        if (from < -(int16_t)rowBytes || from >= (int16_t)i)
+          continue;
+        uint16_t length = 0;
+        while (i + length < rowBytes && length < LZ_MAX_MATCH &&
+               windowByte(prev, row, from + length, rowBytes) == row[i + length])
+          length++;
+        if (length > bestLength)
+        {
+          bestLength = length;
+          bestDistance = i - from;
+        }
+      }
+    }
+    if (bestLength >= LZ_MIN_MATCH)
+    {
+      if (len + (literalStart < i ? 1 + i - literalStart : 0) + 3 > rowBytes)
+        return rowBytes;
+      if (literalStart < i)
+      { // Flush the literals waiting to go out
+        out[len++] = i - literalStart - 1;
+        memcpy(out + len, row + literalStart, i - literalStart);
+        len += i - literalStart;
+      }
+      out[len++] = 0x80 | (bestLength - LZ_MIN_MATCH);
+      out[len++] = bestDistance & 0xFF;
+      out[len++] = bestDistance >> 8;
+      i += bestLength;
+      literalStart = i;
+    }
+    else
+    {
+      i++;
+      if (i - literalStart == 128)
+      {
+        if (len + 1 + 128 > rowBytes)
+          return rowBytes;
+        out[len++] = 127;
+        memcpy(out + len, row + literalStart, 128);
+        len += 128;
+        literalStart = i;
+      }
+    }
+  }
+  if (literalStart < rowBytes)
+  {
+    if (len + 1 + rowBytes - literalStart > rowBytes)
+      return rowBytes;
+    out[len++] = rowBytes - literalStart - 1;
+    memcpy(out + len, row + literalStart, rowBytes - literalStart);
+    len += rowBytes - literalStart;
+  }
+  return len;
+}
+
+/// Code a row in whichever way is smallest. out must have room for rowBytes + 1 bytes
+/// and scratch for rowBytes (ROW_CODE_MAX is enough for any row). Returns the number of
+/// bytes in out, including the tag.
+uint16_t encodeRow(const uint8_t *prev, const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out, uint8_t *scratch)
+{
+  uint16_t rleLength = encodeRle(row, rowBytes, pixelBytes, out + 1);
+  uint16_t lzLength = encodeLz(prev, row, rowBytes, pixelBytes, scratch);
+
+  if (rleLength <= lzLength && rleLength < rowBytes) // RLE is quicker to decode, so it wins a tie
+  {
+    out[0] = ROW_RLE;
+    return rleLength + 1;
+  }
+  if (lzLength < rowBytes)
+  {
+    out[0] = ROW_LZ;
+    memcpy(out + 1, scratch, lzLength);
+    return lzLength + 1;
+  }
+  out[0] = ROW_RAW;
+  memcpy(out + 1, row, rowBytes);
+  return rowBytes + 1;
+}
+
+/// Decode the next coded row into row, taking its bytes from read(buf, len). prev must
+/// hold the previous decoded row (all zeros for the first row).
+template <typename Reader>
+bool decodeRowFrom(Reader read, const uint8_t *prev, uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes)
+{
+  uint8_t tag, n;
+  uint16_t i = 0;
+
+  if (!read(&tag, 1))
+    return false;
+  switch (tag)
+  {
+  case ROW_RAW:
+    return read(row, rowBytes);
+  case ROW_RLE:
+    while (i < rowBytes)
+    {
+      if (!read(&n, 1))
+        return false;
+      uint16_t count = ((n & 0x7F) + 1) * pixelBytes;
+      if (i + count > rowBytes)
+        return false; // Corrupt row
+      if (n & 0x80)
+      {
+        if (!read(row + i, pixelBytes))
+          return false;
+        for (uint16_t j = pixelBytes; j < count; j++)
+          row[i + j] = row[i + j - pixelBytes];
+      }
+      else if (!read(row + i, count))
+        return false;
+      i += count;
+    }
+    return true;
+  case ROW_LZ:
+    while (i < rowBytes)
+    {
+      if (!read(&n, 1))
+        return false;
+      if (n & 0x80)
+      {
+        uint8_t distance[2];
+        if (!read(distance, 2))
+          return false;
+        uint16_t count = (n & 0x7F) + LZ_MIN_MATCH;
+        int16_t from = i - (distance[0] | (distance[1] << 8));
+        if (from < -(int16_t)rowBytes || i + count > rowBytes)
+          return false; // Corrupt row
+        for (uint16_t j = 0; j < count; j++, i++, from++) // Byte by byte as the copy can overlap
+          row[i] = windowByte(prev, row, from, rowBytes);
+      }
+      else
+      {
+        uint16_t count = n + 1;
+        if (i + count > rowBytes || !read(row + i, count))
+          return false;
+        i += count;
+      }
+    }
+    return true;
+  }
+  return false; // Unknown row type
+}
+
+/// Read the next coded row from the read-ahead buffer and decode it into row
+bool decodeRow(const uint8_t *prev, uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes)
+{
+  return decodeRowFrom(readRowStream, prev, row, rowBytes, pixelBytes);
+}
+
+/// Read the next coded row straight from a file - for the previews, which mustn't
+/// disturb the read-ahead buffer of a bitmap that is playing
+bool decodeRow(File &file, const uint8_t *prev, uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes)
+{
+  return decodeRowFrom([&file](uint8_t *buf, uint16_t len) { return file.read(buf, len) == len; }, prev, row, rowBytes,
+                       pixelBytes);
+}
@@ -20,6 +20,15 @@ const char NAME_KEY[] = "name";
 const char PARMS_KEY[] = "parms";
 const char VALUES_KEY[] = "values";
 const char ROWTIME_KEY[] = "rowtime";
+const char LATEPOLICY_KEY[] = "latepolicy";
+const char KEEPALIVE_KEY[] = "keepalive";
+const char SUBROWS_KEY[] = "subrows";
+const char SCANCOLUMNS_KEY[] = "scancolumns";
+const char VIEWPORT_KEY[] = "viewport";
+const char TILEUPLOADS_KEY[] = "tileuploads";
+const char TEXT_KEY[] = "text";
+const char TEXTSCALE_KEY[] = "textscale";
+const char TEXTCOLOUR_KEY[] = "textcolour";
 const char BMPFILE_KEY[] = "bmpfile";
 const char APSSID_KEY[] = "apssid";
 const char APPW_KEY[] = "appw";
@@ -33,7 +42,16 @@ const char APPW_KEY[] = "appw";
 #define DEFAULT_INTERLEAVE false
 #define DEFAULT_PRESETIDX 0
 #define DEFAULT_PALETTEIDX 0
-#define DEFAULT_ROWTIME 20
+#define DEFAULT_ROWTIME 20 // Milliseconds
+#define DEFAULT_LATEPOLICY SCHEDULE_CATCHUP
+#define DEFAULT_KEEPALIVE 1000 // Milliseconds
+#define DEFAULT_SUBROWS 1
+#define DEFAULT_SCANCOLUMNS false
+#define DEFAULT_VIEWPORT 0
+#define DEFAULT_TILEUPLOADS false
+#define DEFAULT_TEXT "Hello"
+#define DEFAULT_TEXTSCALE 4
+#define DEFAULT_TEXTCOLOUR 0xFFFFFF
 #define DEFAULT_BMPFILE "/bmp/sjrps.bmp"
 #define DEFAULT_APSSID "SJR-PixelStick"
 #define DEFAULT_APPW "l3tm31nn0w" // WARNING: PW *must* be at least 8 characters otherwise setup fails
@@ -55,7 +73,7 @@ extern const String paletteNames[];
 extern const uint8_t paletteNum;
 extern PresetInfo presetList[]; // Preset info is held in this array
 extern const uint8_t presetNum; // Number of presets in the list
-extern RGBColour colours[5];
+extern RGBColour colours[MAX_COLOURS];
 extern FixPreset fixpresets[MAX_FIXPRESETS];
 
 ///
@@ -90,6 +108,8 @@ void loadColours(JsonDocument &doc)
         JsonArray userColours = doc[COLOURS_KEY].as<JsonArray>();
         for (JsonArray userColour : userColours)
         {
+            if (i == MAX_COLOURS)
+                break;
             colours[i][0] = userColour[0];
             colours[i][1] = userColour[1];
             colours[i][2] = userColour[2];
@@ -160,7 +180,16 @@ void loadConfig()
     config.interleave = doc[INTERLEAVE_KEY] | DEFAULT_INTERLEAVE;
     loadColours(doc);
     config.presetIndex = doc[PRESETIDX_KEY] | DEFAULT_PRESETIDX;
-    config.rowDisplayTime = doc[ROWTIME_KEY] | DEFAULT_ROWTIME;
+    config.rowDisplayMicros = (doc[ROWTIME_KEY] | (float)DEFAULT_ROWTIME) * 1000; // Stored in milliseconds, but not always whole ones
+    config.latePolicy = doc[LATEPOLICY_KEY] | DEFAULT_LATEPOLICY;
+    config.keepaliveMillis = doc[KEEPALIVE_KEY] | DEFAULT_KEEPALIVE;
+    config.subRows = constrain(doc[SUBROWS_KEY] | DEFAULT_SUBROWS, 1, MAX_SUBROWS);
+    config.scanColumns = doc[SCANCOLUMNS_KEY] | DEFAULT_SCANCOLUMNS;
+    config.viewport = doc[VIEWPORT_KEY] | DEFAULT_VIEWPORT;
+    config.tileUploads = doc[TILEUPLOADS_KEY] | DEFAULT_TILEUPLOADS;
+    strlcpy(config.text, doc[TEXT_KEY] | DEFAULT_TEXT, sizeof(config.text));
+    config.textScale = constrain(doc[TEXTSCALE_KEY] | DEFAULT_TEXTSCALE, 1, MAX_TEXT_SCALE);
+    config.textColour = doc[TEXTCOLOUR_KEY] | DEFAULT_TEXTCOLOUR;
     strlcpy(config.bmpFile, doc[BMPFILE_KEY] | DEFAULT_BMPFILE, sizeof(config.bmpFile));
     strlcpy(config.apssid, doc[APSSID_KEY] | DEFAULT_APSSID, sizeof(config.apssid));
     strlcpy(config.appw, doc[APPW_KEY] | DEFAULT_APPW, sizeof(config.appw));
@@ -309,7 +338,16 @@ void config2Json(JsonDocument &doc)
     doc[PRESETIDX_KEY] = config.presetIndex;
     getPresets(doc);
     getPalettes(doc);
-    doc[ROWTIME_KEY] = config.rowDisplayTime;
+    doc[ROWTIME_KEY] = config.rowDisplayMicros / 1000.0;
+    doc[LATEPOLICY_KEY] = config.latePolicy;
+    doc[KEEPALIVE_KEY] = config.keepaliveMillis;
+    doc[SUBROWS_KEY] = config.subRows;
+    doc[SCANCOLUMNS_KEY] = config.scanColumns;
+    doc[VIEWPORT_KEY] = config.viewport;
+    doc[TILEUPLOADS_KEY] = config.tileUploads;
+    doc[TEXT_KEY] = config.text;
+    doc[TEXTSCALE_KEY] = config.textScale;
+    doc[TEXTCOLOUR_KEY] = config.textColour;
     doc[BMPFILE_KEY] = config.bmpFile;
     doc[APSSID_KEY] = config.apssid;
     doc[APPW_KEY] = config.appw;
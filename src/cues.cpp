@@ -0,0 +1,289 @@
+#include "pixelstick.h"
+
+// Cue list
+//
+// A list of bitmaps, motion presets and fixed colour presets shown one after the other,
+// each for a set time (or once through, for a bitmap without a time). It is kept in
+// /cues.json and run from serviceLeds(). While one cue is showing, the details, palette
+// and start of the image data of the next bitmap are fetched in the idle time between
+// frames, so moving on is just a matter of switching to data that is already in RAM.
+// Cues change on a frame boundary with no blank frames in between, and timed cues end
+// at absolute times so the list doesn't drift. The mode and colours the user had are
+// put back when the list stops, and are what gets saved if the settings are saved while
+// it is running.
+//
+// The file looks like:
+//   {"loop":true,"cues":[{"mode":2,"bmpfile":"/bmp/logo.bmp","time":0},
+//                        {"mode":1,"index":3,"time":5000},
+//                        {"mode":0,"index":1,"time":2000}]}
+
+const char CUES_FILENAME[] PROGMEM = "/cues.json";
+
+#define CUES_JSON_SIZE 2048
+#define CUE_TIME_MAX 1800000 // Half an hour (ms), so the end of a cue can be timed with micros()
+
+// Keys for the cue list JSON values
+const char CUELOOP_KEY[] = "loop";
+const char CUES_KEY[] = "cues";
+const char CUEMODE_KEY[] = "mode";
+const char CUEINDEX_KEY[] = "index";
+const char CUETIME_KEY[] = "time";
+const char CUEFILE_KEY[] = "bmpfile";
+
+// How far the next cue has been fetched
+#define PREFETCH_NONE 0
+#define PREFETCH_INFO 1 // File details and palette
+#define PREFETCH_DONE 2 // The start of the image data as well, or there's nothing to fetch
+
+void readBmpInfo(const char *path, FileInfo &info);
+bool findBmpIndex(const char *path, FileInfo &info);
+void loadPalette(FileInfo &info, CRGB *palette);
+void getBmpInfo(char *path);
+void preloadRowStream(const char *path, uint32_t start, uint32_t length);
+uint32_t imageDataLength(const FileInfo &info);
+bool openBitmap(bool carryOn);
+void endBitmap();
+void closeFile();
+void setFixPreset(int index);
+void writeConfig();
+
+extern FileInfo currentFile;
+extern CRGB bmpPalette[];
+extern RGBColour colours[];
+extern bool requestDrawBmp;
+extern bool looping;
+extern const uint8_t presetNum;
+
+Cue cues[MAX_CUES];
+uint8_t cueCount;
+bool cueLoop;              // Go back to the first cue after the last one
+bool running;              // The list is being shown
+int8_t cueIndex;           // Cue being shown, -1 before the first one starts
+uint32_t cueEnd;           // When the current cue finishes, if it has a time (micros)
+uint8_t prefetchStage;     // How much of the next cue is ready
+FileInfo nextFile;         // Details of the next bitmap
+CRGB *nextPalette;         // Lookup table for the next bitmap, allocated while the list is running
+Config savedConfig;        // What the user was showing before the list started
+RGBColour savedColours[MAX_COLOURS];
+
+/// Fill the cue list from the JSON. Returns false if it isn't a valid list.
+bool parseCues(JsonDocument &doc)
+{
+  JsonArray list = doc[CUES_KEY];
+
+  if (list.isNull())
+    return false;
+  cueLoop = doc[CUELOOP_KEY] | true;
+  cueCount = 0;
+  for (JsonObject item : list)
+  {
+    if (cueCount == MAX_CUES)
+      break;
+    Cue &cue = cues[cueCount];
+    cue.mode = item[CUEMODE_KEY] | MODE_FIXED;
+    cue.index = item[CUEINDEX_KEY] | 0;
+    cue.time = item[CUETIME_KEY] | 0;
+    if (cue.time > CUE_TIME_MAX)
+      cue.time = CUE_TIME_MAX;
+    strlcpy(cue.bmpFile, item[CUEFILE_KEY] | "", sizeof(Cue::bmpFile));
+    if (cue.mode > MODE_BITMAP || (cue.mode == MODE_FIXED && cue.index >= MAX_FIXPRESETS) ||
+        (cue.mode == MODE_PRESET && cue.index >= presetNum) || (cue.mode == MODE_BITMAP && !cue.bmpFile[0]))
+    {
+      Serial.printf("Skipping bad cue %u\n", cueCount);
+      continue;
+    }
+    cueCount++;
+  }
+  return true;
+}
+
+/// Load the cue list, if there is one
+void initCues()
+{
+  DynamicJsonDocument doc(CUES_JSON_SIZE);
+  File file = LittleFS.open(FPSTR(CUES_FILENAME), "r");
+
+  if (!file)
+    return;
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  if (error || !parseCues(doc))
+  {
+    Serial.print(F("Failed to read cue list: "));
+    Serial.println(error.c_str());
+  }
+}
+
+/// Replace the cue list with the one in json, and save it
+bool setCues(const char *json)
+{
+  DynamicJsonDocument doc(CUES_JSON_SIZE);
+  File file;
+
+  if (running || deserializeJson(doc, json) || !parseCues(doc))
+    return false;
+  if (!(file = LittleFS.open(FPSTR(CUES_FILENAME), "w")))
+  {
+    Serial.print(F("Failed to open cue list for write: "));
+    Serial.println(FPSTR(CUES_FILENAME));
+    return false;
+  }
+  serializeJson(doc, file);
+  file.close();
+  return true;
+}
+
+bool cuesRunning()
+{
+  return running;
+}
+
+/// The cue after the current one, or -1 if the list has finished
+int8_t nextCueIndex()
+{
+  if (cueIndex + 1 < cueCount)
+    return cueIndex + 1;
+  return cueLoop && cueCount ? 0 : -1;
+}
+
+/// Start running the cue list from the first cue, on the next frame
+bool startCues()
+{
+  if (!cueCount || (!nextPalette && !(nextPalette = (CRGB *)malloc(256 * sizeof(CRGB)))))
+    return false;
+  if (!running)
+  {
+    savedConfig = getConfig();
+    memcpy(savedColours, colours, sizeof(savedColours));
+  }
+  closeFile();
+  requestDrawBmp = false;
+  running = true;
+  cueIndex = -1;
+  prefetchStage = PREFETCH_NONE;
+  return true;
+}
+
+/// Put back the settings the cues take over, as they were before the list started
+void restoreUserSettings()
+{
+  getConfig().mode = savedConfig.mode;
+  getConfig().presetIndex = savedConfig.presetIndex;
+  getConfig().coloursUsed = savedConfig.coloursUsed;
+  getConfig().gradient = savedConfig.gradient;
+  getConfig().interleave = savedConfig.interleave;
+  memcpy(colours, savedColours, sizeof(savedColours));
+}
+
+/// Save the settings. While the list is running, the ones the cues have taken over are
+/// saved as the user had them before it started, not as the current cue left them.
+void saveSettings()
+{
+  if (!running)
+  {
+    writeConfig();
+    return;
+  }
+  Config now = getConfig();
+  RGBColour nowColours[MAX_COLOURS];
+  memcpy(nowColours, colours, sizeof(nowColours));
+  restoreUserSettings();
+  writeConfig();
+  getConfig() = now; // Carry on with the cue
+  memcpy(colours, nowColours, sizeof(nowColours));
+}
+
+/// Stop the cue list and go back to whatever the user was showing before it started
+void stopCues()
+{
+  if (!running)
+    return;
+  running = false;
+  requestDrawBmp = false;
+  looping = false;
+  closeFile();
+  restoreUserSettings();
+  getBmpInfo(getConfig().bmpFile); // Put the selected bitmap back
+  free(nextPalette);
+  nextPalette = NULL;
+}
+
+/// Get the next cue ready - called in the idle time between frames. One step per call so
+/// the next frame isn't held up for long.
+void prefetchCue()
+{
+  if (!running || prefetchStage == PREFETCH_DONE)
+    return;
+  int8_t next = nextCueIndex();
+  if (next < 0 || cues[next].mode != MODE_BITMAP)
+  {
+    prefetchStage = PREFETCH_DONE; // Nothing to fetch
+    return;
+  }
+  if (prefetchStage == PREFETCH_NONE)
+  {
+    if (!findBmpIndex(cues[next].bmpFile, nextFile))
+      readBmpInfo(cues[next].bmpFile, nextFile);
+    if (nextFile.status == VALID)
+      loadPalette(nextFile, nextPalette);
+    prefetchStage = PREFETCH_INFO;
+  }
+  else
+  {
+    if (nextFile.status == VALID && nextFile.compMethod != CODEC_TILES) // Tiles are read as they're needed
+      preloadRowStream(nextFile.path, nextFile.bmpImageoffset, imageDataLength(nextFile));
+    prefetchStage = PREFETCH_DONE;
+  }
+}
+
+/// Switch to cue i, ready for its first frame to be drawn
+void startCue(int8_t i)
+{
+  Cue &cue = cues[i];
+  bool timed = cueIndex >= 0 && cues[cueIndex].time;
+
+  cueEnd = (timed ? cueEnd : micros()) + cue.time * 1000; // Carry on from when the last one should have ended
+  cueIndex = i;
+  prefetchStage = PREFETCH_NONE;
+  getConfig().mode = cue.mode;
+  switch (cue.mode)
+  {
+  case MODE_FIXED:
+    setFixPreset(cue.index);
+    break;
+  case MODE_PRESET:
+    getConfig().presetIndex = cue.index;
+    break;
+  case MODE_BITMAP:
+    currentFile = nextFile;
+    memcpy(bmpPalette, nextPalette, 256 * sizeof(CRGB));
+    looping = cue.time != 0; // A timed bitmap is repeated until the time is up
+    requestDrawBmp = openBitmap(true);
+    break;
+  }
+}
+
+/// Called when a frame is due - if the current cue has finished, the next one starts
+/// with this frame
+void advanceCues()
+{
+  if (!running)
+    return;
+  if (cueIndex >= 0)
+  {
+    Cue &cue = cues[cueIndex];
+    if (cue.time ? (int32_t)(micros() - cueEnd) < 0 : (cue.mode != MODE_BITMAP || requestDrawBmp))
+      return; // Still going
+  }
+  int8_t next = nextCueIndex();
+  if (next < 0)
+  {
+    stopCues(); // That was the last one
+    return;
+  }
+  while (prefetchStage != PREFETCH_DONE) // Only if the last cue was too short to get it ready in time
+    prefetchCue();
+  endBitmap(); // The last row stays on the LEDs until the first frame of the next cue replaces it
+  requestDrawBmp = false;
+  startCue(next);
+}
@@ -1,6 +1,17 @@
 #include "pixelstick.h"
 
 FileInfo currentFile;
+CRGB bmpPalette[256]; // Palette for the current bitmap, gamma corrected
+uint8_t gamma5[32];   // Gamma correction for 5-bit colour values
+uint8_t gamma6[64];   // Gamma correction for 6-bit colour values
+
+extern const uint8_t gamma8[];
+
+RowStreamStats &getRowStreamStats();
+FrameStats &getFrameStats();
+bool findBmpIndex(const char *path, FileInfo &info);
+uint16_t readIndexPage(uint16_t start, void (*fn)(const FileInfo &info, String &s), String &s);
+uint16_t getBmpIndexCount();
 
 uint16_t read16(File &f) // Read a 2-byte int from the file (little-endian)
 {
@@ -16,73 +27,234 @@ uint32_t read32(File &f) // Read a 4-byte int from the file (little-endian)
   return result;
 }
 
-String getBMPList()
+/// Size of a row of pixels in the given format, without padding
+uint16_t pixelRowBytes(uint8_t pixelFormat, uint16_t width)
+{
+  switch (pixelFormat)
+  {
+  case PIXEL_RGB565:
+  case PIXEL_RGB555:
+    return width * 2;
+  case PIXEL_INDEXED8:
+    return width;
+  case PIXEL_INDEXED4:
+    return (width + 1) / 2;
+  default:
+    return width * 3;
+  }
+}
+
+/// Size of the unit the RLE codec works in for the given format - a whole pixel, or a byte for 4-bit images
+uint8_t pixelCodeBytes(uint8_t pixelFormat)
+{
+  return pixelFormat == PIXEL_INDEXED4 ? 1 : pixelRowBytes(pixelFormat, 1);
+}
+
+void addBmpName(const FileInfo &info, String &s)
+{
+  if (s.length() > 0)
+    s += ":";
+  s += info.path + 5; // Skip the "/bmp/"
+}
+
+/// Returns a page of the list of bitmap files, starting at the given place in the index.
+/// If there are more, the last item is ">" and where the next page starts.
+String getBMPList(uint16_t start)
 {
-  Dir dir = LittleFS.openDir("/bmp"); // Get object to iterate over all files in /bmp
   String s = "";
+  uint16_t next = readIndexPage(start, addBmpName, s);
 
-  while (dir.next())
+  if (next)
   {
-    if (!dir.fileName().endsWith(".bmp"))
-      continue;
-    if (s.length() > 0)
-      s += ":";
-    s += dir.fileName(); 
+    s += ":>";
+    s += next;
   }
   return s;
 }
 
-void getBmpInfo(char *path)
+void readBmpInfo(const char *path, FileInfo &info)
 {
   File bmpFile; // The file we want info for
+  uint16_t signature;
 
-  strlcpy(currentFile.path, path, sizeof(currentFile.path));
-  currentFile.status = VALID; // Assume the file is good
+  strlcpy(info.path, path, sizeof(info.path));
+  info.status = VALID; // Assume the file is good
+  info.fileType = FILE_BMP;
+  info.powerStep = 0;
 
   if (!(bmpFile = LittleFS.open(path, "r"))) // Open the file
   {
     Serial.print(F("Error opening file: "));
     Serial.println(path);
-    currentFile.status = OPEN_ERROR;
+    info.status = OPEN_ERROR;
     return;
   }
 
+  signature = read16(bmpFile);
+  if (signature == NATIVE_SIGNATURE) // Already converted, so the header has everything we need
+  {
+    NativeHeader header;
+    if (!bmpFile.seek(0, SeekSet) || bmpFile.read((uint8_t *)&header, sizeof(header)) != sizeof(header))
+    {
+      Serial.print(F("Bitmap header is cut short: "));
+      Serial.println(path);
+      bmpFile.close();
+      info.status = BAD_SIZE;
+      return;
+    }
+    info.fileType = FILE_NATIVE;
+    info.fileSize = bmpFile.size();
+    info.bmpImageoffset = header.dataOffset;
+    info.bmpWidth = header.width;
+    info.bmpHeight = header.height;
+    info.planeCount = 1;
+    info.pixelFormat = header.pixelFormat;
+    info.rowBytes = pixelRowBytes(header.pixelFormat, header.width);
+    info.paletteOffset = sizeof(header);
+    info.paletteColours = 0;
+    switch (header.pixelFormat)
+    {
+    case PIXEL_RGB888:
+      info.bitDepth = 24;
+      break;
+    case PIXEL_RGB565:
+      info.bitDepth = 16;
+      break;
+    case PIXEL_INDEXED8:
+      info.bitDepth = 8;
+      info.paletteColours = 256;
+      break;
+    case PIXEL_INDEXED4:
+      info.bitDepth = 4;
+      info.paletteColours = 16;
+      break;
+    default:
+      info.bitDepth = 0;
+      info.status |= BAD_BITDEPTH;
+    }
+    if (header.version < 2)
+      header.codec = CODEC_NONE; // Version 1 files have no codec field and are never compressed
+    info.compMethod = header.codec;
+    if (header.version >= 3)
+      info.powerStep = header.powerStep;
+    bmpFile.close();
+    if (header.version > NATIVE_VERSION)
+      info.status |= BAD_BITDEPTH;
+    if (header.codec > CODEC_TILES)
+      info.status |= BAD_COMPRESSION;
+  }
   // Parse BMP header to get the information we need
-  if (read16(bmpFile) == 0x4D42) // BMP file signature ("BM") check
+  else if (signature == 0x4D42) // BMP file signature ("BM") check
   {
-    currentFile.fileSize = read32(bmpFile);       // Size of file
-    read32(bmpFile);                              // Discard the four reserved bytes
-    currentFile.bmpImageoffset = read32(bmpFile); // Start of image data
+    info.fileSize = read32(bmpFile);       // Size of file
+    read32(bmpFile);                       // Discard the four reserved bytes
+    info.bmpImageoffset = read32(bmpFile); // Start of image data
     // In very old Windows BMP files, the DiB header size is 12 bytes and the width and height values
     // are 16-bit signed integers (OS/2 BMP unsigned). Most Windows BMP files have a 40-byte DIB header
     // and 32-bit signed integers for width and height - we are assuming this at the moment.
-    if (int i = read32(bmpFile) != 40)
+    uint32_t dibSize = read32(bmpFile);
+    if (dibSize != 40)
     { // DIB Header size
       Serial.print(F("Unexpected BMP header size: "));
-      Serial.println(i);
+      Serial.println(dibSize);
     }
-    currentFile.bmpWidth = read32(bmpFile);  // Image width (implicit cast to u_int16t)
-    currentFile.bmpHeight = read32(bmpFile); // Image height (implicit cast to u_int16t)
+    info.bmpWidth = read32(bmpFile);  // Image width (implicit cast to u_int16t)
+    info.bmpHeight = read32(bmpFile); // Image height (implicit cast to u_int16t)
 
-    currentFile.planeCount = read16(bmpFile); // No. of planes in the image
-    currentFile.bitDepth = read16(bmpFile);   // Bit depth of the image
-    currentFile.compMethod = read32(bmpFile); // Compression method
+    info.planeCount = read16(bmpFile); // No. of planes in the image
+    info.bitDepth = read16(bmpFile);   // Bit depth of the image
+    info.compMethod = read32(bmpFile); // Compression method
+    bmpFile.seek(46, SeekSet);
+    uint32_t coloursUsed = read32(bmpFile); // Size of the palette, 0 for all the colours
+    info.paletteOffset = 14 + dibSize;      // The palette follows the DIB header
+    info.paletteColours = 0;
+    uint32_t redMask = 0x7C00;
+    if (info.bitDepth == 16 && info.compMethod == 3) // BI_BITFIELDS - the masks follow the 40-byte header
+    {
+      bmpFile.seek(54, SeekSet);
+      redMask = read32(bmpFile);
+      if (redMask != 0xF800 || read32(bmpFile) != 0x07E0 || read32(bmpFile) != 0x001F)
+        info.status |= BAD_COMPRESSION; // Only 565 is played without converting
+    }
+    else if (info.compMethod != 0)
+      info.status |= BAD_COMPRESSION;
     bmpFile.close();
-    if (currentFile.planeCount != 1)
-      currentFile.status |= BAD_PLANES;
-    if (currentFile.bitDepth != 24)
-      currentFile.status |= BAD_BITDEPTH;
-    if (currentFile.compMethod != 0)
-      currentFile.status |= BAD_COMPRESSION;
+    if (info.planeCount != 1)
+      info.status |= BAD_PLANES;
+    info.pixelFormat = PIXEL_BGR888;
+    switch (info.bitDepth)
+    {
+    case 4:
+    case 8:
+      info.pixelFormat = info.bitDepth == 8 ? PIXEL_INDEXED8 : PIXEL_INDEXED4;
+      info.paletteColours = coloursUsed && coloursUsed < (1U << info.bitDepth) ? coloursUsed : 1 << info.bitDepth;
+      break;
+    case 16:
+      info.pixelFormat = redMask == 0xF800 ? PIXEL_RGB565 : PIXEL_RGB555;
+      break;
+    case 24:
+      break;
+    default:
+      info.status |= BAD_BITDEPTH;
+    }
+    info.rowBytes = pixelRowBytes(info.pixelFormat, info.bmpWidth);
   }
   else
   {
-    currentFile.status = BAD_SIGNATURE;
+    bmpFile.close();
+    info.status = BAD_SIGNATURE;
     Serial.print(F("Invalid signature: "));
     Serial.println(path);
   }
 }
 
+/// Build the gamma corrected lookup tables for playing a bitmap, so the pixels only
+/// need a table lookup as each row is drawn
+void loadPalette(FileInfo &info, CRGB *palette)
+{
+  File bmpFile;
+  uint8_t entry[4];
+  uint8_t entrySize = info.fileType == FILE_NATIVE ? 3 : 4; // Native palettes are RGB, BMP ones are BGRX
+
+  if (info.pixelFormat == PIXEL_RGB565 || info.pixelFormat == PIXEL_RGB555)
+  {
+    for (uint8_t i = 0; i < 32; i++)
+      gamma5[i] = gamma8[i * 255 / 31];
+    for (uint8_t i = 0; i < 64; i++)
+      gamma6[i] = gamma8[i * 255 / 63];
+  }
+  if (!info.paletteColours)
+    return;
+  if (!(bmpFile = LittleFS.open(info.path, "r")))
+  {
+    info.status |= OPEN_ERROR;
+    return;
+  }
+  fill_solid(palette, 256, CRGB::Black);
+  bmpFile.seek(info.paletteOffset, SeekSet);
+  for (uint16_t i = 0; i < info.paletteColours; i++)
+  {
+    if (bmpFile.read(entry, entrySize) != entrySize)
+    {
+      info.status |= BAD_SIGNATURE; // The palette is missing
+      break;
+    }
+    if (entrySize == 3)
+      palette[i].setRGB(gamma8[entry[0]], gamma8[entry[1]], gamma8[entry[2]]);
+    else
+      palette[i].setRGB(gamma8[entry[2]], gamma8[entry[1]], gamma8[entry[0]]);
+  }
+  bmpFile.close();
+}
+
+void getBmpInfo(char *path)
+{
+  if (!findBmpIndex(path, currentFile)) // Files that aren't in the index still get read
+    readBmpInfo(path, currentFile);
+  if (currentFile.status == VALID)
+    loadPalette(currentFile, bmpPalette);
+}
+
 // Returns BMP file info as a single string
 String getBMPInfoString(char *filename)
 {
@@ -102,11 +274,21 @@ String getBMPInfoString(char *filename)
   return s;
 }
 
-String getSystemInfo()
+void addBmpRow(const FileInfo &info, String &s)
+{
+  s += F("<tr>");
+  s += F("<td>");
+  s += info.path + 5; // Skip the "/bmp/"
+  s += F("</td><td style=\"text-align:right\">");
+  s += info.fileSize;
+  s += F("</td></tr>");
+}
+
+/// Returns the file system info, with one page of the list of bitmaps starting at the given place in the index
+String getSystemInfo(uint16_t start)
 {
   FSInfo fsinfo;
   String s = "";
-  int filecount = 0;
 
   LittleFS.info(fsinfo);
   s += F("File system total capacity: ");
@@ -120,18 +302,45 @@ String getSystemInfo()
   s += F("% free)<br><br>");
   s += F("<table style=\"width:100%\">");
   s += F("<tr><th style=\"width:70%;text-align:left\">Bitmap files</th><th style=\"width:30%;text-align:right\">File size</th></tr>");
-  Dir dir = LittleFS.openDir("/bmp");
-  while (dir.next())
+  uint16_t next = readIndexPage(start, addBmpRow, s);
+  s += F("</table>");
+  if (start) // Links to the other pages
+    s += F("<a href=\"#\" onclick=\"sendCmd('S');return false\">First page</a> ");
+  if (next)
   {
-    s += F("<tr>");
-    s += F("<td>");
-    s += dir.fileName();
-    s += F("</td><td style=\"text-align:right\">");
-    s += dir.fileSize();
-    s += F("</td></tr>");
-    filecount++;
+    s += F("<a href=\"#\" onclick=\"sendCmd('S");
+    s += next;
+    s += F("');return false\">Next page</a>");
   }
-  s += F("</table><p>Total files: ");
-  s += filecount;
+  s += F("<p>Total files: ");
+  s += getBmpIndexCount();
+  RowStreamStats &stats = getRowStreamStats(); // Read-ahead performance for the last bitmap played
+  s += F("<p>Last bitmap: ");
+  s += stats.refills;
+  s += F(" reads, ");
+  s += stats.underruns;
+  s += F(" underruns, ");
+  s += stats.refills ? stats.refillMicros / stats.refills : 0;
+  s += F("us average read, ");
+  s += stats.maxRefillMicros;
+  s += F("us longest read, ");
+  s += stats.rowMicros ? (uint32_t)((uint64_t)stats.rows * 1000000 / stats.rowMicros) : 0;
+  s += F(" rows/s decode rate, ");
+  s += stats.cachedBytes;
+  s += F(" bytes from the RAM cache");
+  FrameStats &frames = getFrameStats(); // Timing accuracy since the display was last started
+  s += F("<p>Frame timing: ");
+  s += frames.frames;
+  s += F(" frames, ");
+  s += frames.late;
+  s += F(" late, ");
+  s += frames.dropped;
+  s += F(" dropped, ");
+  s += frames.frames ? frames.jitterTotal / frames.frames : 0;
+  s += F("us average jitter, ");
+  s += frames.maxJitter;
+  s += F("us worst jitter, ");
+  s += getConfig().rowDisplayMicros;
+  s += F("us row time");
   return s;
 }
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "pixelstick.h"
+
+// Fixed colours
+//
+// Draws the fixed colour modes - bands, gradients or interleaved LEDs - for any number
+// of colours. The picture only changes when the user (or a cue) changes the colours or
+// how they're shown, so it is drawn once into a frame that is kept, along with the
+// settings it was drawn from and the power it draws. Each frame is then just a copy of
+// it, and the frame is drawn again the first time the settings are found to differ.
+
+extern RGBColour colours[];
+
+uint32_t pixelLoad(const CRGB &c);
+
+struct FixedSettings
+{
+  unsigned char coloursUsed;
+  bool gradient;
+  bool interleave;
+  RGBColour colours[MAX_COLOURS];
+};
+
+FixedSettings fixedSettings;    // Settings the frame was drawn from
+CRGB fixedFrame[NUM_LEDS];      // The frame, ready to copy to the LEDs
+uint32_t fixedFrameLoad;        // Power it draws
+bool fixedFrameValid;           // There is a frame
+
+/// Split the strip into equal bands, one per colour. Where the LEDs don't divide
+/// exactly the bands differ by one LED, the longer ones spread along the strip.
+void fillBands(CRGB *dst, const CRGB *cols, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint16_t start = i * NUM_LEDS / count;
+    uint16_t end = (i + 1) * NUM_LEDS / count;
+    fill_solid(dst + start, end - start, cols[i]);
+  }
+}
+
+/// Fade from each colour to the next, with the colours spaced evenly along the strip
+/// and the first and last at the ends, as FastLED's 2, 3 and 4 colour gradients do
+void fillGradient(CRGB *dst, const CRGB *cols, uint8_t count)
+{
+  if (count < 2)
+  {
+    fill_solid(dst, NUM_LEDS, cols[0]);
+    return;
+  }
+  for (uint8_t i = 0; i < count - 1; i++)
+  {
+    uint16_t start = i * NUM_LEDS / (count - 1);
+    uint16_t end = i == count - 2 ? NUM_LEDS - 1 : (i + 1) * NUM_LEDS / (count - 1);
+    fill_gradient_RGB(dst, start, cols[i], end, cols[i + 1]);
+  }
+}
+
+/// Use each colour in turn along the strip
+void fillInterleave(CRGB *dst, const CRGB *cols, uint8_t count)
+{
+  for (uint16_t i = 0, c = 0; i < NUM_LEDS; i++)
+  {
+    dst[i] = cols[c];
+    if (++c == count)
+      c = 0;
+  }
+}
+
+/// Get the fixed colour frame, drawing it again if the settings have changed since it
+/// was drawn. load is set to the power it draws.
+const CRGB *getFixedFrame(uint32_t &load)
+{
+  FixedSettings current;
+
+  memset(&current, 0, sizeof(current)); // So the padding compares equal too
+  current.coloursUsed = getConfig().coloursUsed;
+  if (current.coloursUsed < 1)
+    current.coloursUsed = 1;
+  if (current.coloursUsed > MAX_COLOURS)
+    current.coloursUsed = MAX_COLOURS;
+  current.gradient = getConfig().gradient;
+  current.interleave = getConfig().interleave;
+  memcpy(current.colours, colours, current.coloursUsed * sizeof(RGBColour)); // The unused colours don't matter
+
+  if (!fixedFrameValid || memcmp(&current, &fixedSettings, sizeof(current)))
+  {
+    CRGB cols[MAX_COLOURS];
+    for (uint8_t i = 0; i < current.coloursUsed; i++)
+      cols[i] = CRGB(current.colours[i][0], current.colours[i][1], current.colours[i][2]);
+    if (current.interleave)
+      fillInterleave(fixedFrame, cols, current.coloursUsed);
+    else if (current.gradient)
+      fillGradient(fixedFrame, cols, current.coloursUsed);
+    else
+      fillBands(fixedFrame, cols, current.coloursUsed);
+    fixedFrameLoad = 0;
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+      fixedFrameLoad += pixelLoad(fixedFrame[i]);
+    fixedSettings = current;
+    fixedFrameValid = true;
+  }
+  load = fixedFrameLoad;
+  return fixedFrame;
+}
@@ -3,28 +3,78 @@
 #define DATA_PIN D1
 #define LED_TYPE WS2812B
 #define COLOUR_ORDER GRB
-#define MILLI_AMPS 4000 // Maximum current available to drive the LEDs (4000 allows 3A from the converter at max white)
 
-void writeConfig();
+void showLeds();
+void showFrame();
+void clearLeds();
 void doFixed();
 void doPreset();
+void endPreset();
+uint32_t renderPreset(PresetInfo &preset, PresetClock &clock, uint32_t now, const int *parms = NULL);
+const char *startBake(uint16_t seconds);
+bool serviceBake();
+int8_t bakeStale(const char *path);
 void doBitmap();
 String update(char *cmd);
 String getBMPInfoString(char *filename);
 Switch getSwitch();
 void writeFixPresets();
+bool openRowStream(const char *path, uint32_t start, uint32_t length);
+void closeRowStream();
+void serviceRowStream();
+void primeRowStream();
+bool readRowStream(uint8_t *buf, uint16_t len);
+RowStreamStats &getRowStreamStats();
+bool decodeRow(const uint8_t *prev, uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes);
+uint8_t pixelCodeBytes(uint8_t pixelFormat);
+void setupResample(uint16_t width);
+void startFrames();
+void removeFromBmpIndex(const char *path);
+void preloadRowStream(const char *path, uint32_t start, uint32_t length);
+void dropCacheEntries(const char *path);
+void rawStoreRemove(const char *path);
+bool frameDue();
+void resampleRow(const CRGB *src, CRGB *dst);
+bool cuesRunning();
+bool startCues();
+void stopCues();
+void saveSettings();
+bool setCues(const char *json);
+void prefetchCue();
+void advanceCues();
+bool openTiles(const FileInfo &info);
+void closeTiles();
+bool readTileLine(uint16_t line, CRGB *dst);
+void serviceTiles();
+uint16_t tileLines();
+uint16_t openText();
+bool readTextColumn(uint16_t column, CRGB *dst);
+void setFrameLoad(uint32_t load);
+uint32_t pixelLoad(const CRGB &c);
+uint8_t limitBrightness(uint8_t brightness, const CRGB *leds, uint16_t lit);
+void loadPowerProfile(const FileInfo &info);
+void clearPowerProfile();
+void setRowLoad(uint16_t row);
+void setRowLoad(uint16_t from, uint16_t to);
+const CRGB *getFixedFrame(uint32_t &load);
+const CRGB *getPaletteColours(uint8_t index);
 
 extern WiFiStatus wifistatus;
 extern PresetInfo presetList[]; // Preset info is held in this array
+extern const CRGBPalette16 palettes[];
 extern Credentials creds;
 extern WebSocketsServer ws;
 extern FileInfo currentFile;
 extern const uint8_t gamma8[];
+extern CRGB bmpPalette[];
+extern uint8_t gamma5[];
+extern uint8_t gamma6[];
 extern bool browserInit;
+extern CLEDController *ledController;
 
 bool saveCreds(char *newCreds);
 
-CRGB leds[NUM_LEDS];
+CRGB leds[NUM_LEDS] __attribute__((aligned(4))); // Aligned so it can be hashed a word at a time
 
 RGBColour colours[MAX_COLOURS]; // All colours default to [0, 0, 0] if no config data
 
@@ -38,36 +88,53 @@ bool requestDrawBmp = false;
 bool repeat = false;
 bool looping = false;
 bool fileopen = false;
-File file;
-uint8_t gHue = 0; // rotating "base color" used by many of the patterns
+uint16_t bmpRow;     // Next row of the bitmap to be drawn (or column, for a tiled bitmap played sideways)
+uint16_t bmpRows;    // Number of rows (or columns) to draw
+uint16_t bmpRowSize; // Size of each row in the file
+uint8_t bmpSubRow;   // Frames drawn so far blending towards the current row
+bool blending;       // There's a row to blend from
+int16_t activePreset = -1;  // Preset that has been started, -1 if there isn't one
+PresetClock liveClock = {0, 0, 0, 0, 0, true}; // Clock the presets are shown with
 
 void initLeds()
 {
     CRGB initColours[3] = {CRGB::Red, CRGB::Green, CRGB::Blue};
 
-    FastLED.addLeds<WS2812B, DATA_PIN, COLOUR_ORDER>(leds, NUM_LEDS).setCorrection(TypicalLEDStrip);
+    ledController = &FastLED.addLeds<WS2812B, DATA_PIN, COLOUR_ORDER>(leds, NUM_LEDS).setCorrection(TypicalLEDStrip);
     FastLED.setDither(DISABLE_DITHER);                     // TODO: Disable dither only for bitmaps??
     FastLED.setBrightness(DEFAULT_BRIGHTNESS);             // Set brightness to default for startup
-    FastLED.setMaxPowerInVoltsAndMilliamps(5, MILLI_AMPS); // Limit the power to the LEDs
-    FastLED.clear(true);                                   // Make sure the LEDs are all off to begin with
+    clearLeds();                                           // Make sure the LEDs are all off to begin with
     delay(1000);                                           // This function is the only place we use delay() as it is before the wifi is running
     for (int i = 0; i < 3; i++)                            // Flash the LEDs R/G/B to show we're awake
     {
         fill_solid(leds, NUM_LEDS, CRGB(initColours[i]));
-        FastLED.show();
+        showLeds();
         delay(250);
-        FastLED.clear(true);
+        clearLeds();
         delay(250);
     }
 }
 
+/// Stop reading the bitmap, leaving whatever is on the LEDs there
+void endBitmap()
+{
+    if (fileopen)
+    {
+        RowStreamStats &stats = getRowStreamStats();
+        Serial.printf("Bitmap read-ahead: %u reads, %u underruns, max read %uus\n",
+                      stats.refills, stats.underruns, stats.maxRefillMicros);
+        closeRowStream();
+        closeTiles();
+        fileopen = false;
+    }
+}
+
 void closeFile()
 {
     if (fileopen)
     { // Make sure the file is closed
-        file.close();
-        fileopen = false;
-        FastLED.clear(true); // We've closed the file so not looping - clear the LEDs
+        endBitmap();
+        clearLeds(); // We've closed the file so not looping - clear the LEDs
     }
 }
 
@@ -90,7 +157,7 @@ bool sweepStatus()
         statusColour = wifistatus == WIFI_OK_AP ? CRGB::Green : CRGB::Blue;
 
     leds[i] = statusColour;
-    FastLED.show();
+    showLeds();
     if (up)
     {
         if (i == NUM_LEDS - 1)
@@ -107,6 +174,35 @@ bool sweepStatus()
     return true;
 }
 
+/// Size of a row of the bitmap in the file, including any padding
+uint16_t fileRowSize(const FileInfo &info)
+{
+    if (info.fileType == FILE_NATIVE)
+        return info.rowBytes; // Native rows aren't padded
+    return (info.rowBytes + 3) & ~3;
+}
+
+/// Size of the image data in the bitmap
+uint32_t imageDataLength(const FileInfo &info)
+{
+    if (info.fileType == FILE_NATIVE)
+        return info.fileSize - info.bmpImageoffset; // Compressed rows vary in size
+    return info.bmpHeight * fileRowSize(info);
+}
+
+/// Bitmap and text modes paint an image a row at a time when the switch is pressed
+bool paintMode()
+{
+    return getConfig().mode == MODE_BITMAP || getConfig().mode == MODE_TEXT;
+}
+
+/// Get the start of the current bitmap into RAM so the first rows don't have to wait for the flash
+void preloadBitmap()
+{
+    if (currentFile.status == VALID && !fileopen && currentFile.compMethod != CODEC_TILES)
+        preloadRowStream(currentFile.path, currentFile.bmpImageoffset, imageDataLength(currentFile));
+}
+
 void serviceLeds()
 {
     static bool startup = true;
@@ -130,14 +226,14 @@ void serviceLeds()
     if (getSwitch() == SWITCH_CHANGED_ON)
     {                         // User has pressed the switch
         char power[3] = "U1"; // Assume we're switching the LEDs on
-        if (getConfig().ledsOn && getConfig().mode != MODE_BITMAP)
+        if (getConfig().ledsOn && !paintMode())
         {
             power[1] = '0';      // If they were on, we're switching them off unless we're in bitmap mode
             switchDelay = false; // Set false so we ensure we get full delay if the user presses again before timeout
         }
         update(&power[1]);      // Set the states based on LEDs on/off
         ws.broadcastTXT(power); // .... and tell the browser
-        if (getConfig().mode == MODE_BITMAP)
+        if (paintMode())
         { // In bitmap mode, set status to display the bitmap (LEDs are not turned off by the switch in bitmap mode)
             requestDrawBmp = true;
             // If not in repeat mode, the bitmap is displayed once
@@ -149,14 +245,18 @@ void serviceLeds()
         // If the user has pressed the switch to start the display, then start the delay
         // Except: In bitmap mode, don't start the delay if in repeat mode but we're stopping looping
         // Note that this means if you press the button again while displaying an image, the display will freeze before continuing
-        if (!switchDelay && (power[1] == '1' && !(getConfig().mode == MODE_BITMAP && repeat && !looping)))
+        if (!switchDelay && (power[1] == '1' && !(paintMode() && repeat && !looping)))
         {
             switchDelay = true;
             switchTimer = millis();
+            if (getConfig().mode == MODE_BITMAP)
+                preloadBitmap(); // Use the delay to get the bitmap ready
         }
     }
     if (requestLedsOn)
     { // If requested to turn LEDS on, then do it
+        if (!getConfig().ledsOn)
+            startFrames(); // Don't try to catch up on the frames we didn't draw while they were off
         getConfig().ledsOn = true;
         requestLedsOn = false;
     }
@@ -164,10 +264,15 @@ void serviceLeds()
     { // If requested to turn LEDS off, then do it
         getConfig().ledsOn = false;
         requestLedsOff = false;
-        FastLED.clear(true); // Switch the LEDs off
+        stopCues();          // The cue list only runs while the LEDs are on
+        clearLeds();         // Switch the LEDs off
         closeFile();         // Make sure BMP file is closed if open
+        endPreset();         // It starts again when they're switched back on
     }
 
+    if (serviceBake())
+        return; // Nothing else is drawn while a preset is being baked
+
     if (!(getConfig().ledsOn))
         return; // LEDs are off so nothing else to do
 
@@ -176,16 +281,26 @@ void serviceLeds()
         if (millis() - switchTimer > getConfig().delay * 1000)
         {
             switchDelay = false;
+            startFrames();
         }
         else
             return;
     }
 
+    // Use the time between frames to read ahead in the bitmap, and get the next cue ready
+    if (fileopen)
+    {
+        serviceRowStream();
+        serviceTiles();
+    }
+    prefetchCue();
+
     // Check whether it's time to do an update
-    static unsigned long prevMillis = millis();
-    if (millis() - prevMillis < getConfig().rowDisplayTime)
+    if (!frameDue())
         return;
-    prevMillis = millis();
+    advanceCues(); // Start the next cue with this frame if the current one has finished
+    if (getConfig().mode != MODE_PRESET)
+        endPreset();
     // The LEDs are on so process as required
     switch (getConfig().mode)
     {
@@ -196,211 +311,271 @@ void serviceLeds()
         doPreset();
         break;
     case MODE_BITMAP:
+    case MODE_TEXT:
         doBitmap();
     }
 }
 
-void doFixedBands()
+void doFixed()
+{
+    uint32_t load;
+
+    FastLED.setBrightness(getConfig().brightness);
+    memcpy(leds, getFixedFrame(load), sizeof(leds)); // Only drawn again when the colours change
+    setFrameLoad(load);
+    showFrame();
+}
+
+/// Stop the preset that is running, if there is one
+void endPreset()
+{
+    if (activePreset < 0)
+        return;
+    if (presetList[activePreset].teardown)
+        presetList[activePreset].teardown();
+    activePreset = -1;
+}
+
+void doPreset()
+{
+    uint32_t now = millis();
+    PresetInfo &preset = presetList[getConfig().presetIndex];
+    if (activePreset != getConfig().presetIndex)
+    { // A different preset has been picked, so start it
+        endPreset();
+        activePreset = getConfig().presetIndex;
+        liveClock.last = now;
+        if (preset.init)
+            preset.init();
+    }
+    FastLED.setBrightness(getConfig().brightness);
+    setFrameLoad(renderPreset(preset, liveClock, now));
+    showFrame();
+}
+
+/// Convert a row of bitmap pixels into LED colours, gamma correcting them unless
+/// that was done when the file was converted
+void expandRow(const uint8_t *src, CRGB *dst, uint16_t width, uint8_t pixelFormat)
 {
-    switch (getConfig().coloursUsed)
+    uint16_t value;
+
+    switch (pixelFormat)
     {
-    case 1:
-        fill_solid(leds, NUM_LEDS, CRGB(colours[0][0], colours[0][1], colours[0][2]));
+    case PIXEL_RGB888:
+        memcpy(dst, src, width * 3);
         break;
-    case 2:
-        if (getConfig().gradient)
-        {
-            fill_gradient_RGB(leds, NUM_LEDS,
-                              CRGB(colours[0][0], colours[0][1], colours[0][2]),
-                              CRGB(colours[1][0], colours[1][1], colours[1][2]));
-        }
-        else
-        {
-            CRGB colour0 = CRGB(colours[0][0], colours[0][1], colours[0][2]);
-            CRGB colour1 = CRGB(colours[1][0], colours[1][1], colours[1][2]);
-            for (int i = 0; i < NUM_LEDS / 2; i++)
-            {
-                leds[i] = colour0;
-                leds[i + NUM_LEDS / 2] = colour1;
-            }
-        }
+    case PIXEL_BGR888:
+        for (uint16_t i = 0; i < width; i++, src += 3)
+            dst[i].setRGB(gamma8[src[2]], gamma8[src[1]], gamma8[src[0]]);
         break;
-    case 3:
-        if (getConfig().gradient)
+    case PIXEL_RGB565:
+        for (uint16_t i = 0; i < width; i++, src += 2)
         {
-            fill_gradient_RGB(leds, NUM_LEDS,
-                              CRGB(colours[0][0], colours[0][1], colours[0][2]),
-                              CRGB(colours[1][0], colours[1][1], colours[1][2]),
-                              CRGB(colours[2][0], colours[2][1], colours[2][2]));
-        }
-        else
-        {
-            CRGB colour0 = CRGB(colours[0][0], colours[0][1], colours[0][2]);
-            CRGB colour1 = CRGB(colours[1][0], colours[1][1], colours[1][2]);
-            CRGB colour2 = CRGB(colours[2][0], colours[2][1], colours[2][2]);
-            for (int i = 0; i < NUM_LEDS / 3; i++)
-            {
-                leds[i] = colour0;
-                leds[i + NUM_LEDS / 3] = colour1;
-                leds[i + 2 * NUM_LEDS / 3] = colour2;
-            }
+            value = src[0] | (src[1] << 8);
+            dst[i].setRGB(gamma5[value >> 11], gamma6[(value >> 5) & 0x3F], gamma5[value & 0x1F]);
         }
         break;
-    case 4:
-        if (getConfig().gradient)
+    case PIXEL_RGB555:
+        for (uint16_t i = 0; i < width; i++, src += 2)
         {
-            fill_gradient_RGB(leds, NUM_LEDS,
-                              CRGB(colours[0][0], colours[0][1], colours[0][2]),
-                              CRGB(colours[1][0], colours[1][1], colours[1][2]),
-                              CRGB(colours[2][0], colours[2][1], colours[2][2]),
-                              CRGB(colours[3][0], colours[3][1], colours[3][2]));
+            value = src[0] | (src[1] << 8);
+            dst[i].setRGB(gamma5[(value >> 10) & 0x1F], gamma5[(value >> 5) & 0x1F], gamma5[value & 0x1F]);
         }
-        else
+        break;
+    case PIXEL_INDEXED8:
+        for (uint16_t i = 0; i < width; i++)
+            dst[i] = bmpPalette[src[i]];
+        break;
+    case PIXEL_INDEXED4:
+        for (uint16_t i = 0; i < width; i++)
+            dst[i] = bmpPalette[(i & 1) ? src[i >> 1] & 0x0F : src[i >> 1] >> 4];
+        break;
+    }
+}
+
+/// Open the current bitmap ready to draw its first row. If carryOn is set, it is taking
+/// over from something else that was being shown, so the LEDs aren't switched off and
+/// the frame timing isn't restarted.
+bool openBitmap(bool carryOn)
+{
+    clearPowerProfile();
+    if (getConfig().mode == MODE_TEXT)
+    { // Text is drawn as it's needed, so there's nothing to read
+        if (!(bmpRows = openText()))
+            return false;
+        fileopen = true;
+    }
+    else if (currentFile.status != VALID)
+    {
+        Serial.print(F("Bitmap file error:"));
+        Serial.println(currentFile.status);
+        return false;
+    }
+    else if (currentFile.compMethod == CODEC_TILES)
+    { // Tiles are read as they're needed, and shown through the viewport without resampling
+        if (!openTiles(currentFile))
         {
-            CRGB colour0 = CRGB(colours[0][0], colours[0][1], colours[0][2]);
-            CRGB colour1 = CRGB(colours[1][0], colours[1][1], colours[1][2]);
-            CRGB colour2 = CRGB(colours[2][0], colours[2][1], colours[2][2]);
-            CRGB colour3 = CRGB(colours[3][0], colours[3][1], colours[3][2]);
-            for (int i = 0; i < NUM_LEDS / 4; i++)
-            {
-                leds[i] = colour0;
-                leds[i + NUM_LEDS / 4] = colour1;
-                leds[i + NUM_LEDS / 2] = colour2;
-                leds[i + 3 * NUM_LEDS / 4] = colour3;
-            }
+            Serial.print(F("Error opening tiled bitmap "));
+            Serial.println(currentFile.path);
+            return false;
         }
-        break;
-    case 5:
-        if (getConfig().gradient)
+        fileopen = true;
+        bmpRows = tileLines();
+    }
+    else
+    {
+        // Check the image isn't too wide
+        if (currentFile.bmpWidth > MAX_BMP_WIDTH)
         {
-            fill_gradient_RGB(leds, 0, CRGB(colours[0][0], colours[0][1], colours[0][2]),
-                              NUM_LEDS / 4, CRGB(colours[1][0], colours[1][1], colours[1][2]));
-            fill_gradient_RGB(leds, NUM_LEDS / 4, CRGB(colours[1][0], colours[1][1], colours[1][2]),
-                              NUM_LEDS / 2, CRGB(colours[2][0], colours[2][1], colours[2][2]));
-            fill_gradient_RGB(leds, NUM_LEDS / 2, CRGB(colours[2][0], colours[2][1], colours[2][2]),
-                              NUM_LEDS * 3 / 4, CRGB(colours[3][0], colours[3][1], colours[3][2]));
-            fill_gradient_RGB(leds, NUM_LEDS * 3 / 4, CRGB(colours[3][0], colours[3][1], colours[3][2]),
-                              NUM_LEDS - 1, CRGB(colours[4][0], colours[4][1], colours[4][2]));
+            Serial.println(F("Error: Image is too wide"));
+            return false;
         }
-        else
+        bmpRowSize = fileRowSize(currentFile);
+        // Check file exists and open it
+        if (!openRowStream(currentFile.path, currentFile.bmpImageoffset, imageDataLength(currentFile)))
         {
-            CRGB colour0 = CRGB(colours[0][0], colours[0][1], colours[0][2]);
-            CRGB colour1 = CRGB(colours[1][0], colours[1][1], colours[1][2]);
-            CRGB colour2 = CRGB(colours[2][0], colours[2][1], colours[2][2]);
-            CRGB colour3 = CRGB(colours[3][0], colours[3][1], colours[3][2]);
-            CRGB colour4 = CRGB(colours[4][0], colours[4][1], colours[4][2]);
-            for (int i = 0; i <= NUM_LEDS / 5; i++) // <= as 5 is not a factor of 144
-            {
-                leds[i] = colour0;
-                leds[i + NUM_LEDS / 5] = colour1;
-                leds[i + 2 * NUM_LEDS / 5] = colour2;
-                leds[i + 3 * NUM_LEDS / 5] = colour3;
-                leds[i + 4 * NUM_LEDS / 5] = colour4;
-            }
+            Serial.print(F("File not found"));
+            Serial.println(currentFile.path);
+            return false;
         }
-        break;
+        fileopen = true;
+        bmpRows = currentFile.bmpHeight;
+        loadPowerProfile(currentFile);
+        if (currentFile.bmpWidth != NUM_LEDS)
+            setupResample(currentFile.bmpWidth); // Work out how to fit the rows to the LEDs
     }
-}
-
-void doFixedInterleave()
-{
-    CRGB userColours[] = {CRGB(colours[0][0], colours[0][1], colours[0][2]),
-                          CRGB(colours[1][0], colours[1][1], colours[1][2]),
-                          CRGB(colours[2][0], colours[2][1], colours[2][2]),
-                          CRGB(colours[3][0], colours[3][1], colours[3][2]),
-                          CRGB(colours[4][0], colours[4][1], colours[4][2])};
-    int coloursUsed = getConfig().coloursUsed;
-
-    for (int i = 0; i < NUM_LEDS; i++)
+    if (!carryOn)
     {
-        leds[i] = userColours[i % coloursUsed];
+        startFrames();       // Time the rows from the first one
+        clearLeds();         // Switch the LEDs off to start
     }
+    bmpRow = 0;       // Start at the first (bottom) row of the image
+    bmpSubRow = 0;
+    blending = false;
+    if (getConfig().mode != MODE_TEXT)
+        primeRowStream(); // Fill the read-ahead buffer before the first row
+    return true;
 }
 
-void doFixed()
+/// Read the next row of the bitmap into dst, resampled to fit the LEDs
+bool readNextRow(CRGB *dst)
 {
-    FastLED.setBrightness(getConfig().brightness);
-    if (getConfig().interleave)
-        doFixedInterleave();
+    static uint8_t rowBuffer[MAX_BMP_WIDTH * 3];
+    static uint8_t decodeWindow[2][MAX_BMP_WIDTH * 3]; // Previous and current row for compressed files
+    static uint8_t current;                            // Which half of the window holds the current row
+    static CRGB sourceRow[MAX_BMP_WIDTH];              // The row before it is resampled to fit the LEDs
+
+    if (getConfig().mode == MODE_TEXT)
+        return readTextColumn(bmpRow, dst);
+    if (currentFile.compMethod == CODEC_TILES)
+        return readTileLine(bmpRow, dst);
+    CRGB *target = currentFile.bmpWidth == NUM_LEDS ? dst : sourceRow; // Rows that fit go straight to dst
+    bool ok;
+    if (currentFile.fileType == FILE_NATIVE && currentFile.compMethod == CODEC_ROWS)
+    { // Compressed rows can refer back to the previous row, which is all zeros at the start of the image
+        if (bmpRow == 0)
+            memset(decodeWindow[current ^ 1], 0, bmpRowSize);
+        ok = decodeRow(decodeWindow[current ^ 1], decodeWindow[current], bmpRowSize, pixelCodeBytes(currentFile.pixelFormat));
+        expandRow(decodeWindow[current], target, currentFile.bmpWidth, currentFile.pixelFormat);
+        current ^= 1;
+    }
+    else if (currentFile.pixelFormat == PIXEL_RGB888)
+    { // Native rows are ready to go, so they can be read straight into the LED array (or the resampler)
+        ok = readRowStream((uint8_t *)target, bmpRowSize);
+    }
     else
-        doFixedBands();
-    FastLED.show();
+    {
+        // Get the row of data and skip any padding
+        ok = readRowStream(rowBuffer, currentFile.rowBytes) &&
+             readRowStream(NULL, bmpRowSize - currentFile.rowBytes);
+        expandRow(rowBuffer, target, currentFile.bmpWidth, currentFile.pixelFormat);
+    }
+    if (target != dst)
+        resampleRow(sourceRow, dst);
+    return ok;
 }
 
-void doPreset()
+/// Mix two rows of LEDs, fraction (out of 256) of the way from one to the other
+void blendRows(const CRGB *from, const CRGB *to, CRGB *dst, uint16_t fraction)
 {
-    static unsigned long prevMillis = millis();
-    if (millis() - prevMillis > 40)
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
     {
-        prevMillis = millis();
-        gHue++;
+        dst[i].r = from[i].r + (((to[i].r - from[i].r) * fraction) >> 8);
+        dst[i].g = from[i].g + (((to[i].g - from[i].g) * fraction) >> 8);
+        dst[i].b = from[i].b + (((to[i].b - from[i].b) * fraction) >> 8);
     }
-    FastLED.setBrightness(getConfig().brightness);
-    presetList[getConfig().presetIndex].presetfn();
-    FastLED.show();
 }
 
 void drawNextRow()
 {
-    static unsigned int rowSize;
-    static uint32_t offset;
-    static uint8_t rowBuffer[NUM_LEDS * 3];
+    static CRGB blendRow[2][NUM_LEDS]; // The row we're blending from and the one we're blending to
+    static uint8_t blendTo;            // Which of them is the one we're blending to
 
-    if (!fileopen)
+    if (!fileopen && !openBitmap(false))
     {
-        if (currentFile.status != VALID)
-        {
-            Serial.print(F("Bitmap file error:"));
-            Serial.println(currentFile.status);
-            return;
-        }
-        // Check the image isn't too wide
-        if (currentFile.bmpWidth > NUM_LEDS)
-        {
-            Serial.println(F("Error: Image is bigger than the number of LEDs"));
-            return;
-        }
-        // Check file exists and open it
-        if (!(file = LittleFS.open(currentFile.path, "r")))
-        {
-            Serial.print(F("File not found"));
-            Serial.println(currentFile.path);
-            return;
-        }
-        fileopen = true;
-        rowSize = (currentFile.bmpWidth * 3 + 3) & ~3;
-        offset = currentFile.bmpImageoffset;     // Set the offset pointer to the first (bottom) row of the image
-        memset(rowBuffer, 0, sizeof(rowBuffer)); // Clear the LED array
-        FastLED.clear(true);                     // Switch the LEDs off to start
+        requestDrawBmp = false; // Rather than trying again every frame
+        return;
     }
 
-    // Seek to the next row if there's some padding
-    if (file.position() != offset)
+    unsigned long start = micros();
+    uint8_t steps = getConfig().subRows;
+    bool ok = true;
+    if (steps <= 1)
     {
-        file.seek(offset, SeekSet);
+        ok = readNextRow(leds);
+        bmpSubRow = 0; // In case blending has just been switched off
+        blending = false;
+    }
+    else
+    { // Blend from each row to the next over several frames, so slow paintings don't look steppy
+        if (bmpSubRow == 0)
+        {
+            blendTo ^= 1; // The row we were blending to is the one we blend from now
+            ok = readNextRow(blendRow[blendTo]);
+            if (!blending)
+            {                          // Nothing to blend from yet,
+                bmpSubRow = steps - 1; // so the first row goes straight out
+                blending = true;
+            }
+        }
+        bmpSubRow++;
+        blendRows(blendRow[blendTo ^ 1], blendRow[blendTo], leds, bmpSubRow * 256 / steps);
+        if (bmpSubRow >= steps)
+            bmpSubRow = 0; // Reached the row, so on to the next one
     }
-    file.read(rowBuffer, currentFile.bmpWidth * 3); // Read  in the row of data
-    // Set the LED colours for this row
-    uint16_t pixelPtr = 0;
-    for (int16_t i = 0; i < currentFile.bmpWidth; i++)
+    if (!ok)
     {
-        leds[i].setRGB(gamma8[rowBuffer[pixelPtr + 2]], gamma8[rowBuffer[pixelPtr + 1]], gamma8[rowBuffer[pixelPtr]]);
-        pixelPtr += 3;
+        Serial.println(F("Error: Unexpected end of bitmap data"));
+        requestDrawBmp = false;
+        closeFile();
+        return;
     }
+    RowStreamStats &stats = getRowStreamStats();
+    stats.rows++;
+    stats.rowMicros += micros() - start;
+
     FastLED.setBrightness(getConfig().brightness);
-    FastLED.show();
-    offset += rowSize; // Bump the offset to the next row
+    if (bmpSubRow)
+        setRowLoad(bmpRow ? bmpRow - 1 : bmpRows - 1, bmpRow); // Part way between the last row and this one
+    else
+        setRowLoad(bmpRow);
+    showFrame();
 
-    if (offset >= currentFile.bmpImageoffset + currentFile.bmpHeight * rowSize)
+    if (bmpSubRow)
+        return; // Still blending towards this row
+    if (++bmpRow >= bmpRows)
     {
         if (looping)
-        {                                        // Show the BMP file again
-            offset = currentFile.bmpImageoffset; // Reset the offset to the start of the image
+        {               // Show the BMP file again
+            bmpRow = 0; // The read-ahead wraps round to the start of the image
         }
         else
         {
             requestDrawBmp = false;
-            closeFile();
+            if (cuesRunning())
+                endBitmap(); // Leave the last row showing until the next cue takes over
+            else
+                closeFile();
         }
     }
 }
@@ -523,7 +698,7 @@ String update(char *cmd)
         userChanges = true;
         break;
     case 'J': // Set number of colours used in fixed mode
-        getConfig().coloursUsed = cmd[1] - '0';
+        getConfig().coloursUsed = constrain(atoi(cmd + 1), 1, MAX_COLOURS);
         s = cmd;
         userChanges = true;
         break;
@@ -539,6 +714,7 @@ String update(char *cmd)
         userChanges = true;
         break;
     case 'M': // Change [M]ode
+        stopCues(); // The user has taken over
         getConfig().mode = cmd[1] - '0';
         closeFile();
         s = cmd; // sends back "M0"/"M1"/"M2"
@@ -570,13 +746,12 @@ String update(char *cmd)
         userChanges = true;
         break;
     case 'S': // [S]ave settings
-        writeConfig();
+        saveSettings(); // As the user had them, if a cue list has taken over
         s = 'S';
         userChanges = false;
         break;
-    case 'T': // Set  row display [T]ime
-        i = atoi(cmd + 1);
-        getConfig().rowDisplayTime = i;
+    case 'T': // Set  row display [T]ime in milliseconds, which needn't be a whole number
+        getConfig().rowDisplayMicros = atof(cmd + 1) * 1000;
         s = cmd;
         userChanges = true;
         break;
@@ -585,14 +760,93 @@ String update(char *cmd)
         s = cmd;
         userChanges = true;
         break;
+    case 'V': // Set late frame policy: V0 catch up, V1 drop
+        getConfig().latePolicy = cmd[1] == '1' ? SCHEDULE_DROP : SCHEDULE_CATCHUP;
+        s = cmd;
+        userChanges = true;
+        break;
+    case 'W': // Cue list: W1 run it, W0 stop it, W{...} replace it with a new one
+        if (cmd[1] == '{')
+            s = setCues(cmd + 1) ? "W" : "?Error in cue list";
+        else if (cmd[1] == '1')
+        {
+            requestLedsOn = true; // Make sure the LEDs are on
+            s = startCues() ? cmd : "?No cues to run";
+        }
+        else
+        {
+            stopCues();
+            s = cmd;
+        }
+        break;
     case 'X':        // Delete file
         s = cmd + 1; // Path for file being deleted
         closeFile(); // Should be closed anyway, but just in case
         if (LittleFS.remove(s))
+        {
+            removeFromBmpIndex(cmd + 1);
+            dropCacheEntries(cmd + 1);
+            rawStoreRemove(cmd + 1);
             s = 'X';
+        }
         else
             s = "?Error deleting file";
         break;
+    case 'Y': // Set the number of frames to blend from one bitmap row to the next
+        getConfig().subRows = constrain(atoi(cmd + 1), 1, MAX_SUBROWS);
+        s = cmd;
+        userChanges = true;
+        break;
+    case 'Z': // Tiled bitmaps: ZA<0|1> play rows/columns, ZV<n> move the viewport, ZT<0|1> tile all uploads
+        i = atoi(cmd + 2);
+        if (cmd[1] == 'A')
+            getConfig().scanColumns = i;
+        else if (cmd[1] == 'V')
+            getConfig().viewport = i;
+        else if (cmd[1] == 'T')
+            getConfig().tileUploads = i;
+        s = cmd;
+        userChanges = true;
+        break;
+    case 'b': // Bake: bB<seconds> start baking the current preset into a bitmap, bC<path> check whether a baked bitmap is out of date
+        if (cmd[1] == 'B')
+        {
+            closeFile(); // It may be replacing the open bitmap
+            const char *error = startBake(atoi(cmd + 2));
+            if (error)
+            {
+                s = "?";
+                s += error;
+            }
+            else
+                s = "bP0"; // Progress and the result are sent to every browser as the bake goes on
+        }
+        else if (cmd[1] == 'C')
+        {
+            s = "bC";
+            s += (int)bakeStale(cmd + 2); // -1 if it isn't a baked preset
+        }
+        else
+        {
+            s = "?Unknown bake command: ";
+            s += cmd;
+        }
+        break;
+    case 'k': // Set the keepalive time: k<ms> resend unchanged frames this often, 0 to send every frame
+        getConfig().keepaliveMillis = atoi(cmd + 1);
+        s = cmd;
+        userChanges = true;
+        break;
+    case 't': // Text mode: tT<text> set the message, tS<n> set the scale, tC<rrggbb> set the colour
+        if (cmd[1] == 'T')
+            strlcpy(getConfig().text, cmd + 2, sizeof(Config::text));
+        else if (cmd[1] == 'S')
+            getConfig().textScale = constrain(atoi(cmd + 2), 1, MAX_TEXT_SCALE);
+        else if (cmd[1] == 'C')
+            getConfig().textColour = strtoul(cmd + 2, NULL, 16);
+        s = cmd;
+        userChanges = true;
+        break;
     default:
         Serial.print(F("Unexpected websocket command: "));
         Serial.println(cmd);
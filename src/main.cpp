@@ -1,6 +1,9 @@
 #include "pixelstick.h"
 
 void initConfig();
+void initBmpIndex();
+void initRawStore();
+void initCues();
 void initLeds();
 void initWifi();
 // void checkWifi();
@@ -25,6 +28,9 @@ void setup()
   pinMode(USER_SWITCH, INPUT_PULLUP);
   LittleFS.begin();
   initConfig();    // Get the config data
+  initBmpIndex();  // Make sure the index of bitmap files is up to date
+  initRawStore();  // Load the directory of the raw flash store, if there is one
+  initCues();      // Load the cue list, if there is one
   initLeds();      // Set the LEDs up and tell the user we're alive
   initWifi();      // Start the WiFi - default is AP mode, press user switch during boot for client mode
   initOTA();       // Set up OTA
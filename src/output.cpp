@@ -0,0 +1,96 @@
+#include "pixelstick.h"
+
+// LED output
+//
+// Sends the frame in leds[] to the strip. Only as many LEDs as need it are clocked out:
+// those up to the last one lit now, or lit by the last frame. The rest of the strip is
+// already off and stays that way. Frames the LEDs are already showing aren't sent again
+// until the keepalive time is up. On a PC, FastLED's controller is the host's capture
+// of the strip (see hostled.h), so extras/hosttest can check the strip ends up the same
+// as if every LED had been sent.
+
+extern CRGB leds[];
+
+uint8_t limitBrightness(uint8_t brightness, const CRGB *leds, uint16_t lit);
+
+CLEDController *ledController; // So we can change how many LEDs are sent
+uint16_t litLeds = NUM_LEDS;   // LEDs that were lit by the last frame sent - all of them, as far as we know at startup
+uint32_t shownHash;            // Hash of the last frame sent
+uint8_t shownBrightness;       // Brightness it was sent at, after power limiting
+uint32_t shownMillis;          // When it was sent
+bool shownValid;               // The LEDs are showing that frame, as far as we know
+
+/// A quick hash of the frame, to tell whether it has changed since it was sent. It's
+/// FNV-1a a word at a time, with the top half folded back down after each word: the
+/// multiply only carries a change upwards, so on its own a change to the top byte of a
+/// word would only reach the top 8 bits of the hash, and 1 in 256 frames that changed
+/// two LEDs would look the same as the last one and not be sent.
+uint32_t hashLeds()
+{
+  const uint32_t *words = (const uint32_t *)leds;
+  uint32_t hash = 2166136261;
+
+  for (uint16_t i = 0; i < NUM_LEDS * 3 / 4; i++)
+  {
+    hash = (hash ^ words[i]) * 16777619;
+    hash ^= hash >> 16;
+  }
+  for (uint16_t i = NUM_LEDS * 3 & ~3; i < NUM_LEDS * 3; i++)
+    hash = (hash ^ ((const uint8_t *)leds)[i]) * 16777619;
+  return hash;
+}
+
+/// Send the frame to the LEDs. Only the LEDs up to the last one that is lit now, or was
+/// lit by the last frame, are sent - the rest of the strip is already off and stays as it
+/// is - so a frame that only lights the start of the strip takes less time to send, with
+/// the interrupts off for less time. The brightness is turned down if the frame would
+/// draw more power than the supply can give. Unless always is set, the frame isn't sent
+/// if the LEDs are already showing it, at the same brightness, and were last sent it
+/// within the keepalive time.
+void sendLeds(bool always)
+{
+  uint16_t lit = NUM_LEDS;
+
+  while (lit && !leds[lit - 1])
+    lit--;
+  uint8_t brightness = limitBrightness(FastLED.getBrightness(), leds, lit);
+  uint32_t hash = hashLeds();
+  uint32_t now = millis();
+  if (!always && shownValid && hash == shownHash && brightness == shownBrightness &&
+      now - shownMillis < getConfig().keepaliveMillis)
+    return;
+  uint16_t count = lit > litLeds ? lit : litLeds;
+  if (count)
+  {
+    ledController->setLeds(leds, count);
+    FastLED.show(brightness);
+  }
+  litLeds = lit;
+  shownHash = hash;
+  shownBrightness = brightness;
+  shownMillis = now;
+  shownValid = true;
+}
+
+/// Send the frame to the LEDs, whether or not they're showing it already
+void showLeds()
+{
+  sendLeds(true);
+}
+
+/// Send a frame drawn by one of the modes, which are drawn every frame whether they have
+/// changed or not. Frames that haven't changed (fixed colours, a solid rainbow between
+/// steps of its hue, bitmap rows that are the same as the last one) aren't sent, so the
+/// interrupts aren't kept off for 4ms at a time for nothing, which WiFi doesn't like.
+void showFrame()
+{
+  sendLeds(false);
+}
+
+/// Switch all the LEDs off. The whole frame is cleared, not FastLED.clear(), which only
+/// clears as many LEDs as were last sent.
+void clearLeds()
+{
+  fill_solid(leds, NUM_LEDS, CRGB::Black);
+  showLeds();
+}
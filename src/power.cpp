@@ -0,0 +1,136 @@
+#include "pixelstick.h"
+
+// Power limiting
+//
+// Works out how far the brightness has to be turned down so the LEDs don't draw more
+// than the supply can give, using the same model as FastLED's power limiter. FastLED's
+// own limiter adds up every LED on each show(); here the frame's load is usually known
+// before it is sent. Bitmaps carry a power profile, worked out when they are uploaded,
+// and fixed colours are added up as they are set, so each frame only costs a lookup.
+// The motion presets are added up by renderPreset() straight after each frame is drawn.
+// Anything else (text, and bitmaps uploaded before there were profiles) is added up
+// when the frame is sent. The profile also lets the limiter see what's coming, so the
+// brightness is eased down before a bright patch of a bitmap and back up after it,
+// rather than changing from one row to the next, which shows up as banding.
+
+#define POWER_MAX (5 * MILLI_AMPS) // Most power the LEDs can have (mW)
+#define POWER_SMOOTH 8             // Profile entries either side of a row that affect its brightness
+
+uint32_t rawStoreFind(const char *path, uint32_t length);
+bool rawStoreRead(uint32_t offset, uint8_t *buf, uint32_t len);
+
+uint8_t powerProfile[POWER_PROFILE_MAX]; // Profile of the bitmap being played
+uint16_t powerEntries;                    // Entries in it, 0 if there isn't one
+uint16_t powerStep;                       // Rows covered by each entry
+uint32_t frameLoad;                       // Load of the frame about to be sent, if it's known
+bool frameLoadKnown;
+
+/// Power an LED set to r, g, b draws, in 1/256 mW
+uint32_t pixelLoad(uint8_t r, uint8_t g, uint8_t b)
+{
+  return r * POWER_RED + g * POWER_GREEN + b * POWER_BLUE;
+}
+
+uint32_t pixelLoad(const CRGB &c)
+{
+  return pixelLoad(c.r, c.g, c.b);
+}
+
+/// The renderer has worked out the load of the frame it has just drawn (the sum of
+/// pixelLoad() for each LED), so it doesn't have to be added up when it's sent
+void setFrameLoad(uint32_t load)
+{
+  frameLoad = load;
+  frameLoadKnown = true;
+}
+
+/// Brightness to send a frame at, so it doesn't draw more than the supply can give.
+/// lit is the number of LEDs that might be lit, for adding up the load if the renderer
+/// hasn't already.
+uint8_t limitBrightness(uint8_t brightness, const CRGB *leds, uint16_t lit)
+{
+  uint32_t load = frameLoad;
+
+  if (!frameLoadKnown)
+  {
+    load = 0;
+    for (uint16_t i = 0; i < lit; i++)
+      load += pixelLoad(leds[i]);
+  }
+  frameLoadKnown = false;
+  uint32_t requested = ((load >> 8) + POWER_DARK * NUM_LEDS) * brightness / 256;
+  if (requested <= POWER_MAX)
+    return brightness;
+  return brightness * POWER_MAX / requested;
+}
+
+/// Read the power profile of a bitmap, ready for it to be played
+void loadPowerProfile(const FileInfo &info)
+{
+  File file;
+  uint32_t raw;
+  uint32_t offset = info.paletteOffset + info.paletteColours * 3; // It follows the palette
+
+  powerStep = info.powerStep;
+  powerEntries = powerStep ? (info.bmpHeight + powerStep - 1) / powerStep : 0;
+  if (!powerEntries || powerEntries > POWER_PROFILE_MAX)
+  {
+    powerEntries = 0;
+    return;
+  }
+  if ((raw = rawStoreFind(info.path, info.fileSize)))
+  {
+    if (!rawStoreRead(raw + offset, powerProfile, powerEntries))
+      powerEntries = 0;
+    return;
+  }
+  if (!(file = LittleFS.open(info.path, "r")) || !file.seek(offset, SeekSet) ||
+      file.read(powerProfile, powerEntries) != powerEntries)
+    powerEntries = 0;
+  if (file)
+    file.close();
+}
+
+/// Forget the profile - the bitmap has finished, or what's being played doesn't have one
+void clearPowerProfile()
+{
+  powerEntries = 0;
+}
+
+/// Load level of a bitmap row from the profile. Rows near a bright one are treated as if
+/// they were brighter too, tapering off with the distance from it, so the brightness
+/// changes gradually.
+uint16_t rowLevel(uint16_t row)
+{
+  int16_t entry = row / powerStep;
+  uint16_t level = 0;
+  for (int16_t i = entry - POWER_SMOOTH + 1; i < entry + POWER_SMOOTH; i++)
+  {
+    if (i < 0 || i >= powerEntries)
+      continue;
+    uint16_t weighted = powerProfile[i] * (POWER_SMOOTH - abs(i - entry)) / POWER_SMOOTH;
+    if (weighted > level)
+      level = weighted;
+  }
+  return level;
+}
+
+/// Set the load of a bitmap row from the profile, if there is one
+void setRowLoad(uint16_t row)
+{
+  if (!powerEntries)
+    return;
+  setFrameLoad((uint32_t)rowLevel(row) * POWER_WHITE * NUM_LEDS);
+}
+
+/// Set the load of a frame blended from one bitmap row to another. The load of the blend
+/// is part way between theirs, so it is taken as whichever of the two draws more.
+void setRowLoad(uint16_t from, uint16_t to)
+{
+  if (!powerEntries)
+    return;
+  uint16_t level = rowLevel(from);
+  if (rowLevel(to) > level)
+    level = rowLevel(to);
+  setFrameLoad((uint32_t)level * POWER_WHITE * NUM_LEDS);
+}
@@ -3,8 +3,8 @@
 #define ARRAY_SIZE(A) (sizeof(A) / sizeof((A)[0]))
 
 extern CRGB leds[];
-extern CRGBPalette16 SnowColours;
-extern CRGBPalette16 Incandescent;
+extern const TProgmemRGBPalette16 SnowColours;
+extern const TProgmemRGBPalette16 Incandescent;
 extern const TProgmemRGBPalette16 RedGreenWhite_p;
 extern const TProgmemRGBPalette16 Holly_p;
 extern const TProgmemRGBPalette16 RedWhite_p;
@@ -14,38 +14,52 @@ extern const TProgmemRGBPalette16 Snow_p;
 extern const TProgmemRGBPalette16 RetroC9_p;
 extern const TProgmemRGBPalette16 Ice_p;
 
-void pride();
-void rainbow();
-void rainbowWithGlitter();
-void rainbowSolid();
-void colourWaves();
-void confetti();
-void sinelon();
-void bpm();
-void juggle();
-void fire();
-void water();
-void colourTwinkles();
-void drawTwinkles();
+void pride(const PresetContext &ctx);
+void prideInit();
+void rainbow(const PresetContext &ctx);
+void rainbowInit();
+void rainbowWithGlitter(const PresetContext &ctx);
+void rainbowSolid(const PresetContext &ctx);
+void colourWaves(const PresetContext &ctx);
+void colourWavesInit();
+void confetti(const PresetContext &ctx);
+void sinelon(const PresetContext &ctx);
+void sinelonInit();
+void bpm(const PresetContext &ctx);
+void juggle(const PresetContext &ctx);
+void juggleInit();
+void fire(const PresetContext &ctx);
+void water(const PresetContext &ctx);
+void fireInit();
+void waterInit();
+void colourTwinkles(const PresetContext &ctx);
+void colourTwinklesInit();
+void drawTwinkles(const PresetContext &ctx);
+void drawTwinklesInit();
+void swarFade(CRGB *leds, uint16_t count, uint8_t fade);
+void swarBlend(CRGB *dst, const CRGB *src, uint16_t count, uint8_t amount);
+uint32_t pixelLoad(const CRGB &c);
 
 PresetInfo presetList[] = {
-    {"Pride", pride, {}, -1},
-    {"Rainbow", rainbow, {}, -1},
-    {"Rainbow with glitter", rainbowWithGlitter, {}, -1},
+    {"Pride", pride, {}, -1, prideInit},
+    {"Rainbow", rainbow, {}, -1, rainbowInit},
+    {"Rainbow with glitter", rainbowWithGlitter, {}, -1, rainbowInit},
     {"Solid rainbow", rainbowSolid, {}, -1},
-    {"Colour Waves", colourWaves, {}, 0},
+    {"Colour Waves", colourWaves, {}, 0, colourWavesInit},
     {"Confetti", confetti, {}, 0},
-    {"Sinelon", sinelon, {{"Speed", {1, 100, 36}}, {"Fade", {1, 255, 20}}}, 0},
+    {"Sinelon", sinelon, {{"Speed", {1, 100, 36}}, {"Fade", {1, 255, 20}}}, 0, sinelonInit},
     {"Beat", bpm, {{"Beats/minute", {30, 255, 120}}}, 0},
-    {"Juggle", juggle, {}, -1},
-    {"Fire", fire, {{"Cooling", {20, 100, 90}}, {"Sparking", {50, 200, 150}}}, -1},
-    {"Water", water, {{"Cooling", {20, 100, 80}}, {"Sparking", {50, 200, 100}}}, -1},
-    {"Twinkles", colourTwinkles, {}, 8},
-    {"TwinkleFox", drawTwinkles, {{"Twinkle speed", {0, 8, 4}}, {"Twinkle density", {1, 8, 5}}}, 10}};
+    {"Juggle", juggle, {}, -1, juggleInit},
+    {"Fire", fire, {{"Cooling", {20, 100, 90}}, {"Sparking", {50, 200, 150}}}, -1, fireInit},
+    {"Water", water, {{"Cooling", {20, 100, 80}}, {"Sparking", {50, 200, 100}}}, -1, waterInit},
+    {"Twinkles", colourTwinkles, {}, 8, colourTwinklesInit},
+    {"TwinkleFox", drawTwinkles, {{"Twinkle speed", {0, 8, 4}}, {"Twinkle density", {1, 8, 5}}}, 10, drawTwinklesInit}};
 
 extern const uint8_t presetNum = ARRAY_SIZE(presetList);
 
-extern uint8_t gHue; // rotating "base color" used by many of the patterns
+const PresetClock *renderClock; // Clock of the preset being drawn, NULL if there isn't one
+
+CRGB presetRow[NUM_LEDS] __attribute__((aligned(4))); // New colours for pride and colourWaves, blended into the LEDs in one go
 
 extern const CRGBPalette16 palettes[] = {
     RainbowColors_p,
@@ -89,14 +103,77 @@ extern const String paletteNames[paletteNum] = {
     "RetroC9",
     "Ice"};
 
+CRGB paletteColours[256]; // The palette in use, expanded so each colour is a single lookup
+int16_t expandedPalette = -1; // Which palette it is, -1 before the first one
+
+CRGB rainbowColours[256]; // What fill_rainbow() gives for each hue
+bool rainbowReady;
+
+const CRGBPalette16 fireColours(CRGB::Black, CRGB::Red, CRGB::Yellow, CRGB::White);
+const CRGBPalette16 waterColours(CRGB::Black, CRGB::Blue, CRGB::Aqua, CRGB::White);
+CRGB heatColours[256]; // Fire or water palette, expanded
+
+/// Work out every colour the palette gives with blending
+void expandPalette(const CRGBPalette16 &palette, CRGB *colours)
+{
+  for (uint16_t i = 0; i < 256; i++)
+    colours[i] = ColorFromPalette(palette, i, 255, LINEARBLEND);
+}
+
+/// Get the colours of one of the palettes, expanding it if it isn't the one expanded
+/// last - so only when a preset with a different palette starts or the palette is changed
+const CRGB *getPaletteColours(uint8_t index)
+{
+  if (index != expandedPalette)
+  {
+    expandPalette(palettes[index], paletteColours);
+    expandedPalette = index;
+  }
+  return paletteColours;
+}
+
+/// The same as ColorFromPalette() with LINEARBLEND, from the expanded palette. The
+/// brightness is applied the way ColorFromPalette() does it.
+inline CRGB paletteColour(const CRGB *colours, uint8_t index, uint8_t brightness = 255)
+{
+  CRGB c = colours[index];
+
+  if (brightness == 255)
+    return c;
+  if (!brightness)
+    return CRGB::Black;
+  return c.nscale8(brightness + 1);
+}
+
+/// Get the rainbow ready, the first time it is needed
+void rainbowInit()
+{
+  if (rainbowReady)
+    return;
+  for (uint16_t i = 0; i < 256; i++)
+    hsv2rgb_rainbow(CHSV(i, 240, 255), rainbowColours[i]); // The saturation and value fill_rainbow() uses
+  rainbowReady = true;
+}
+
+// Where pride and colour waves have got to, so they start the same way each time
+uint16_t pridePseudotime;
+uint16_t prideHue16;
+uint16_t wavesPseudotime;
+uint16_t wavesHue16;
+
+void prideInit()
+{
+  pridePseudotime = 0;
+  prideHue16 = 0;
+}
+
 // Pride2015 by Mark Kriegsman: https://gist.github.com/kriegsman/964de772d64c502760e5
 // This function draws rainbows with an ever-changing,
 // widely-varying set of parameters.
-void pride()
+void pride(const PresetContext &ctx)
 {
-  static uint16_t sPseudotime = 0;
-  static uint16_t sLastMillis = 0;
-  static uint16_t sHue16 = 0;
+  uint16_t &sPseudotime = pridePseudotime;
+  uint16_t &sHue16 = prideHue16;
 
   uint8_t sat8 = beatsin88(87, 220, 250);
   uint8_t brightdepth = beatsin88(341, 96, 224);
@@ -106,9 +183,7 @@ void pride()
   uint16_t hue16 = sHue16; //gHue * 256;
   uint16_t hueinc16 = beatsin88(113, 1, 3000);
 
-  uint16_t ms = millis();
-  uint16_t deltams = ms - sLastMillis;
-  sLastMillis = ms;
+  uint16_t deltams = ctx.delta;
   sPseudotime += deltams * msmultiplier;
   sHue16 += deltams * beatsin88(400, 5, 9);
   uint16_t brightnesstheta16 = sPseudotime;
@@ -130,14 +205,25 @@ void pride()
     uint16_t pixelnumber = i;
     pixelnumber = (NUM_LEDS - 1) - pixelnumber;
 
-    nblend(leds[pixelnumber], newcolor, 64);
+    presetRow[pixelnumber] = newcolor;
   }
+  swarBlend(leds, presetRow, NUM_LEDS, 64);
 }
 
-void rainbow()
+void rainbow(const PresetContext &ctx)
 {
-  // FastLED's built-in rainbow generator
-  fill_rainbow(leds, NUM_LEDS, gHue, 255 / NUM_LEDS);
+  // FastLED's built-in rainbow generator, from the table of its colours
+  uint8_t step = 255 / NUM_LEDS;
+  if (step == 1)
+  { // Each LED is the next hue round, so it's one or two copies
+    uint16_t first = 256 - ctx.hue < NUM_LEDS ? 256 - ctx.hue : NUM_LEDS;
+    memcpy(leds, rainbowColours + ctx.hue, first * sizeof(CRGB));
+    memcpy(leds + first, rainbowColours, (NUM_LEDS - first) * sizeof(CRGB));
+    return;
+  }
+  uint8_t hue = ctx.hue;
+  for (uint16_t i = 0; i < NUM_LEDS; i++, hue += step)
+    leds[i] = rainbowColours[hue];
 }
 
 void addGlitter(uint8_t chanceOfGlitter)
@@ -148,26 +234,31 @@ void addGlitter(uint8_t chanceOfGlitter)
   }
 }
 
-void rainbowWithGlitter()
+void rainbowWithGlitter(const PresetContext &ctx)
 {
   // built-in FastLED rainbow, plus some random sparkly glitter
-  rainbow();
+  rainbow(ctx);
   addGlitter(80);
 }
 
-void rainbowSolid()
+void rainbowSolid(const PresetContext &ctx)
 {
-  fill_solid(leds, NUM_LEDS, CHSV(gHue, 255, 255));
+  fill_solid(leds, NUM_LEDS, CHSV(ctx.hue, 255, 255));
+}
+
+void colourWavesInit()
+{
+  wavesPseudotime = 0;
+  wavesHue16 = 0;
 }
 
 // ColorWavesWithPalettes by Mark Kriegsman: https://gist.github.com/kriegsman/8281905786e8b2632aeb
 // This function draws color waves with an ever-changing,
 // widely-varying set of parameters, using a color palette.
-void colourWaves(CRGB *ledarray, uint16_t numleds, const CRGBPalette16 &palette)
+void colourWaves(CRGB *ledarray, uint16_t numleds, const CRGB *colours, uint16_t deltams)
 {
-  static uint16_t sPseudotime = 0;
-  static uint16_t sLastMillis = 0;
-  static uint16_t sHue16 = 0;
+  uint16_t &sPseudotime = wavesPseudotime;
+  uint16_t &sHue16 = wavesHue16;
 
   // uint8_t sat8 = beatsin88( 87, 220, 250);
   uint8_t brightdepth = beatsin88(341, 96, 224);
@@ -177,9 +268,6 @@ void colourWaves(CRGB *ledarray, uint16_t numleds, const CRGBPalette16 &palette)
   uint16_t hue16 = sHue16; //gHue * 256;
   uint16_t hueinc16 = beatsin88(113, 300, 1500);
 
-  uint16_t ms = millis();
-  uint16_t deltams = ms - sLastMillis;
-  sLastMillis = ms;
   sPseudotime += deltams * msmultiplier;
   sHue16 += deltams * beatsin88(400, 5, 9);
   uint16_t brightnesstheta16 = sPseudotime;
@@ -209,38 +297,46 @@ void colourWaves(CRGB *ledarray, uint16_t numleds, const CRGBPalette16 &palette)
     //index = triwave8( index);
     index = scale8(index, 240);
 
-    CRGB newcolor = ColorFromPalette(palette, index, bri8);
+    CRGB newcolor = paletteColour(colours, index, bri8);
 
     uint16_t pixelnumber = i;
     pixelnumber = (numleds - 1) - pixelnumber;
 
-    nblend(ledarray[pixelnumber], newcolor, 128);
+    presetRow[pixelnumber] = newcolor;
   }
+  swarBlend(ledarray, presetRow, numleds, 128);
 }
 
-void colourWaves()
+void colourWaves(const PresetContext &ctx)
 {
-  colourWaves(leds, NUM_LEDS, palettes[presetList[getConfig().presetIndex].paletteIndex]);
+  colourWaves(leds, NUM_LEDS, ctx.colours, ctx.delta);
 }
 
-void confetti()
+void confetti(const PresetContext &ctx)
 {
   // random colored speckles that blink in and fade smoothly
-  fadeToBlackBy(leds, NUM_LEDS, 10);
+  swarFade(leds, NUM_LEDS, 10);
   int pos = random16(NUM_LEDS);
   // leds[pos] += CHSV( gHue + random8(64), 200, 255);
   // leds[pos] += ColorFromPalette(palettes[currentPaletteIndex], gHue + random8(64));
-  leds[pos] += ColorFromPalette(palettes[presetList[getConfig().presetIndex].paletteIndex], gHue + random8(64));
+  leds[pos] += ctx.colours[(uint8_t)(ctx.hue + random8(64))];
+}
+
+int sinelonPos; // Where the dot was last frame
+
+void sinelonInit()
+{
+  sinelonPos = 0;
 }
 
-void sinelon()
+void sinelon(const PresetContext &ctx)
 {
   // a colored dot sweeping back and forth, with fading trails
-  fadeToBlackBy(leds, NUM_LEDS, presetList[getConfig().presetIndex].parms[1].values[2]);
-  int pos = beatsin16(presetList[getConfig().presetIndex].parms[0].values[2], 0, NUM_LEDS);
-  static int prevpos = 0;
+  swarFade(leds, NUM_LEDS, ctx.parms[1]);
+  int pos = beatsin16(ctx.parms[0], 0, NUM_LEDS);
+  int &prevpos = sinelonPos;
   // CRGB color = ColorFromPalette(palettes[currentPaletteIndex], gHue, 255);
-  CRGB color = ColorFromPalette(palettes[presetList[getConfig().presetIndex].paletteIndex], gHue, 255);
+  CRGB color = ctx.colours[ctx.hue];
   if (pos < prevpos)
   {
     fill_solid(leds + pos, (prevpos - pos) + 1, color);
@@ -252,29 +348,46 @@ void sinelon()
   prevpos = pos;
 }
 
-void bpm()
+void bpm(const PresetContext &ctx)
 {
   // colored stripes pulsing at a defined Beats-Per-Minute (BPM)
-  uint8_t beat = beatsin8(presetList[getConfig().presetIndex].parms[0].values[2], 64, 255);
+  uint8_t beat = beatsin8(ctx.parms[0], 64, 255);
   for (int i = 0; i < NUM_LEDS; i++)
   {
-    leds[i] = ColorFromPalette(palettes[presetList[getConfig().presetIndex].paletteIndex], gHue + (i * 2), beat - gHue + (i * 10));
+    leds[i] = paletteColour(ctx.colours, ctx.hue + (i * 2), beat - ctx.hue + (i * 10));
   }
 }
 
-void juggle()
+struct JuggleState
 {
-  static uint8_t numdots = 4;                // Number of dots in use.
-  static uint8_t faderate = 2;               // How long should the trails be. Very low value = longer trails.
-  static uint8_t hueinc = 255 / numdots - 1; // Incremental change in hue between each dot.
-  static uint8_t thishue = 0;                // Starting hue.
-  static uint8_t curhue = 0;                 // The current hue
-  static uint8_t thissat = 255;              // Saturation of the colour.
-  static uint8_t thisbright = 255;           // How bright should the LED/display be.
-  static uint8_t basebeat = 5;               // Higher = faster movement.
-
-  static uint8_t lastSecond = 99;              // Static variable, means it's only defined once. This is our 'debounce' variable.
-  uint8_t secondHand = (millis() / 1000) % 30; // IMPORTANT!!! Change '30' to a different value to change duration of the loop.
+  uint8_t numdots;    // Number of dots in use.
+  uint8_t faderate;   // How long should the trails be. Very low value = longer trails.
+  uint8_t hueinc;     // Incremental change in hue between each dot.
+  uint8_t thishue;    // Starting hue.
+  uint8_t basebeat;   // Higher = faster movement.
+  uint8_t lastSecond; // This is our 'debounce' variable.
+};
+
+JuggleState juggleState;
+
+void juggleInit()
+{
+  juggleState = {4, 2, 255 / 4 - 1, 0, 5, 99};
+}
+
+void juggle(const PresetContext &ctx)
+{
+  uint8_t &numdots = juggleState.numdots;
+  uint8_t &faderate = juggleState.faderate;
+  uint8_t &hueinc = juggleState.hueinc;
+  uint8_t &thishue = juggleState.thishue;
+  uint8_t curhue;                  // The current hue
+  const uint8_t thissat = 255;     // Saturation of the colour.
+  const uint8_t thisbright = 255;  // How bright should the LED/display be.
+  uint8_t &basebeat = juggleState.basebeat;
+
+  uint8_t &lastSecond = juggleState.lastSecond;
+  uint8_t secondHand = (ctx.now / 1000) % 30; // IMPORTANT!!! Change '30' to a different value to change duration of the loop.
 
   if (lastSecond != secondHand)
   { // Debounce to make sure we're not repeating an assignment.
@@ -309,32 +422,44 @@ void juggle()
 
   // Several colored dots, weaving in and out of sync with each other
   curhue = thishue; // Reset the hue values.
-  fadeToBlackBy(leds, NUM_LEDS, faderate);
+  swarFade(leds, NUM_LEDS, faderate);
   for (int i = 0; i < numdots; i++)
   {
     //beat16 is a FastLED 3.1 function
-    leds[beatsin16(basebeat + i + numdots, 0, NUM_LEDS)] += CHSV(gHue + curhue, thissat, thisbright);
+    leds[beatsin16(basebeat + i + numdots, 0, NUM_LEDS)] += CHSV(ctx.hue + curhue, thissat, thisbright);
     curhue += hueinc;
   }
 }
 
-// // based on FastLED example Fire2012WithPalette: https://github.com/FastLED/FastLED/blob/master/examples/Fire2012WithPalette/Fire2012WithPalette.ino
-void heatMap(CRGBPalette16 palette, bool up)
+// Array of temperature readings at each simulation cell
+byte heat[NUM_LEDS];
+
+/// Start fire from cold
+void fireInit()
 {
-  fill_solid(leds, NUM_LEDS, CRGB::Black);
+  memset(heat, 0, sizeof(heat));
+  expandPalette(fireColours, heatColours);
+}
 
-  // Add entropy to random number generator; we use a lot of it.
-  random16_add_entropy(random(256));
+/// Start water from cold
+void waterInit()
+{
+  memset(heat, 0, sizeof(heat));
+  expandPalette(waterColours, heatColours);
+}
 
-  // Array of temperature readings at each simulation cell
-  static byte heat[NUM_LEDS];
+// // based on FastLED example Fire2012WithPalette: https://github.com/FastLED/FastLED/blob/master/examples/Fire2012WithPalette/Fire2012WithPalette.ino
+void heatMap(const PresetContext &ctx, bool up)
+{
+  fill_solid(leds, NUM_LEDS, CRGB::Black);
 
   byte colorindex;
 
   // Step 1.  Cool down every cell a little
+  uint8_t cooling = ((ctx.parms[0] * 10) / NUM_LEDS) + 2;
   for (uint16_t i = 0; i < NUM_LEDS; i++)
   {
-    heat[i] = qsub8(heat[i], random8(0, ((presetList[getConfig().presetIndex].parms[0].values[2] * 10) / NUM_LEDS) + 2));
+    heat[i] = qsub8(heat[i], random8(0, cooling));
   }
 
   // Step 2.  Heat from each cell drifts 'up' and diffuses a little
@@ -344,7 +469,7 @@ void heatMap(CRGBPalette16 palette, bool up)
   }
 
   // Step 3.  Randomly ignite new 'sparks' of heat near the bottom
-  if (random8() < presetList[getConfig().presetIndex].parms[1].values[2])
+  if (random8() < ctx.parms[1])
   {
     int y = random8(7);
     heat[y] = qadd8(heat[y], random8(160, 255));
@@ -357,7 +482,7 @@ void heatMap(CRGBPalette16 palette, bool up)
     // for best results with color palettes.
     colorindex = scale8(heat[j], 190);
 
-    CRGB color = ColorFromPalette(palette, colorindex);
+    CRGB color = heatColours[colorindex];
 
     if (up)
     {
@@ -370,12 +495,70 @@ void heatMap(CRGBPalette16 palette, bool up)
   }
 }
 
-void fire()
+void fire(const PresetContext &ctx)
 {
-  heatMap(CRGBPalette16(CRGB::Black, CRGB::Red, CRGB::Yellow, CRGB::White), false);
+  heatMap(ctx, false);
 }
 
-void water()
+void water(const PresetContext &ctx)
 {
-  heatMap(CRGBPalette16(CRGB::Black, CRGB::Blue, CRGB::Aqua, CRGB::White), true);
+  heatMap(ctx, true);
+}
+
+/// The time for FastLED's beat functions - the time of the frame being drawn while a
+/// preset draws one, and millis() the rest of the time
+uint32_t get_millisecond_timer()
+{
+  return renderClock ? renderClock->now : millis();
+}
+
+/// Start a clock for drawing a preset's frames at a time of its own, beginning at start
+/// (ms), with its own random numbers starting from seed. The preset's init hook needs
+/// calling too, and the LEDs clearing, for it to draw the same frames every time.
+void startPresetClock(PresetClock &clock, uint32_t start, uint16_t seed)
+{
+  clock.now = clock.last = clock.hueMillis = start;
+  clock.hue = 0;
+  clock.seed = seed;
+  clock.live = false;
+}
+
+/// Draw a preset's frame for time now (ms) on its clock into leds[], with the preset's
+/// own parameters unless others are given. Returns the frame's load (see setFrameLoad()).
+uint32_t renderPreset(PresetInfo &preset, PresetClock &clock, uint32_t now, const int *parms)
+{
+  uint16_t liveSeed = 0;
+  uint32_t load = 0;
+
+  if (now - clock.hueMillis > 40)
+  {
+    clock.hueMillis = now;
+    clock.hue++;
+  }
+  // Look everything up once, rather than for every LED
+  uint8_t palette = preset.paletteIndex < 0 ? 0 : preset.paletteIndex;
+  PresetContext ctx = {palettes[palette], getPaletteColours(palette), {}, now, now - clock.last, clock.hue};
+  for (uint8_t i = 0; i < MAX_PARMS; i++)
+    ctx.parms[i] = parms ? parms[i] : preset.parms[i].values[2];
+  clock.now = clock.last = now;
+
+  if (clock.live)
+    random16_add_entropy(random(256)); // Fire and water use a lot of random numbers
+  else
+  { // Swap in the clock's random numbers while it draws
+    liveSeed = random16_get_seed();
+    random16_set_seed(clock.seed);
+  }
+  renderClock = &clock;
+  preset.presetfn(ctx);
+  renderClock = NULL;
+  if (!clock.live)
+  {
+    clock.seed = random16_get_seed();
+    random16_set_seed(liveSeed);
+  }
+  // Add up the load while the frame is still in the cache, rather than when it's sent
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+    load += pixelLoad(leds[i]);
+  return load;
 }
@@ -0,0 +1,216 @@
+#include "pixelstick.h"
+
+// Bitmap previews
+//
+// Uploaded bitmaps are kept in the native playback format, which a browser can't show,
+// so when the web page asks for one (the preview on the Images page) it is turned back
+// into a 24-bit BMP as it is sent. Native rows are in the order a bottom-up BMP keeps
+// them, so each is decoded, converted and sent in turn, and tiled images a tile's width
+// at a time, so the RAM needed doesn't depend on the size of the image. RGB888 images
+// were gamma corrected when they were uploaded, which can't be undone exactly for the
+// darkest colours, so each level becomes the middle of the levels that correct to it:
+// the preview may be a little off in the shadows, but every pixel in it is one the stick
+// plays the same as the original.
+
+#define PREVIEW_HEADER 54 // BMP file header and 40-byte DIB header
+#define PREVIEW_CHUNK 512 // Bytes sent at a time
+
+struct PreviewBuffers
+{
+  uint8_t palette[256][3];            // The palette of an indexed image, RGB
+  uint8_t ungamma[256];               // Undoes the gamma correction of RGB888 images
+  uint8_t rows[2][MAX_BMP_WIDTH * 3]; // The row being decoded and the one before it
+  uint8_t out[PREVIEW_CHUNK];         // BMP data waiting to be sent
+};
+
+typedef void (*PreviewWriter)(const uint8_t *buf, size_t len);
+
+extern const uint8_t gamma8[];
+
+uint16_t pixelRowBytes(uint8_t pixelFormat, uint16_t width);
+uint8_t pixelCodeBytes(uint8_t pixelFormat);
+bool decodeRow(File &file, const uint8_t *prev, uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes);
+
+PreviewBuffers *pvBuf;   // Allocated while a preview is being sent
+PreviewWriter pvWrite;   // Where it goes
+uint16_t pvUsed;         // Bytes in pvBuf->out
+uint32_t pvSent;         // Bytes of the BMP so far
+
+/// Size of each BMP row, padded to a multiple of 4 bytes
+uint32_t previewStride(const FileInfo &info)
+{
+  return ((uint32_t)info.bmpWidth * 3 + 3) & ~3;
+}
+
+/// Size of the BMP a native bitmap is sent as, or 0 if it can't be
+uint32_t previewSize(const FileInfo &info)
+{
+  if (info.status != VALID || info.fileType != FILE_NATIVE)
+    return 0;
+  if (info.compMethod != CODEC_TILES && info.rowBytes > sizeof(PreviewBuffers::rows[0]))
+    return 0;
+  return PREVIEW_HEADER + previewStride(info) * info.bmpHeight;
+}
+
+void previewBytes(const uint8_t *data, uint16_t len)
+{
+  while (len)
+  {
+    uint16_t n = len < PREVIEW_CHUNK - pvUsed ? len : PREVIEW_CHUNK - pvUsed;
+    memcpy(pvBuf->out + pvUsed, data, n);
+    pvUsed += n;
+    pvSent += n;
+    data += n;
+    len -= n;
+    if (pvUsed == PREVIEW_CHUNK)
+    {
+      pvWrite(pvBuf->out, pvUsed);
+      pvUsed = 0;
+    }
+  }
+}
+
+void preview16(uint16_t value)
+{
+  uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+  previewBytes(bytes, 2);
+}
+
+void preview32(uint32_t value)
+{
+  preview16(value);
+  preview16(value >> 16);
+}
+
+/// Convert count pixels of a native row to BMP pixels (BGR) and send them
+void previewPixels(const uint8_t *row, uint16_t count, uint8_t pixelFormat)
+{
+  for (uint16_t x = 0; x < count; x++)
+  {
+    const uint8_t *rgb;
+    uint8_t bgr[3];
+    uint16_t value;
+    switch (pixelFormat)
+    {
+    case PIXEL_RGB888:
+      rgb = row + x * 3;
+      bgr[0] = pvBuf->ungamma[rgb[2]];
+      bgr[1] = pvBuf->ungamma[rgb[1]];
+      bgr[2] = pvBuf->ungamma[rgb[0]];
+      break;
+    case PIXEL_RGB565:
+      value = row[x * 2] | (row[x * 2 + 1] << 8);
+      bgr[0] = (value & 0x1F) * 255 / 31;
+      bgr[1] = ((value >> 5) & 0x3F) * 255 / 63;
+      bgr[2] = (value >> 11) * 255 / 31;
+      break;
+    default:
+      rgb = pvBuf->palette[pixelFormat == PIXEL_INDEXED8 ? row[x] : (x & 1) ? row[x >> 1] & 0x0F : row[x >> 1] >> 4];
+      bgr[0] = rgb[2];
+      bgr[1] = rgb[1];
+      bgr[2] = rgb[0];
+      break;
+    }
+    previewBytes(bgr, 3);
+  }
+}
+
+/// Send zeros up to the given point in the BMP - the padding at the end of a row, or the
+/// rest of a row that couldn't be read
+void previewFill(uint32_t end)
+{
+  static const uint8_t zeros[16] = {};
+
+  while (pvSent < end)
+    previewBytes(zeros, end - pvSent < sizeof(zeros) ? end - pvSent : sizeof(zeros));
+}
+
+/// Send the next row of a tiled image: a row of each tile in the band it is in
+bool previewTileRow(File &file, const FileInfo &info, uint16_t y)
+{
+  uint16_t tilesAcross = (info.bmpWidth + TILE_SIZE - 1) / TILE_SIZE;
+  uint16_t tileRowBytes = pixelRowBytes(info.pixelFormat, TILE_SIZE);
+  uint32_t band = info.bmpImageoffset + (uint32_t)(y / TILE_SIZE) * tilesAcross * TILE_SIZE * tileRowBytes;
+
+  for (uint16_t tx = 0; tx < tilesAcross; tx++)
+  {
+    uint16_t count = info.bmpWidth - tx * TILE_SIZE < TILE_SIZE ? info.bmpWidth - tx * TILE_SIZE : TILE_SIZE;
+    uint32_t offset = band + ((uint32_t)tx * TILE_SIZE + y % TILE_SIZE) * tileRowBytes;
+    if (!file.seek(offset, SeekSet) || file.read(pvBuf->rows[0], tileRowBytes) != tileRowBytes)
+      return false;
+    previewPixels(pvBuf->rows[0], count, info.pixelFormat);
+  }
+  return true;
+}
+
+/// Send a native bitmap as a BMP, previewSize(info) bytes long, through write. If the
+/// file can't be read the rest of the image is sent black, so the size still holds, and
+/// it returns false.
+bool writePreview(const FileInfo &info, PreviewWriter write)
+{
+  File file;
+  bool ok = true;
+  uint8_t current = 0;
+  uint16_t paletteBytes = info.paletteColours * 3;
+
+  if (!previewSize(info) || !(pvBuf = (PreviewBuffers *)malloc(sizeof(PreviewBuffers))))
+    return false;
+  pvWrite = write;
+  pvUsed = 0;
+  pvSent = 0;
+  for (uint16_t v = 0, i = 0; v < 256; v++)
+  { // The middle of the levels that correct to v, or the next one up if none do
+    uint16_t start = i;
+    while (i < 256 && gamma8[i] <= v)
+      i++;
+    pvBuf->ungamma[v] = i > start ? (start + i - 1) / 2 : start < 256 ? start : 255;
+  }
+  memset(pvBuf->palette, 0, sizeof(pvBuf->palette));
+  memset(pvBuf->rows, 0, sizeof(pvBuf->rows));
+
+  previewBytes((const uint8_t *)"BM", 2);
+  preview32(previewSize(info));
+  preview32(0);
+  preview32(PREVIEW_HEADER);
+  preview32(40);
+  preview32(info.bmpWidth);
+  preview32(info.bmpHeight); // Bottom-up, as the native rows are
+  preview16(1);
+  preview16(24);
+  preview32(0); // BI_RGB
+  preview32(previewStride(info) * info.bmpHeight);
+  preview32(2835); // 72 DPI
+  preview32(2835);
+  preview32(0);
+  preview32(0);
+
+  if (!(file = LittleFS.open(info.path, "r")) || !file.seek(info.paletteOffset, SeekSet) ||
+      file.read(&pvBuf->palette[0][0], paletteBytes) != paletteBytes ||
+      !file.seek(info.bmpImageoffset, SeekSet))
+    ok = false;
+  for (uint16_t y = 0; y < info.bmpHeight; y++)
+  {
+    uint8_t *row = pvBuf->rows[current];
+    if (ok && info.compMethod == CODEC_TILES)
+      ok = previewTileRow(file, info, y);
+    else if (ok)
+    {
+      if (info.compMethod == CODEC_ROWS)
+        ok = decodeRow(file, pvBuf->rows[current ^ 1], row, info.rowBytes, pixelCodeBytes(info.pixelFormat));
+      else
+        ok = file.read(row, info.rowBytes) == info.rowBytes;
+      if (ok)
+        previewPixels(row, info.bmpWidth, info.pixelFormat);
+      current ^= 1;
+    }
+    previewFill(PREVIEW_HEADER + (y + 1) * previewStride(info)); // Black from here if it couldn't be read
+    yield();
+  }
+  if (pvUsed)
+    write(pvBuf->out, pvUsed);
+  if (file)
+    file.close();
+  free(pvBuf);
+  pvBuf = NULL;
+  return ok;
+}
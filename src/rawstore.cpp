@@ -0,0 +1,377 @@
+// Raw flash store for bitmaps
+//
+// An optional second copy of each uploaded bitmap kept in a reserved area of the flash,
+// outside LittleFS. Each image is one contiguous extent, so playback reads it with plain
+// SPI flash reads at a computed address - no file system blocks to look up, no metadata
+// to walk and no fragmentation. The first sector of the area is a small directory, kept
+// in RAM and written back when it changes. Space is allocated first fit, and if there
+// isn't a big enough gap the extents are slid down to close the gaps up. LittleFS still
+// holds the real file, so if the directory is lost or a copy can't be made the bitmap is
+// just played from there as normal.
+//
+// Define RAWSTORE_START and RAWSTORE_SIZE (flash offsets, multiples of the sector size)
+// in the build flags to use it - see platformio.ini. Build with RAWSTORE_HOST (and
+// PIXELSTICK_HOST) defined and the area is a plain file instead, so the allocator can
+// be tried out on a PC - see extras/rawstore.
+
+#include "pixelstick.h"
+
+#ifdef RAWSTORE_HOST
+#define FLASH_SECTOR 4096
+#ifndef RAWSTORE_SIZE
+#define RAWSTORE_SIZE 0x80000
+#endif
+#ifndef RAWSTORE_IMAGE
+#define RAWSTORE_IMAGE "rawstore.img" // The file standing in for the flash, in the current directory
+#endif
+#else
+#define FLASH_SECTOR SPI_FLASH_SEC_SIZE
+#endif
+
+#ifndef RAWSTORE_START
+#define RAWSTORE_START 0
+#endif
+#ifndef RAWSTORE_SIZE
+#define RAWSTORE_SIZE 0 // No store
+#endif
+
+#define RAWSTORE_SIGNATURE 0x31535252 // "RRS1"
+#define RAWSTORE_ENTRIES 32
+
+struct RawEntry
+{
+  char path[32];   // Bitmap this is a copy of, empty if the entry isn't in use
+  uint32_t offset; // Start of the extent from the start of the area, always a whole sector
+  uint32_t length; // Size of the file
+};
+
+struct RawDirectory
+{
+  uint32_t signature; // RAWSTORE_SIGNATURE
+  RawEntry entries[RAWSTORE_ENTRIES];
+};
+
+RawDirectory rawDir;
+int8_t rawWriting = -1; // Entry being written, which isn't in the directory on flash yet
+uint32_t rawWritePos;   // Where the next byte of it goes
+
+#ifdef RAWSTORE_HOST
+FILE *rawImage;
+RawFlashStats rawFlashStats;
+
+bool rawRead(uint32_t offset, void *buf, uint32_t len)
+{
+  rawFlashStats.readBytes += len;
+  return fseek(rawImage, offset, SEEK_SET) == 0 && fread(buf, 1, len, rawImage) == len;
+}
+
+bool rawWrite(uint32_t offset, const void *buf, uint32_t len)
+{
+  rawFlashStats.writtenBytes += len;
+  return fseek(rawImage, offset, SEEK_SET) == 0 && fwrite(buf, 1, len, rawImage) == len;
+}
+
+bool rawErase(uint32_t offset)
+{
+  uint8_t blank[FLASH_SECTOR];
+  memset(blank, 0xFF, sizeof(blank));
+  rawFlashStats.erases++;
+  rawFlashStats.writtenBytes -= sizeof(blank); // Counted as an erase, not a write
+  return rawWrite(offset, blank, sizeof(blank));
+}
+
+bool openRawArea()
+{
+  if (rawImage)
+    fclose(rawImage); // Opened again, as after a restart
+  if (!(rawImage = fopen(RAWSTORE_IMAGE, "r+b")) && !(rawImage = fopen(RAWSTORE_IMAGE, "w+b")))
+    return false;
+  fseek(rawImage, 0, SEEK_END);
+  for (uint32_t offset = ftell(rawImage) & ~(FLASH_SECTOR - 1); offset < RAWSTORE_SIZE; offset += FLASH_SECTOR)
+    rawErase(offset); // New file, so make it look like blank flash
+  return true;
+}
+#else
+bool rawRead(uint32_t offset, void *buf, uint32_t len)
+{
+  return ESP.flashRead(RAWSTORE_START + offset, (uint8_t *)buf, len);
+}
+
+bool rawWrite(uint32_t offset, const void *buf, uint32_t len)
+{
+  return ESP.flashWrite(RAWSTORE_START + offset, (const uint8_t *)buf, len);
+}
+
+bool rawErase(uint32_t offset)
+{
+  return ESP.flashEraseSector((RAWSTORE_START + offset) / FLASH_SECTOR);
+}
+
+bool openRawArea()
+{
+  return RAWSTORE_START + RAWSTORE_SIZE <= ESP.getFlashChipSize();
+}
+#endif
+
+/// Space taken by length bytes, rounded up to whole sectors
+uint32_t extentSize(uint32_t length)
+{
+  return (length + FLASH_SECTOR - 1) & ~(uint32_t)(FLASH_SECTOR - 1);
+}
+
+void saveRawDirectory()
+{
+  rawErase(0);
+  rawWrite(0, &rawDir, sizeof(rawDir));
+}
+
+/// Load the directory, or start an empty one if there isn't a valid one there
+void initRawStore()
+{
+  if (!RAWSTORE_SIZE)
+    return;
+  if (!openRawArea())
+  {
+    Serial.println(F("Raw flash store doesn't fit in the flash"));
+    return;
+  }
+  if (!rawRead(0, &rawDir, sizeof(rawDir)) || rawDir.signature != RAWSTORE_SIGNATURE)
+  {
+    memset(&rawDir, 0, sizeof(rawDir));
+    rawDir.signature = RAWSTORE_SIGNATURE;
+    saveRawDirectory();
+  }
+}
+
+/// Find the first gap of at least size bytes. Returns 0 if there isn't one.
+uint32_t findRawGap(uint32_t size)
+{
+  uint32_t pos = FLASH_SECTOR; // The directory has the first sector
+  bool moved = true;
+
+  while (moved)
+  { // Step past anything that overlaps, until nothing does
+    moved = false;
+    for (uint8_t i = 0; i < RAWSTORE_ENTRIES; i++)
+    {
+      RawEntry &entry = rawDir.entries[i];
+      uint32_t end = entry.offset + extentSize(entry.length);
+      if (entry.path[0] && entry.offset < pos + size && end > pos)
+      {
+        pos = end;
+        moved = true;
+      }
+    }
+  }
+  return pos + size <= RAWSTORE_SIZE ? pos : 0;
+}
+
+/// Total space not taken by any extent
+uint32_t rawFreeSpace()
+{
+  uint32_t used = FLASH_SECTOR; // The directory
+
+  for (uint8_t i = 0; i < RAWSTORE_ENTRIES; i++)
+    if (rawDir.entries[i].path[0])
+      used += extentSize(rawDir.entries[i].length);
+  return RAWSTORE_SIZE - used;
+}
+
+/// Slide the extents down to the start of the area so the free space is all in one piece.
+/// The directory is saved twice however many extents move - once with the extents that move
+/// taken out, so a power cut just loses those copies, and once at the end - as every
+/// save erases the first sector again.
+void compactRawStore()
+{
+  uint8_t *buf = (uint8_t *)malloc(FLASH_SECTOR);
+  uint8_t order[RAWSTORE_ENTRIES]; // Entries that move, lowest first
+  uint32_t from[RAWSTORE_ENTRIES]; // Where each of them was
+  uint8_t moves = 0;
+  uint32_t pos = FLASH_SECTOR;
+
+  if (!buf)
+    return;
+  while (true)
+  { // Work out where everything goes
+    int8_t next = -1; // The lowest extent that hasn't been dealt with yet
+    for (uint8_t i = 0; i < RAWSTORE_ENTRIES; i++)
+    {
+      RawEntry &entry = rawDir.entries[i];
+      if (entry.path[0] && entry.offset >= pos && (next < 0 || entry.offset < rawDir.entries[next].offset))
+        next = i;
+    }
+    if (next < 0)
+      break;
+    RawEntry &entry = rawDir.entries[next];
+    if (entry.offset != pos)
+    {
+      order[moves] = next;
+      from[moves++] = entry.offset;
+      entry.offset = pos;
+    }
+    pos += extentSize(entry.length);
+  }
+  if (moves)
+  {
+    RawDirectory *saved = (RawDirectory *)buf; // The directory without them, which fits in the sector buffer
+    memcpy(saved, &rawDir, sizeof(rawDir));
+    for (uint8_t m = 0; m < moves; m++)
+      memset(&saved->entries[order[m]], 0, sizeof(RawEntry));
+    rawErase(0);
+    rawWrite(0, saved, sizeof(*saved));
+    for (uint8_t m = 0; m < moves; m++)
+    {
+      RawEntry &entry = rawDir.entries[order[m]];
+      for (uint32_t done = 0; done < extentSize(entry.length); done += FLASH_SECTOR)
+      { // Always moving down, a sector at a time, so we never overwrite anything we still need
+        rawRead(from[m] + done, buf, FLASH_SECTOR);
+        rawErase(entry.offset + done);
+        rawWrite(entry.offset + done, buf, FLASH_SECTOR);
+        yield(); // Each sector takes tens of ms to erase and write, so let WiFi have a look in
+      }
+    }
+    saveRawDirectory();
+  }
+  free(buf);
+}
+
+/// Forget the copy of path - called when the file is replaced or deleted
+void rawStoreRemove(const char *path)
+{
+  bool changed = false;
+
+  for (uint8_t i = 0; i < RAWSTORE_ENTRIES; i++)
+  {
+    if (i != rawWriting && strcmp(rawDir.entries[i].path, path) == 0)
+    {
+      memset(&rawDir.entries[i], 0, sizeof(RawEntry));
+      changed = true;
+    }
+  }
+  if (changed)
+    saveRawDirectory();
+}
+
+/// Make room for a copy of length bytes of path, ready for rawStoreAppend().
+/// Returns false if there isn't room.
+bool rawStoreCreate(const char *path, uint32_t length)
+{
+  int8_t slot = -1;
+
+  if (!RAWSTORE_SIZE || rawWriting >= 0 || !length)
+    return false;
+  rawStoreRemove(path);
+  for (uint8_t i = 0; i < RAWSTORE_ENTRIES && slot < 0; i++)
+    if (!rawDir.entries[i].path[0])
+      slot = i;
+  if (slot < 0)
+    return false; // Directory is full
+  uint32_t offset = findRawGap(extentSize(length));
+  if (!offset)
+  {
+    if (rawFreeSpace() < extentSize(length))
+      return false; // Closing the gaps up wouldn't make enough room
+    compactRawStore();
+    if (!(offset = findRawGap(extentSize(length))))
+      return false;
+  }
+  for (uint32_t done = 0; done < extentSize(length); done += FLASH_SECTOR)
+  {
+    if (!rawErase(offset + done))
+      return false;
+    yield();
+  }
+  RawEntry &entry = rawDir.entries[slot];
+  strncpy(entry.path, path, sizeof(entry.path) - 1);
+  entry.offset = offset;
+  entry.length = length;
+  rawWriting = slot;
+  rawWritePos = offset;
+  return true;
+}
+
+void abandonRawEntry()
+{
+  memset(&rawDir.entries[rawWriting], 0, sizeof(RawEntry));
+  rawWriting = -1;
+}
+
+/// Add the next part of the file to the copy being written
+bool rawStoreAppend(const uint8_t *data, uint32_t len)
+{
+  if (rawWriting < 0)
+    return false;
+  RawEntry &entry = rawDir.entries[rawWriting];
+  if (rawWritePos + len > entry.offset + entry.length || !rawWrite(rawWritePos, data, len))
+  {
+    abandonRawEntry();
+    return false;
+  }
+  rawWritePos += len;
+  return true;
+}
+
+/// Finished writing the copy, so put it in the directory. Returns false if it's incomplete.
+bool rawStoreFinish()
+{
+  if (rawWriting < 0)
+    return false;
+  RawEntry &entry = rawDir.entries[rawWriting];
+  if (rawWritePos != entry.offset + entry.length)
+  {
+    abandonRawEntry();
+    return false;
+  }
+  rawWriting = -1;
+  saveRawDirectory();
+  return true;
+}
+
+/// Find the copy of path, which must be length bytes long. Returns where it is in the
+/// store, or 0 if there isn't a copy.
+uint32_t rawStoreFind(const char *path, uint32_t length)
+{
+  if (!RAWSTORE_SIZE)
+    return 0;
+  for (uint8_t i = 0; i < RAWSTORE_ENTRIES; i++)
+  {
+    RawEntry &entry = rawDir.entries[i];
+    if (i != rawWriting && entry.length == length && strcmp(entry.path, path) == 0)
+      return entry.offset;
+  }
+  return 0;
+}
+
+/// Read len bytes from offset in the store
+bool rawStoreRead(uint32_t offset, uint8_t *buf, uint32_t len)
+{
+  return rawRead(offset, buf, len);
+}
+
+/// Copy a bitmap into the store, if there's room, so it can be played without going
+/// through LittleFS
+void rawStoreImport(const char *path)
+{
+  File file;
+  uint8_t *buf;
+  int16_t len;
+
+  if (!RAWSTORE_SIZE || !(file = LittleFS.open(path, "r")))
+    return;
+  if (!(buf = (uint8_t *)malloc(FLASH_SECTOR)))
+  {
+    file.close();
+    return;
+  }
+  if (!rawStoreCreate(path, file.size()))
+    Serial.println(F("No room in the raw flash store"));
+  else
+  {
+    while ((len = file.read(buf, FLASH_SECTOR)) > 0 && rawStoreAppend(buf, len))
+      yield();
+    if (!rawStoreFinish())
+      Serial.println(F("Error copying bitmap to the raw flash store"));
+  }
+  free(buf);
+  file.close();
+}
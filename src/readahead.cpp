@@ -0,0 +1,212 @@
+#include "pixelstick.h"
+
+// Read-ahead engine for bitmap playback
+//
+// Image data is pulled from the file in whole, block aligned chunks into a RAM ring
+// buffer whenever there is idle time between frames. drawNextRow() then takes its rows
+// from RAM so the row tick never has to wait for LittleFS. If the ring runs dry the
+// data is read synchronously and the underrun is counted so it can be reported.
+// Anything that is in the RAM cache is copied from there instead, and the file isn't
+// opened until we need something that isn't, so a cached image can start straight away.
+// If the raw flash store has a copy of the file, that is read instead of the file.
+
+extern bool looping;
+
+CacheEntry *findCacheEntry(const char *path, uint32_t length);
+CacheEntry *newCacheEntry(const char *path, uint32_t length, uint32_t size);
+void releaseCacheEntry(CacheEntry *entry);
+uint32_t rawStoreFind(const char *path, uint32_t length);
+bool rawStoreRead(uint32_t offset, uint8_t *buf, uint32_t len);
+
+File streamFile;                         // The bitmap file being played, once it's been opened
+char streamPath[sizeof(FileInfo::path)]; // Path to the file
+CacheEntry *streamCache;                 // RAM copy of the image data, if we have one
+uint32_t streamRaw;                      // Where the file is in the raw flash store, 0 if it isn't
+uint8_t streamBuffer[READAHEAD_SIZE];    // The ring buffer
+uint16_t streamHead;                     // Index of the next byte to be consumed
+uint16_t streamCount;                    // Number of bytes waiting to be consumed
+uint32_t streamStart;                    // Offset of the image data in the file
+uint32_t streamEnd;                      // Offset of the end of the image data
+uint32_t streamPos;                      // Offset of the next byte to be read from the file
+uint16_t streamAlign = READAHEAD_SIZE / 2; // File reads end on a multiple of this
+RowStreamStats streamStats;
+
+/// Open the file and prepare to stream the image data from start to start + length
+bool openRowStream(const char *path, uint32_t start, uint32_t length)
+{
+  FSInfo fsinfo;
+
+  strlcpy(streamPath, path, sizeof(streamPath));
+  if (!(streamCache = findCacheEntry(path, length)))
+    streamCache = newCacheEntry(path, length, length); // Keep small images in RAM as they're read
+  if (streamCache)
+    streamCache->locked = true;
+  streamRaw = rawStoreFind(path, start + length); // Only native files are copied, and their image data runs to the end
+  if ((!streamCache || streamCache->loaded < length) && !streamRaw && !LittleFS.exists(path))
+  {
+    if (streamCache)
+      releaseCacheEntry(streamCache);
+    streamCache = NULL;
+    return false;
+  }
+  // Align reads with the file system blocks, but make sure we can always fit two reads in the buffer
+  LittleFS.info(fsinfo);
+  streamAlign = READAHEAD_SIZE / 2;
+  while (streamAlign > fsinfo.blockSize && streamAlign > 256)
+    streamAlign >>= 1;
+  streamStart = start;
+  streamEnd = start + length;
+  streamPos = start;
+  streamHead = 0;
+  streamCount = 0;
+  memset(&streamStats, 0, sizeof(streamStats));
+  return true;
+}
+
+void closeRowStream()
+{
+  if (streamFile)
+    streamFile.close();
+  if (streamCache)
+    releaseCacheEntry(streamCache);
+  streamCache = NULL;
+  streamCount = 0;
+}
+
+/// Copy len bytes of the image data, from the cache if it's there or the flash if not
+bool readImageData(uint8_t *buf, uint16_t len)
+{
+  uint32_t offset = streamPos - streamStart; // Where we are in the image data
+
+  if (streamCache && offset + len <= streamCache->loaded)
+  {
+    memcpy(buf, streamCache->data + offset, len);
+    streamStats.cachedBytes += len;
+    return true;
+  }
+  unsigned long start = micros();
+  if (streamRaw)
+  {
+    if (!rawStoreRead(streamRaw + streamPos, buf, len))
+      return false;
+  }
+  else
+  {
+    if (!streamFile && !(streamFile = LittleFS.open(streamPath, "r")))
+      return false;
+    if (streamFile.position() != streamPos)
+      streamFile.seek(streamPos, SeekSet);
+    if (streamFile.read(buf, len) != len)
+      return false;
+  }
+  unsigned long elapsed = micros() - start;
+  streamStats.refills++;
+  streamStats.bytesRead += len;
+  streamStats.refillMicros += elapsed;
+  if (elapsed > streamStats.maxRefillMicros)
+    streamStats.maxRefillMicros = elapsed;
+  if (streamCache && offset == streamCache->loaded && offset + len <= streamCache->capacity)
+  { // Next part of an image we're caching
+    memcpy(streamCache->data + offset, buf, len);
+    streamCache->loaded += len;
+  }
+  return true;
+}
+
+/// Read the next chunk of the file into the ring buffer. Returns false if there wasn't room
+/// for a full chunk or there is no more data to read.
+bool fillRowStream()
+{
+  if (streamPos >= streamEnd)
+  {
+    if (!looping)
+      return false; // Nothing left to read
+    streamPos = streamStart; // Start reading the image again
+  }
+  uint32_t chunk = streamAlign - (streamPos % streamAlign); // Read up to the next block boundary
+  if (chunk > streamEnd - streamPos)
+    chunk = streamEnd - streamPos;
+  if (chunk > (uint32_t)(READAHEAD_SIZE - streamCount))
+    return false; // Not enough room, wait until some rows have been used
+
+  uint16_t tail = (streamHead + streamCount) % READAHEAD_SIZE;
+  uint16_t first = chunk < (uint32_t)(READAHEAD_SIZE - tail) ? chunk : READAHEAD_SIZE - tail;
+  if (!readImageData(streamBuffer + tail, first))
+    return false;
+  streamPos += first;
+  streamCount += first;
+  if (first < chunk)
+  { // The chunk wrapped round the end of the buffer
+    if (!readImageData(streamBuffer, chunk - first))
+      return false;
+    streamPos += chunk - first;
+    streamCount += chunk - first;
+  }
+  return true;
+}
+
+/// Top up the ring buffer - called in the idle time between frames
+void serviceRowStream()
+{
+  fillRowStream(); // One chunk per call so the rest of the loop isn't held up
+}
+
+/// Load the start of the image data into the cache, ready for it to be played
+void preloadRowStream(const char *path, uint32_t start, uint32_t length)
+{
+  File file;
+  CacheEntry *entry = findCacheEntry(path, length);
+
+  if (!entry && !(entry = newCacheEntry(path, length, length <= BMP_CACHE_MAX / 2 ? length : BMP_PRELOAD_SIZE)))
+    return; // No room
+  uint32_t size = entry->capacity < BMP_PRELOAD_SIZE ? entry->capacity : BMP_PRELOAD_SIZE;
+  uint32_t raw = rawStoreFind(path, start + length);
+  if (entry->loaded >= size)
+    return; // Already there
+  if (raw)
+  {
+    if (rawStoreRead(raw + start + entry->loaded, entry->data + entry->loaded, size - entry->loaded))
+      entry->loaded = size;
+    return;
+  }
+  if (!(file = LittleFS.open(path, "r")))
+    return;
+  file.seek(start + entry->loaded, SeekSet);
+  entry->loaded += file.read(entry->data + entry->loaded, size - entry->loaded);
+  file.close();
+}
+
+/// Fill the ring buffer as far as possible before playback starts
+void primeRowStream()
+{
+  while (fillRowStream())
+    ;
+}
+
+/// Take len bytes of image data from the ring buffer, or skip them if buf is null.
+/// Returns false if the data has run out.
+bool readRowStream(uint8_t *buf, uint16_t len)
+{
+  if (streamCount < len)
+  { // The buffer has run dry, so we have to wait for the flash
+    streamStats.underruns++;
+    while (streamCount < len && fillRowStream())
+      ;
+    if (streamCount < len)
+      return false;
+  }
+  uint16_t first = len < READAHEAD_SIZE - streamHead ? len : READAHEAD_SIZE - streamHead;
+  if (buf)
+  {
+    memcpy(buf, streamBuffer + streamHead, first);
+    memcpy(buf + first, streamBuffer, len - first);
+  }
+  streamHead = (streamHead + len) % READAHEAD_SIZE;
+  streamCount -= len;
+  return true;
+}
+
+RowStreamStats &getRowStreamStats()
+{
+  return streamStats;
+}
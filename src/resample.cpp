@@ -0,0 +1,87 @@
+#include "pixelstick.h"
+
+// Width resampler for bitmap playback
+//
+// Images don't have to be the same width as the LED strip. When a bitmap is opened the
+// filter taps for every LED are worked out once, in 8-bit fixed point, so each row then
+// only needs a few multiply-adds per LED. Wider images are area averaged, so every
+// source pixel counts towards the LEDs it overlaps by as much as it overlaps them, and
+// narrower ones are linearly interpolated. An LED never has more than
+// MAX_BMP_WIDTH / NUM_LEDS + 2 taps, so the time taken for a row is bounded too.
+
+#define RESAMPLE_TAPS_MAX (MAX_BMP_WIDTH + 2 * NUM_LEDS) // Total taps for the worst case
+
+struct ResampleLed
+{
+  uint16_t first; // First source pixel used for this LED
+  uint8_t count;  // Number of source pixels used
+};
+
+ResampleLed resampleLeds[NUM_LEDS];
+uint16_t resampleWeights[RESAMPLE_TAPS_MAX]; // The weight of each tap, out of 256 for each LED
+
+/// Work out the filter taps for mapping a row of width pixels onto the LEDs
+void setupResample(uint16_t width)
+{
+  uint16_t tap = 0;
+
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+  {
+    ResampleLed &led = resampleLeds[i];
+    if (width > NUM_LEDS)
+    { // Area average - LED i covers i * width to (i + 1) * width, measured in 1/NUM_LEDS of a pixel
+      uint32_t start = (uint32_t)i * width;
+      uint32_t end = start + width;
+      uint16_t given = 0; // Weight given to the pixels so far, rounded so the total is exactly 256
+      led.first = start / NUM_LEDS;
+      led.count = 0;
+      for (uint32_t j = led.first; j * NUM_LEDS < end; j++)
+      {
+        uint32_t to = (j + 1) * NUM_LEDS < end ? (j + 1) * NUM_LEDS : end;
+        uint16_t total = ((to - start) * 256 + width / 2) / width;
+        resampleWeights[tap++] = total - given;
+        given = total;
+        led.count++;
+      }
+    }
+    else
+    { // Linear - the centre of LED i is at ((2i + 1) * width - NUM_LEDS) / (2 * NUM_LEDS) in the source
+      int32_t position = (int32_t)(2 * i + 1) * width - NUM_LEDS;
+      uint16_t scale = 2 * NUM_LEDS;
+      if (position < 0)
+        position = 0; // Clamp to the first pixel at the edge
+      led.first = position / scale;
+      uint16_t fraction = (position % scale) * 256 / scale;
+      if (led.first >= width - 1 || fraction == 0)
+      {
+        led.count = 1;
+        resampleWeights[tap++] = 256;
+      }
+      else
+      {
+        led.count = 2;
+        resampleWeights[tap++] = 256 - fraction;
+        resampleWeights[tap++] = fraction;
+      }
+    }
+  }
+}
+
+/// Resample a row of pixels onto the LEDs using the taps from setupResample()
+void resampleRow(const CRGB *src, CRGB *dst)
+{
+  const uint16_t *weight = resampleWeights;
+
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+  {
+    const CRGB *pixel = src + resampleLeds[i].first;
+    uint32_t r = 128, g = 128, b = 128; // Start at a half so the result is rounded
+    for (uint8_t n = resampleLeds[i].count; n; n--, pixel++, weight++)
+    {
+      r += pixel->r * *weight;
+      g += pixel->g * *weight;
+      b += pixel->b * *weight;
+    }
+    dst[i].setRGB(r >> 8, g >> 8, b >> 8);
+  }
+}
@@ -0,0 +1,54 @@
+#include "pixelstick.h"
+
+// Frame scheduler
+//
+// Each frame is due at an absolute deadline one row time after the last one, rather than
+// one row time after the previous frame happened to be drawn, so a frame that is drawn
+// late doesn't push all the others back and a bitmap is always painted at the same
+// length. Row times are in microseconds, so they don't have to be whole milliseconds.
+// When frames are missed the late policy says whether they are drawn back to back until
+// the schedule has caught up, or skipped.
+
+#define SCHEDULE_RESYNC 8 // If we fall this many frames behind, give up and restart the schedule
+
+uint32_t frameDeadline; // When the next frame is due
+FrameStats frameStats;
+
+/// Start a new schedule, with the first frame due one row time from now
+void startFrames()
+{
+  frameDeadline = micros() + getConfig().rowDisplayMicros;
+  memset(&frameStats, 0, sizeof(frameStats));
+}
+
+/// Returns true if it's time to draw the next frame, and works out when the one after is due
+bool frameDue()
+{
+  uint32_t period = getConfig().rowDisplayMicros;
+  uint32_t now = micros();
+  int32_t lateness = now - frameDeadline; // Signed so it still works when micros() wraps round
+
+  if (lateness < 0)
+    return false;
+  uint32_t behind = period ? lateness / period : 0; // Number of later deadlines that have also passed
+  frameStats.frames++;
+  frameStats.jitterTotal += lateness;
+  if ((uint32_t)lateness > frameStats.maxJitter)
+    frameStats.maxJitter = lateness;
+  if (behind)
+  {
+    frameStats.late++;
+    if (behind >= SCHEDULE_RESYNC || getConfig().latePolicy == SCHEDULE_DROP)
+    { // Skip the frames we've missed and carry on from the next deadline
+      frameStats.dropped += behind;
+      frameDeadline += behind * period;
+    }
+  }
+  frameDeadline += period;
+  return true;
+}
+
+FrameStats &getFrameStats()
+{
+  return frameStats;
+}
@@ -0,0 +1,168 @@
+#include "pixelstick.h"
+
+// Packed byte kernels
+//
+// The fades and blends the presets do every frame work on each of the 432 bytes of the
+// LEDs on their own. The ESP8266 has no SIMD instructions, but it has 32-bit registers,
+// so these do the same work four bytes at a time (SIMD within a register): bytes in
+// alternate lanes are spread out to 16 bits so they can be multiplied without running
+// into each other, and saturating adds and subtracts work out the carry out of each
+// byte separately. The results are exactly what FastLED's nscale8(), fadeToBlackBy(),
+// nblend() and CRGB +/- give, with FASTLED_SCALE8_FIXED and FASTLED_BLEND_FIXED set
+// as they are by default.
+//
+// The buffers must start on a 4-byte boundary (leds[] is aligned for this). Any bytes
+// left over after the last whole word are done one at a time.
+
+#define LANES_EVEN 0x00FF00FF // Bytes 0 and 2 of a word
+#define LANES_ODD 0xFF00FF00  // Bytes 1 and 3
+#define LANES_TOP 0x80808080  // Top bit of each byte
+#define LANES_LOW 0x7F7F7F7F  // The rest of each byte
+
+// Bytes of each of the three words holding four LEDs that belong to the LEDs whose bits
+// are set in the index (the lowest bit for the first LED)
+const uint32_t pixelMasks[16][3] = {
+    {0x00000000, 0x00000000, 0x00000000},
+    {0x00FFFFFF, 0x00000000, 0x00000000},
+    {0xFF000000, 0x0000FFFF, 0x00000000},
+    {0xFFFFFFFF, 0x0000FFFF, 0x00000000},
+    {0x00000000, 0xFFFF0000, 0x000000FF},
+    {0x00FFFFFF, 0xFFFF0000, 0x000000FF},
+    {0xFF000000, 0xFFFFFFFF, 0x000000FF},
+    {0xFFFFFFFF, 0xFFFFFFFF, 0x000000FF},
+    {0x00000000, 0x00000000, 0xFFFFFF00},
+    {0x00FFFFFF, 0x00000000, 0xFFFFFF00},
+    {0xFF000000, 0x0000FFFF, 0xFFFFFF00},
+    {0xFFFFFFFF, 0x0000FFFF, 0xFFFFFF00},
+    {0x00000000, 0xFFFF0000, 0xFFFFFFFF},
+    {0x00FFFFFF, 0xFFFF0000, 0xFFFFFFFF},
+    {0xFF000000, 0xFFFFFFFF, 0xFFFFFFFF},
+    {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF}};
+
+/// Each byte times k / 256, k from 1 to 256 - scale8() with the scale plus one
+inline uint32_t scaleWord(uint32_t w, uint16_t k)
+{
+  return (((w & LANES_EVEN) * k >> 8) & LANES_EVEN) | ((((w >> 8) & LANES_EVEN) * k) & LANES_ODD);
+}
+
+/// Each byte of a plus the same byte of b, stopping at 255 - qadd8()
+inline uint32_t addWord(uint32_t a, uint32_t b)
+{
+  uint32_t sum = ((a & LANES_LOW) + (b & LANES_LOW)) ^ ((a ^ b) & LANES_TOP);
+  uint32_t carry = ((a & b) | ((a | b) & ~sum)) & LANES_TOP;
+  return sum | ((carry >> 7) * 0xFF);
+}
+
+/// Each byte of a minus the same byte of b, stopping at 0 - qsub8()
+inline uint32_t subWord(uint32_t a, uint32_t b)
+{
+  uint32_t diff = ((a | LANES_TOP) - (b & LANES_LOW)) ^ ((a ^ ~b) & LANES_TOP);
+  uint32_t borrow = ((~a & b) | ((~a | b) & diff)) & LANES_TOP;
+  return diff & ~((borrow >> 7) * 0xFF);
+}
+
+/// Each byte of a blended with the same byte of b - blend8(), with keep 256 - amount and
+/// take amount + 1
+inline uint32_t blendWord(uint32_t a, uint32_t b, uint16_t keep, uint16_t take)
+{
+  uint32_t even = ((a & LANES_EVEN) * keep + (b & LANES_EVEN) * take) >> 8;
+  uint32_t odd = ((a >> 8) & LANES_EVEN) * keep + ((b >> 8) & LANES_EVEN) * take;
+  return (even & LANES_EVEN) | (odd & LANES_ODD);
+}
+
+/// Scale each LED by scale/256 - nscale8()
+void swarScale(CRGB *leds, uint16_t count, uint8_t scale)
+{
+  uint32_t *words = (uint32_t *)leds;
+  uint16_t bytes = count * 3;
+  uint16_t k = scale + 1;
+
+  for (uint16_t i = 0; i < bytes / 4; i++)
+    words[i] = scaleWord(words[i], k);
+  for (uint16_t i = bytes & ~3; i < bytes; i++)
+    ((uint8_t *)leds)[i] = ((uint8_t *)leds)[i] * k >> 8;
+}
+
+/// Fade each LED towards black by fade/256 - fadeToBlackBy()
+void swarFade(CRGB *leds, uint16_t count, uint8_t fade)
+{
+  swarScale(leds, count, 255 - fade);
+}
+
+/// Add src to dst, each channel stopping at 255 - CRGB +=
+void swarAdd(CRGB *dst, const CRGB *src, uint16_t count)
+{
+  uint32_t *d = (uint32_t *)dst;
+  const uint32_t *s = (const uint32_t *)src;
+  uint16_t bytes = count * 3;
+
+  for (uint16_t i = 0; i < bytes / 4; i++)
+    d[i] = addWord(d[i], s[i]);
+  for (uint16_t i = bytes & ~3; i < bytes; i++)
+    ((uint8_t *)dst)[i] = qadd8(((uint8_t *)dst)[i], ((const uint8_t *)src)[i]);
+}
+
+/// Take src from dst, each channel stopping at 0 - CRGB -=
+void swarSub(CRGB *dst, const CRGB *src, uint16_t count)
+{
+  uint32_t *d = (uint32_t *)dst;
+  const uint32_t *s = (const uint32_t *)src;
+  uint16_t bytes = count * 3;
+
+  for (uint16_t i = 0; i < bytes / 4; i++)
+    d[i] = subWord(d[i], s[i]);
+  for (uint16_t i = bytes & ~3; i < bytes; i++)
+    ((uint8_t *)dst)[i] = qsub8(((uint8_t *)dst)[i], ((const uint8_t *)src)[i]);
+}
+
+/// Blend src into dst, amount/256 of the way - nblend()
+void swarBlend(CRGB *dst, const CRGB *src, uint16_t count, uint8_t amount)
+{
+  uint32_t *d = (uint32_t *)dst;
+  const uint32_t *s = (const uint32_t *)src;
+  uint16_t bytes = count * 3;
+  uint16_t keep = 256 - amount;
+  uint16_t take = amount + 1;
+
+  if (amount == 0)
+    return;
+  if (amount == 255)
+  {
+    memcpy(dst, src, bytes);
+    return;
+  }
+  for (uint16_t i = 0; i < bytes / 4; i++)
+    d[i] = blendWord(d[i], s[i], keep, take);
+  for (uint16_t i = bytes & ~3; i < bytes; i++)
+    ((uint8_t *)dst)[i] = blend8(((uint8_t *)dst)[i], ((const uint8_t *)src)[i], amount);
+}
+
+/// Make the LEDs whose bits are set in brighter (a bit per LED, lowest bit first) brighter
+/// by up/256 - c + c.nscale8(up) - and the rest darker by down/256 - c.nscale8(255 - down).
+/// Both are worked out for four LEDs (three words) at a time and the right one picked
+/// for each LED with a mask.
+void swarBrightenOrDarken(CRGB *leds, uint16_t count, const uint8_t *brighter, uint8_t up, uint8_t down)
+{
+  uint32_t *words = (uint32_t *)leds;
+  uint16_t kUp = up + 1;
+  uint16_t kDown = 256 - down;
+  uint16_t group;
+
+  for (group = 0; group < count / 4; group++, words += 3)
+  {
+    const uint32_t *mask = pixelMasks[(brighter[group / 2] >> ((group & 1) * 4)) & 0x0F];
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      uint32_t w = words[i];
+      words[i] = (addWord(w, scaleWord(w, kUp)) & mask[i]) | (scaleWord(w, kDown) & ~mask[i]);
+    }
+  }
+  for (uint16_t i = group * 4; i < count; i++)
+  {
+    CRGB &c = leds[i];
+    if (brighter[i / 8] & (1 << (i & 7)))
+      c.setRGB(qadd8(c.r, c.r * kUp >> 8), qadd8(c.g, c.g * kUp >> 8), qadd8(c.b, c.b * kUp >> 8));
+    else
+      c.setRGB(c.r * kDown >> 8, c.g * kDown >> 8, c.b * kDown >> 8);
+  }
+}
@@ -0,0 +1,191 @@
+#include "pixelstick.h"
+
+// Tiled bitmap playback
+//
+// Tiled files hold the image as TILE_SIZE x TILE_SIZE squares rather than rows, so any
+// row or column can be got at by reading just the tiles it crosses. An image can then be
+// played a column at a time (so it doesn't have to be rotated before it is uploaded),
+// and images much bigger than the strip can be shown through a viewport - a window the
+// length of the strip, which can be moved while the image is playing. All the tiles are
+// the same size, so finding one in the file is just arithmetic. A small cache holds the
+// tiles for the current line and, read in the idle time between frames, the ones the
+// next band of lines will need. Pixels are shown one to one, not resampled. The cache
+// is only as big as the heap allows: if there isn't room for the next band too, the
+// tiles are just read as they're needed.
+
+#define TILE_VIEW (NUM_LEDS / TILE_SIZE + 1) // Most tiles a line through the viewport can cross
+#define TILE_SLOTS (2 * TILE_VIEW)           // Room for this band and the next, if there's the memory
+
+struct TileSlot
+{
+  uint16_t tx;       // Which tile is in the slot
+  uint16_t ty;
+  uint32_t lastUsed; // When the slot was last used, for throwing out the least recently used
+  bool loaded;
+};
+
+void expandRow(const uint8_t *src, CRGB *dst, uint16_t width, uint8_t pixelFormat);
+uint16_t pixelRowBytes(uint8_t pixelFormat, uint16_t width);
+uint32_t rawStoreFind(const char *path, uint32_t length);
+bool rawStoreRead(uint32_t offset, uint8_t *buf, uint32_t len);
+
+extern CRGB bmpPalette[];
+extern WebSocketsServer ws;
+
+File tileFile;            // The bitmap, if it isn't in the raw flash store
+uint32_t tileRaw;         // Where the file is in the raw flash store, 0 if it isn't
+FileInfo tileInfo;        // The bitmap being played
+bool tileColumns;         // Playing it a column at a time
+uint16_t tilesAcross;     // Number of tiles in each band
+uint16_t tileRowBytes;    // Size of a row of a tile
+uint16_t tileBytes;       // Size of a tile
+uint8_t *tileData;        // tileSlotCount tiles, allocated while a tiled bitmap is being played
+TileSlot tileSlots[TILE_SLOTS];
+uint8_t tileSlotCount;    // Slots there was room for
+uint32_t tileClock;       // Bumped for each line, for working out which slot was used least recently
+int32_t tileNextBand;     // First line of the next band, whose tiles are read ahead, or -1
+uint8_t tilePrefetched;   // Number of the next band's tiles dealt with so far
+
+/// Get ready to play a tiled bitmap
+bool openTiles(const FileInfo &info)
+{
+  tileInfo = info;
+  tileColumns = getConfig().scanColumns; // Changes to the scan axis wait until the bitmap is next started
+  tilesAcross = (info.bmpWidth + TILE_SIZE - 1) / TILE_SIZE;
+  tileRowBytes = pixelRowBytes(info.pixelFormat, TILE_SIZE);
+  tileBytes = TILE_SIZE * tileRowBytes;
+  uint32_t room = ESP.getFreeHeap() > TILE_CACHE_RESERVE ? ESP.getFreeHeap() - TILE_CACHE_RESERVE : 0;
+  if (room > ESP.getMaxFreeBlockSize())
+    room = ESP.getMaxFreeBlockSize(); // It has to be in one piece
+  tileSlotCount = room / tileBytes < TILE_SLOTS ? room / tileBytes : TILE_SLOTS;
+  if (tileSlotCount < TILE_VIEW || !(tileData = (uint8_t *)malloc(tileSlotCount * tileBytes)))
+  { // Without a line's worth of tiles every one would be read again for every line
+    Serial.println(F("Not enough memory for the tile cache"));
+    ws.broadcastTXT("?Not enough memory to play this tiled bitmap");
+    return false;
+  }
+  if (!(tileRaw = rawStoreFind(info.path, info.fileSize)) && !(tileFile = LittleFS.open(info.path, "r")))
+  {
+    free(tileData);
+    tileData = NULL;
+    return false;
+  }
+  memset(tileSlots, 0, sizeof(tileSlots));
+  tileNextBand = -1;
+  return true;
+}
+
+void closeTiles()
+{
+  if (tileFile)
+    tileFile.close();
+  free(tileData);
+  tileData = NULL;
+}
+
+/// Find tile (tx, ty) in the cache, reading it in if it isn't there. Returns NULL if it
+/// can't be read.
+const uint8_t *getTile(uint16_t tx, uint16_t ty)
+{
+  TileSlot *oldest = tileSlots;
+
+  for (uint8_t i = 0; i < tileSlotCount; i++)
+  {
+    TileSlot &slot = tileSlots[i];
+    if (slot.loaded && slot.tx == tx && slot.ty == ty)
+    {
+      slot.lastUsed = tileClock;
+      return tileData + i * tileBytes;
+    }
+    if (!slot.loaded || (oldest->loaded && slot.lastUsed < oldest->lastUsed))
+      oldest = &slot;
+  }
+  uint8_t *data = tileData + (oldest - tileSlots) * tileBytes;
+  uint32_t offset = tileInfo.bmpImageoffset + ((uint32_t)ty * tilesAcross + tx) * tileBytes;
+  oldest->loaded = false;
+  if (tileRaw)
+  {
+    if (!rawStoreRead(tileRaw + offset, data, tileBytes))
+      return NULL;
+  }
+  else if (!tileFile.seek(offset, SeekSet) || tileFile.read(data, tileBytes) != tileBytes)
+    return NULL;
+  oldest->tx = tx;
+  oldest->ty = ty;
+  oldest->lastUsed = tileClock;
+  oldest->loaded = true;
+  return data;
+}
+
+/// Number of lines in the image along the scan axis
+uint16_t tileLines()
+{
+  return tileColumns ? tileInfo.bmpWidth : tileInfo.bmpHeight;
+}
+
+/// Length of each line
+uint16_t tileLineLength()
+{
+  return tileColumns ? tileInfo.bmpHeight : tileInfo.bmpWidth;
+}
+
+/// Read line (a row or a column, depending on the scan axis) through the viewport into dst
+bool readTileLine(uint16_t line, CRGB *dst)
+{
+  bool columns = tileColumns;
+  uint32_t length = tileLineLength();
+  const uint8_t *tile = NULL;
+  uint16_t tileAt = 0xFFFF; // Position along the line of the tile we have
+
+  tileClock++;
+  for (uint16_t i = 0; i < NUM_LEDS; i++)
+  {
+    uint32_t p = (uint32_t)getConfig().viewport + i;
+    if (p >= length)
+    { // Past the end of the image
+      dst[i] = CRGB::Black;
+      continue;
+    }
+    if (p / TILE_SIZE != tileAt)
+    {
+      tileAt = p / TILE_SIZE;
+      if (!(tile = columns ? getTile(line / TILE_SIZE, tileAt) : getTile(tileAt, line / TILE_SIZE)))
+        return false;
+    }
+    uint8_t x = columns ? line % TILE_SIZE : p % TILE_SIZE;
+    const uint8_t *row = tile + (columns ? p % TILE_SIZE : line % TILE_SIZE) * tileRowBytes;
+    if (tileInfo.pixelFormat == PIXEL_INDEXED4)
+      dst[i] = bmpPalette[(x & 1) ? row[x >> 1] & 0x0F : row[x >> 1] >> 4];
+    else
+      expandRow(row + pixelRowBytes(tileInfo.pixelFormat, x), dst + i, 1, tileInfo.pixelFormat);
+  }
+  int32_t next = line - line % TILE_SIZE + TILE_SIZE;
+  next = next < tileLines() ? next : 0; // The first band, in case we're looping
+  if (next != tileNextBand)
+  {
+    tileNextBand = next;
+    tilePrefetched = 0;
+  }
+  return true;
+}
+
+/// Read one of the tiles the next band of lines will need, if it isn't already here -
+/// called in the idle time between frames
+void serviceTiles()
+{
+  if (!tileData || tileNextBand < 0 || tileSlotCount < TILE_SLOTS)
+    return; // Nothing to do, or no room to read ahead without throwing out tiles that are still needed
+  uint32_t length = tileLineLength();
+  uint32_t start = getConfig().viewport;
+  uint32_t end = start + NUM_LEDS < length ? start + NUM_LEDS : length;
+  uint16_t count = end > start ? (end - 1) / TILE_SIZE - start / TILE_SIZE + 1 : 0;
+
+  if (tilePrefetched >= count)
+    return; // All there
+  uint16_t along = start / TILE_SIZE + tilePrefetched++;
+  uint16_t band = tileNextBand / TILE_SIZE;
+  if (tileColumns)
+    getTile(band, along);
+  else
+    getTile(along, band);
+}
@@ -0,0 +1,684 @@
+#include "pixelstick.h"
+
+// Streaming BMP transcoder
+//
+// Bitmaps are converted to the native playback format as they are uploaded, so the
+// original file never has to be stored. The header is parsed as soon as it has arrived
+// and anything we can't play is rejected before a byte is written to flash. The pixel
+// data is then converted and compressed one row at a time, so the RAM needed doesn't
+// depend on the size of the image. The buffers are only allocated while an upload is
+// in progress. Images are kept at the depth they were uploaded at where we can play
+// them that way: 4 and 8-bit images stay indexed and 16-bit ones become RGB565, which
+// cuts the data read for each row by up to 5/6. Their colours are gamma corrected
+// through a lookup table when they are played.
+//
+// The power each row will draw is worked out as it is converted, and kept as a profile
+// in the file, so the power limiter doesn't have to add it up as the image is played.
+//
+// Images too wide to be played a row at a time (and all images, if the user has asked
+// for it) are tiled instead. Their rows are written out uncompressed, a tile's width at
+// a time so they don't have to fit in RAM, and then cut up into tiles once the upload
+// is complete.
+
+#define TRANSCODE_HEADER_MAX 1280 // Enough for a BITMAPV5HEADER, bit field masks and a 256 colour palette
+
+#define BI_RGB 0
+#define BI_RLE8 1
+#define BI_RLE4 2
+#define BI_BITFIELDS 3
+
+// States for decoding RLE8/RLE4 pixel data
+enum RleState
+{
+  RLE_COUNT,    // Expecting the count for a run, or 0 for an escape
+  RLE_VALUE,    // Expecting the pixel value(s) for a run
+  RLE_ESCAPE,   // Expecting end of line, end of bitmap, delta or the length of an absolute run
+  RLE_ABSOLUTE, // Receiving the pixels of an absolute run
+  RLE_DELTA_X,  // Expecting the horizontal offset of a delta
+  RLE_DELTA_Y,  // Expecting the vertical offset of a delta
+  RLE_END       // End of bitmap seen
+};
+
+struct TranscodeBuffers
+{
+  uint8_t header[TRANSCODE_HEADER_MAX]; // BMP headers and palette
+  uint8_t row[MAX_BMP_WIDTH * 4];       // One row of BMP pixel data
+  uint8_t palette[256][3];              // Palette for 4 and 8-bit images, RGB
+  uint8_t pixels[MAX_BMP_WIDTH * 3];    // The row converted to native format
+  uint8_t prev[MAX_BMP_WIDTH * 3];      // The previous row, for the LZ codec
+  uint8_t coded[ROW_CODE_MAX];          // The row compressed
+  uint8_t scratch[ROW_CODE_MAX];        // Working space for the encoder
+  uint8_t profile[POWER_PROFILE_MAX];   // Power profile, in playback order
+};
+
+extern const uint8_t gamma8[];
+extern FileInfo currentFile;
+
+void getBmpInfo(char *path);
+void updateBmpIndex(const char *path);
+void dropCacheEntries(const char *path);
+void rawStoreImport(const char *path);
+uint16_t encodeRow(const uint8_t *prev, const uint8_t *row, uint16_t rowBytes, uint8_t pixelBytes, uint8_t *out, uint8_t *scratch);
+uint16_t pixelRowBytes(uint8_t pixelFormat, uint16_t width);
+uint8_t pixelCodeBytes(uint8_t pixelFormat);
+uint32_t pixelLoad(uint8_t r, uint8_t g, uint8_t b);
+
+TranscodeBuffers *tcBuf;                 // Allocated for the duration of an upload
+File tcFile;                             // The native file being written
+char tcPath[sizeof(FileInfo::path)];     // Final path for the file
+char tcTempPath[sizeof(FileInfo::path)]; // Path used while the file is being written
+uint32_t tcMasks[3];                     // Red, green and blue bit masks for 16 and 32-bit images
+uint8_t tcShifts[3];                     // Position of each mask
+uint8_t tcBits[3];                       // Width of each mask
+uint32_t tcPos;                          // Number of bytes received so far
+uint32_t tcDataOffset;                   // Start of the pixel data in the BMP file
+uint16_t tcRowPos;                       // Number of bytes of the current row received so far
+uint16_t tcStride;                       // Size of a padded BMP row
+uint16_t tcRows;                         // Number of rows converted so far
+uint16_t tcWidth;
+uint16_t tcHeight;
+uint16_t tcBitDepth;
+uint32_t tcCompression;
+uint8_t tcFormat;     // Native pixel format the image is being converted to
+uint16_t tcRowBytes;  // Size of a converted row
+uint16_t tcColours;   // Number of colours in the palette
+uint32_t tcRowsStart; // Start of the rows in the native file
+uint16_t tcPowerStep; // Rows covered by each entry of the power profile, 0 if there isn't one
+uint16_t tcPowerEntries; // Entries in the power profile
+bool tcTopDown;      // Rows are stored top first, so they have to be reversed before playback
+bool tcTiled;        // The image is to be tiled once it has all arrived
+bool tcHeaderParsed; // Headers done, now receiving pixels
+uint16_t tcStatus;   // Bitmap file status
+RleState tcRleState;
+uint8_t tcRleCount;   // Pixels left in the current run
+uint8_t tcRleBytes;   // Bytes left in the current absolute run, including padding
+uint8_t tcDeltaX;     // Horizontal offset of a delta
+uint16_t tcX;         // Current pixel in an RLE row
+
+uint16_t get16(const uint8_t *p) // Get a 2-byte int from the header (little-endian)
+{
+  return p[0] | (p[1] << 8);
+}
+
+uint32_t get32(const uint8_t *p) // Get a 4-byte int from the header (little-endian)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/// Work out the position and width of a colour mask
+void setMask(uint8_t i, uint32_t mask)
+{
+  tcMasks[i] = mask;
+  tcShifts[i] = 0;
+  tcBits[i] = 0;
+  if (!mask)
+    return;
+  while (!(mask & 1))
+  {
+    mask >>= 1;
+    tcShifts[i]++;
+  }
+  while (mask & 1)
+  {
+    mask >>= 1;
+    tcBits[i]++;
+  }
+}
+
+/// Extract a colour from a 16 or 32-bit pixel and scale it to 8 bits
+uint8_t getChannel(uint32_t pixel, uint8_t i)
+{
+  if (!tcBits[i])
+    return 0;
+  uint32_t value = (pixel & tcMasks[i]) >> tcShifts[i];
+  if (tcBits[i] >= 8)
+    return value >> (tcBits[i] - 8);
+  return value * 255 / ((1 << tcBits[i]) - 1);
+}
+
+/// Write the native header, followed by the palette for indexed images
+void writeHeader(File &f, uint8_t codec)
+{
+  NativeHeader header;
+  memset(&header, 0, sizeof(header));
+  header.signature = NATIVE_SIGNATURE;
+  header.version = NATIVE_VERSION;
+  header.pixelFormat = tcFormat;
+  header.width = tcWidth;
+  header.height = tcHeight;
+  header.dataOffset = tcRowsStart;
+  header.codec = codec;
+  header.powerStep = codec == CODEC_TILES ? 0 : tcPowerStep;
+  f.write((uint8_t *)&header, sizeof(header));
+  f.write(&tcBuf->palette[0][0], tcColours * 3);
+  if (header.powerStep)
+    f.write(tcBuf->profile, tcPowerEntries);
+}
+
+/// Check the headers and, if we can play the image, start writing the native file
+bool parseHeader()
+{
+  uint8_t *bmpHeader = tcBuf->header;
+  uint32_t dibSize = get32(bmpHeader + 14);
+  int32_t width = get32(bmpHeader + 18);
+  int32_t height = get32(bmpHeader + 22);
+  uint16_t planes = get16(bmpHeader + 26);
+  uint32_t paletteSize = get32(bmpHeader + 46);
+  uint32_t headerEnd = tcDataOffset < TRANSCODE_HEADER_MAX ? tcDataOffset : TRANSCODE_HEADER_MAX;
+
+  tcBitDepth = get16(bmpHeader + 28);
+  tcCompression = get32(bmpHeader + 30);
+  if (dibSize < 40) // Old OS/2 style headers aren't supported
+    tcStatus |= BAD_SIGNATURE;
+  if (planes != 1)
+    tcStatus |= BAD_PLANES;
+  tcTopDown = height < 0;
+  if (tcTopDown)
+    height = -height;
+  if (width <= 0 || width > MAX_TILED_WIDTH || height == 0 || height > 0xFFFF)
+    tcStatus |= BAD_SIZE;
+  tcTiled = width > MAX_BMP_WIDTH || getConfig().tileUploads;
+  if (width > MAX_BMP_WIDTH && tcCompression != BI_RGB && tcCompression != BI_BITFIELDS)
+    tcStatus |= BAD_COMPRESSION; // RLE rows have to fit in the row buffer
+
+  switch (tcBitDepth)
+  {
+  case 4:
+  case 8:
+    if (tcCompression != BI_RGB && tcCompression != (tcBitDepth == 8 ? BI_RLE8 : BI_RLE4))
+      tcStatus |= BAD_COMPRESSION;
+    if (tcCompression != BI_RGB && tcTopDown) // RLE images can only be stored bottom-up
+      tcStatus |= BAD_COMPRESSION;
+    if (paletteSize == 0 || paletteSize > (1U << tcBitDepth))
+      paletteSize = 1 << tcBitDepth;
+    if (14 + dibSize + paletteSize * 4 > headerEnd)
+    {
+      tcStatus |= BAD_SIGNATURE; // The palette is missing or somewhere we can't get at it
+      break;
+    }
+    memset(tcBuf->palette, 0, sizeof(tcBuf->palette));
+    for (uint16_t i = 0; i < paletteSize; i++)
+    { // Palette entries are BGRX
+      const uint8_t *entry = bmpHeader + 14 + dibSize + i * 4;
+      tcBuf->palette[i][0] = entry[2];
+      tcBuf->palette[i][1] = entry[1];
+      tcBuf->palette[i][2] = entry[0];
+    }
+    tcFormat = tcBitDepth == 8 ? PIXEL_INDEXED8 : PIXEL_INDEXED4;
+    tcColours = 1 << tcBitDepth;
+    break;
+  case 16:
+  case 32:
+    if (tcCompression == BI_BITFIELDS)
+    { // The masks follow a 40-byte header and are part of the V2 and later headers - either way at offset 54
+      if (54 + 12 > headerEnd)
+      {
+        tcStatus |= BAD_COMPRESSION;
+        break;
+      }
+      setMask(0, get32(bmpHeader + 54));
+      setMask(1, get32(bmpHeader + 58));
+      setMask(2, get32(bmpHeader + 62));
+    }
+    else if (tcCompression == BI_RGB)
+    {
+      if (tcBitDepth == 16) // X1R5G5B5
+      {
+        setMask(0, 0x7C00);
+        setMask(1, 0x03E0);
+        setMask(2, 0x001F);
+      }
+      else // X8R8G8B8
+      {
+        setMask(0, 0x00FF0000);
+        setMask(1, 0x0000FF00);
+        setMask(2, 0x000000FF);
+      }
+    }
+    else
+      tcStatus |= BAD_COMPRESSION;
+    tcFormat = tcBitDepth == 16 ? PIXEL_RGB565 : PIXEL_RGB888;
+    break;
+  case 24:
+    if (tcCompression != BI_RGB)
+      tcStatus |= BAD_COMPRESSION;
+    break;
+  default:
+    tcStatus |= BAD_BITDEPTH;
+  }
+  if (tcStatus != VALID)
+    return false;
+
+  tcWidth = width;
+  tcHeight = height;
+  tcStride = ((tcWidth * tcBitDepth + 31) / 32) * 4;
+  tcRowBytes = pixelRowBytes(tcFormat, tcWidth);
+  tcPowerStep = tcTiled ? 0 : (tcHeight + POWER_PROFILE_MAX - 1) / POWER_PROFILE_MAX; // Tiles aren't played in rows
+  tcPowerEntries = tcTiled ? 0 : (tcHeight + tcPowerStep - 1) / tcPowerStep;
+  tcRowsStart = sizeof(NativeHeader) + tcColours * 3 + tcPowerEntries;
+  memset(tcBuf->profile, 0, sizeof(tcBuf->profile));
+
+  if (!(tcFile = LittleFS.open(tcTempPath, "w")))
+  {
+    tcStatus |= OPEN_ERROR;
+    return false;
+  }
+  // Top-down and tiled images are kept uncompressed until they've been put in playback order
+  writeHeader(tcFile, tcTopDown || tcTiled ? CODEC_NONE : CODEC_ROWS);
+  memset(tcBuf->pixels, 0, sizeof(tcBuf->pixels));
+  memset(tcBuf->prev, 0, sizeof(tcBuf->prev));
+  return true;
+}
+
+/// Compress the converted row and write it to the file
+void outputRow()
+{
+  if (tcTopDown || tcTiled)
+  {
+    tcFile.write(tcBuf->pixels, tcRowBytes);
+    return;
+  }
+  uint16_t length = encodeRow(tcBuf->prev, tcBuf->pixels, tcRowBytes, pixelCodeBytes(tcFormat), tcBuf->coded, tcBuf->scratch);
+  tcFile.write(tcBuf->coded, length);
+  memcpy(tcBuf->prev, tcBuf->pixels, tcRowBytes);
+}
+
+/// Add the power the converted row will draw to the power profile
+void measureRow()
+{
+  const uint8_t *p = tcBuf->pixels;
+  uint32_t load = 0;
+  uint16_t value;
+
+  if (!tcPowerStep)
+    return;
+  for (uint16_t x = 0; x < tcWidth; x++)
+  {
+    switch (tcFormat)
+    {
+    case PIXEL_RGB888:
+      load += pixelLoad(p[0], p[1], p[2]); // Already gamma corrected
+      p += 3;
+      break;
+    case PIXEL_RGB565:
+      value = p[0] | (p[1] << 8);
+      load += pixelLoad(gamma8[(value >> 11) * 255 / 31], gamma8[((value >> 5) & 0x3F) * 255 / 63], gamma8[(value & 0x1F) * 255 / 31]);
+      p += 2;
+      break;
+    case PIXEL_INDEXED8:
+    case PIXEL_INDEXED4:
+      value = tcFormat == PIXEL_INDEXED8 ? p[x] : (x & 1) ? p[x >> 1] & 0x0F : p[x >> 1] >> 4;
+      load += pixelLoad(gamma8[tcBuf->palette[value][0]], gamma8[tcBuf->palette[value][1]], gamma8[tcBuf->palette[value][2]]);
+      break;
+    }
+  }
+  uint32_t level = (load + (uint32_t)tcWidth * POWER_WHITE - 1) / ((uint32_t)tcWidth * POWER_WHITE); // Rounded up
+  uint16_t entry = (tcTopDown ? tcHeight - 1 - tcRows : tcRows) / tcPowerStep;
+  if (level > tcBuf->profile[entry])
+    tcBuf->profile[entry] = level;
+}
+
+/// Convert count uncompressed BMP pixels to native format
+void convertPixels(const uint8_t *src, uint8_t *p, uint16_t count)
+{
+  if (tcFormat == PIXEL_INDEXED8 || tcFormat == PIXEL_INDEXED4)
+  { // Indexed rows are the same as the BMP, less the padding
+    uint16_t bytes = pixelRowBytes(tcFormat, count);
+    memcpy(p, src, bytes);
+    if (count & 1 && tcFormat == PIXEL_INDEXED4)
+      p[bytes - 1] &= 0xF0; // Keep the unused nibble zero so it compresses the same every time
+    return;
+  }
+  for (uint16_t x = 0; x < count; x++)
+  {
+    const uint8_t *pixel = src + x * tcBitDepth / 8;
+    uint32_t value;
+    uint16_t rgb565;
+    switch (tcBitDepth)
+    {
+    case 16:
+      value = get16(pixel);
+      rgb565 = ((getChannel(value, 0) >> 3) << 11) | ((getChannel(value, 1) >> 2) << 5) | (getChannel(value, 2) >> 3);
+      p[0] = rgb565 & 0xFF;
+      p[1] = rgb565 >> 8;
+      p += 2;
+      break;
+    case 32:
+      value = get32(pixel);
+      p[0] = gamma8[getChannel(value, 0)];
+      p[1] = gamma8[getChannel(value, 1)];
+      p[2] = gamma8[getChannel(value, 2)];
+      p += 3;
+      break;
+    case 24:
+      p[0] = gamma8[pixel[2]];
+      p[1] = gamma8[pixel[1]];
+      p[2] = gamma8[pixel[0]];
+      p += 3;
+      break;
+    }
+  }
+}
+
+/// Convert a complete uncompressed BMP row to native format
+void convertRow()
+{
+  convertPixels(tcBuf->row, tcBuf->pixels, tcWidth);
+}
+
+/// Take the next bytes of a row that is too wide for the row buffer. The pixels are
+/// converted and written out a tile's width at a time. Returns the number of bytes used.
+size_t wideRowBytes(const uint8_t *buf, size_t len)
+{
+  uint16_t segmentBytes = TILE_SIZE * tcBitDepth / 8;    // BMP bytes for a tile's width of pixels
+  uint16_t dataBytes = (tcWidth * tcBitDepth + 7) / 8;   // BMP bytes for the row, not counting the padding
+  size_t n;
+
+  if (tcRowPos >= dataBytes)
+  { // Skip the padding
+    n = len < (size_t)(tcStride - tcRowPos) ? len : tcStride - tcRowPos;
+    tcRowPos += n;
+    return n;
+  }
+  uint16_t segmentStart = tcRowPos - tcRowPos % segmentBytes;
+  uint16_t segmentEnd = segmentStart + segmentBytes < dataBytes ? segmentStart + segmentBytes : dataBytes;
+  n = len < (size_t)(segmentEnd - tcRowPos) ? len : segmentEnd - tcRowPos;
+  memcpy(tcBuf->row + tcRowPos - segmentStart, buf, n);
+  tcRowPos += n;
+  if (tcRowPos == segmentEnd)
+  {
+    uint16_t x = segmentStart * 8 / tcBitDepth;
+    uint16_t count = tcWidth - x < TILE_SIZE ? tcWidth - x : TILE_SIZE;
+    convertPixels(tcBuf->row, tcBuf->pixels, count);
+    tcFile.write(tcBuf->pixels, pixelRowBytes(tcFormat, count));
+  }
+  return n;
+}
+
+/// Cut the uncompressed rows in the temporary file up into tiles. Each band of
+/// TILE_SIZE rows is written a tile at a time, starting from the first row played.
+/// Tiles that hang over the edge of the image are filled out with zeros.
+void writeTiles()
+{
+  File in = LittleFS.open(tcTempPath, "r");
+  uint16_t tileRowBytes = pixelRowBytes(tcFormat, TILE_SIZE);
+  uint16_t tilesAcross = (tcWidth + TILE_SIZE - 1) / TILE_SIZE;
+  uint16_t tilesDown = (tcHeight + TILE_SIZE - 1) / TILE_SIZE;
+
+  tcFile = LittleFS.open(tcPath, "w");
+  writeHeader(tcFile, CODEC_TILES);
+  for (uint16_t ty = 0; ty < tilesDown; ty++)
+  {
+    for (uint16_t tx = 0; tx < tilesAcross; tx++)
+    {
+      uint16_t x = tx * TILE_SIZE;
+      uint16_t count = tcWidth - x < TILE_SIZE ? tcWidth - x : TILE_SIZE;
+      for (uint16_t r = 0; r < TILE_SIZE; r++)
+      {
+        uint32_t y = ty * TILE_SIZE + r;
+        memset(tcBuf->pixels, 0, tileRowBytes);
+        if (y < tcHeight)
+        {
+          uint32_t fileRow = tcTopDown ? tcHeight - 1 - y : y;
+          in.seek(tcRowsStart + fileRow * tcRowBytes + pixelRowBytes(tcFormat, x), SeekSet);
+          in.read(tcBuf->pixels, pixelRowBytes(tcFormat, count));
+        }
+        tcFile.write(tcBuf->pixels, tileRowBytes);
+      }
+    }
+  }
+  in.close();
+  tcFile.close();
+}
+
+/// Finish an RLE row - any pixels that weren't set are left as colour 0
+void finishRleRow()
+{
+  if (tcRows < tcHeight)
+  {
+    measureRow();
+    outputRow();
+    tcRows++;
+  }
+  memset(tcBuf->pixels, 0, sizeof(tcBuf->pixels));
+  tcX = 0;
+}
+
+void setRlePixel(uint8_t index)
+{
+  if (tcX < tcWidth)
+  {
+    if (tcFormat == PIXEL_INDEXED8)
+      tcBuf->pixels[tcX] = index;
+    else if (tcX & 1)
+      tcBuf->pixels[tcX >> 1] |= index;
+    else
+      tcBuf->pixels[tcX >> 1] = index << 4;
+  }
+  tcX++;
+}
+
+/// Decode the next byte of RLE8/RLE4 pixel data
+void rleByte(uint8_t b)
+{
+  switch (tcRleState)
+  {
+  case RLE_COUNT:
+    if (b == 0)
+      tcRleState = RLE_ESCAPE;
+    else
+    {
+      tcRleCount = b;
+      tcRleState = RLE_VALUE;
+    }
+    break;
+  case RLE_VALUE: // RLE4 runs alternate between the two nibbles
+    for (uint8_t i = 0; i < tcRleCount; i++)
+      setRlePixel(tcBitDepth == 8 ? b : (i & 1) ? b & 0x0F : b >> 4);
+    tcRleState = RLE_COUNT;
+    break;
+  case RLE_ESCAPE:
+    if (b == 0) // End of line
+    {
+      finishRleRow();
+      tcRleState = RLE_COUNT;
+    }
+    else if (b == 1) // End of bitmap - anything left is colour 0
+    {
+      while (tcRows < tcHeight)
+        finishRleRow();
+      tcRleState = RLE_END;
+    }
+    else if (b == 2)
+      tcRleState = RLE_DELTA_X;
+    else
+    { // Absolute run of b pixels, padded to a 16-bit boundary
+      tcRleCount = b;
+      tcRleBytes = tcBitDepth == 8 ? b : (b + 1) / 2;
+      tcRleBytes += tcRleBytes & 1;
+      tcRleState = RLE_ABSOLUTE;
+    }
+    break;
+  case RLE_ABSOLUTE:
+    if (tcBitDepth == 8 && tcRleCount)
+    {
+      setRlePixel(b);
+      tcRleCount--;
+    }
+    else if (tcBitDepth == 4)
+    {
+      for (uint8_t i = 0; i < 2 && tcRleCount; i++, tcRleCount--)
+        setRlePixel(i ? b & 0x0F : b >> 4);
+    }
+    if (--tcRleBytes == 0)
+      tcRleState = RLE_COUNT;
+    break;
+  case RLE_DELTA_X:
+    tcDeltaX = b;
+    tcRleState = RLE_DELTA_Y;
+    break;
+  case RLE_DELTA_Y:
+  { // Move right and up, leaving the skipped pixels as colour 0
+    uint16_t x = tcX + tcDeltaX;
+    for (uint8_t i = 0; i < b; i++)
+      finishRleRow();
+    tcX = x;
+    tcRleState = RLE_COUNT;
+    break;
+  }
+  case RLE_END:
+    break;
+  }
+}
+
+/// Start converting a new upload
+void beginTranscode(const char *path)
+{
+  strlcpy(tcPath, path, sizeof(tcPath));
+  strlcpy(tcTempPath, path, sizeof(tcTempPath));
+  if (strlen(tcTempPath) > 4)
+    strcpy(tcTempPath + strlen(tcTempPath) - 4, ".tmp"); // Swap the .bmp for .tmp
+  tcPos = 0;
+  tcDataOffset = 0;
+  tcRowPos = 0;
+  tcRows = 0;
+  tcX = 0;
+  tcRleState = RLE_COUNT;
+  tcHeaderParsed = false;
+  tcColours = 0;
+  tcFormat = PIXEL_RGB888;
+  tcStatus = VALID;
+  if (!tcBuf && !(tcBuf = (TranscodeBuffers *)malloc(sizeof(TranscodeBuffers))))
+    tcStatus |= OPEN_ERROR; // Not enough memory
+}
+
+/// Convert the next chunk of the upload. Returns false once the file has been rejected.
+bool transcodeChunk(const uint8_t *buf, size_t len)
+{
+  size_t i = 0;
+
+  if (tcStatus != VALID)
+    return false;
+
+  while (i < len)
+  {
+    if (!tcHeaderParsed)
+    { // Keep the headers until we reach the pixel data
+      if (tcPos < TRANSCODE_HEADER_MAX)
+        tcBuf->header[tcPos] = buf[i];
+      tcPos++;
+      i++;
+      if (tcPos == 14)
+      {
+        tcDataOffset = get32(tcBuf->header + 10);
+        if (get16(tcBuf->header) != 0x4D42 || tcDataOffset < 54) // BMP file signature ("BM") check
+        {
+          tcStatus |= BAD_SIGNATURE;
+          return false;
+        }
+      }
+      if (tcPos >= 14 && tcPos == tcDataOffset)
+      {
+        if (!parseHeader())
+          return false;
+        tcHeaderParsed = true;
+      }
+      continue;
+    }
+
+    if (tcRows == tcHeight)
+      break; // Ignore anything after the image
+    if (tcCompression == BI_RLE8 || tcCompression == BI_RLE4)
+    {
+      rleByte(buf[i++]);
+      continue;
+    }
+    if (tcWidth > MAX_BMP_WIDTH)
+    {
+      i += wideRowBytes(buf + i, len - i);
+      if (tcRowPos == tcStride)
+      {
+        tcRowPos = 0;
+        tcRows++;
+      }
+      continue;
+    }
+    size_t n = len - i < (size_t)(tcStride - tcRowPos) ? len - i : tcStride - tcRowPos;
+    memcpy(tcBuf->row + tcRowPos, buf + i, n);
+    tcRowPos += n;
+    i += n;
+    if (tcRowPos == tcStride)
+    {
+      convertRow();
+      measureRow();
+      outputRow();
+      tcRowPos = 0;
+      tcRows++;
+    }
+  }
+  return true;
+}
+
+/// Abandon the upload and tidy up
+void abortTranscode()
+{
+  if (tcFile)
+    tcFile.close();
+  LittleFS.remove(tcTempPath);
+  free(tcBuf);
+  tcBuf = NULL;
+}
+
+/// Finish the upload, putting the rows into playback order if the image was stored top first.
+/// Returns the bitmap file status.
+uint16_t endTranscode()
+{
+  if (tcStatus == VALID && (!tcHeaderParsed || tcRows < tcHeight))
+    tcStatus |= BAD_SIZE; // The file was truncated
+  if (tcStatus != VALID)
+  {
+    abortTranscode();
+    return tcStatus;
+  }
+  if (!tcTopDown && tcPowerStep)
+  { // The profile is complete now, so fill it in
+    tcFile.seek(sizeof(NativeHeader) + tcColours * 3, SeekSet);
+    tcFile.write(tcBuf->profile, tcPowerEntries);
+  }
+  tcFile.close();
+
+  LittleFS.remove(tcPath);
+  if (tcTiled)
+  {
+    writeTiles();
+    LittleFS.remove(tcTempPath);
+  }
+  else if (tcTopDown)
+  { // Write the rows out again bottom first, compressing them as we go
+    File in = LittleFS.open(tcTempPath, "r");
+
+    tcFile = LittleFS.open(tcPath, "w");
+    tcTopDown = false;
+    writeHeader(tcFile, CODEC_ROWS);
+    for (int32_t r = tcHeight - 1; r >= 0; r--)
+    {
+      in.seek(tcRowsStart + r * tcRowBytes, SeekSet);
+      in.read(tcBuf->pixels, tcRowBytes);
+      outputRow();
+    }
+    in.close();
+    tcFile.close();
+    LittleFS.remove(tcTempPath);
+  }
+  else
+    LittleFS.rename(tcTempPath, tcPath);
+
+  free(tcBuf);
+  tcBuf = NULL;
+  updateBmpIndex(tcPath);
+  dropCacheEntries(tcPath);
+  rawStoreImport(tcPath); // Replaces any copy of the old file
+  if (strcmp(tcPath, currentFile.path) == 0) // The selected file has been replaced
+    getBmpInfo(tcPath);
+  return VALID;
+}
@@ -62,8 +62,6 @@
 #include "pixelstick.h"
 
 extern CRGB leds[];
-extern PresetInfo presetList[];
-extern const CRGBPalette16 palettes[];
 
 // Overall twinkle speed.
 // 0 (VERY slow) to 8 (VERY fast).
@@ -92,7 +90,24 @@ CRGB gBackgroundColor = CRGB::Black;
 // incandescent bulbs change color as they get dim down.
 #define COOL_LIKE_INCANDESCENT 1
 
-CRGBPalette16 twinkleFoxPalette;
+// If TWINKLE_CLOCK_CACHE is set to 1, each pixel's clock
+// offset, speed and salt are worked out once, when the
+// preset starts, and kept in a table (4 bytes a pixel)
+// rather than coming out of the PRNG every frame. The
+// twinkles are exactly the same either way.
+#define TWINKLE_CLOCK_CACHE 1
+
+struct TwinkleClock
+{
+    uint16_t offset; // Clock offset
+    uint8_t speed;   // Clock speed, in 8ths (8/8ths to 23/8ths)
+    uint8_t salt;    // Picks the colours the pixel twinkles in
+};
+
+#if TWINKLE_CLOCK_CACHE == 1
+TwinkleClock twinkleClocks[NUM_LEDS];
+bool twinkleClocksReady;
+#endif
 
 // This function is like 'triwave8', which produces a
 // symmetrical up-and-down triangle sawtooth waveform, except that this
@@ -139,9 +154,9 @@ void coolLikeIncandescent(CRGB &c, uint8_t phase)
 //  of one cycle of the brightness wave function.
 //  The 'high digits' are also used to determine whether this pixel
 //  should light at all during this cycle, based on the twinkleDensity.
-CRGB computeOneTwinkle(uint32_t ms, uint8_t salt)
+CRGB computeOneTwinkle(const PresetContext &ctx, uint32_t ms, uint8_t salt)
 {
-    uint16_t ticks = ms >> (8 - presetList[getConfig().presetIndex].parms[0].values[2]);
+    uint16_t ticks = ms >> (8 - ctx.parms[0]);
     uint8_t fastcycle8 = ticks;
     uint16_t slowcycle16 = (ticks >> 8) + salt;
     slowcycle16 += sin8(slowcycle16);
@@ -149,7 +164,7 @@ CRGB computeOneTwinkle(uint32_t ms, uint8_t salt)
     uint8_t slowcycle8 = (slowcycle16 & 0xFF) + (slowcycle16 >> 8);
 
     uint8_t bright = 0;
-    if (((slowcycle8 & 0x0E) / 2) < presetList[getConfig().presetIndex].parms[1].values[2])
+    if (((slowcycle8 & 0x0E) / 2) < ctx.parms[1])
     {
         bright = attackDecayWave8(fastcycle8);
     }
@@ -158,7 +173,7 @@ CRGB computeOneTwinkle(uint32_t ms, uint8_t salt)
     CRGB c;
     if (bright > 0)
     {
-        c = ColorFromPalette(twinkleFoxPalette, hue, bright, NOBLEND);
+        c = ColorFromPalette(ctx.palette, hue, bright, NOBLEND);
         if (COOL_LIKE_INCANDESCENT == 1)
         {
             coolLikeIncandescent(c, fastcycle8);
@@ -171,21 +186,48 @@ CRGB computeOneTwinkle(uint32_t ms, uint8_t salt)
     return c;
 }
 
+//  "PRNG16" is the pseudorandom number generator that gives
+//  each pixel its clock parameters. It MUST be started from the
+//  same value each time the parameters for all the pixels are
+//  worked out, so that the sequence of 'random' numbers that it
+//  generates is (paradoxically) stable.
+uint16_t nextTwinkleClock(uint16_t PRNG16, TwinkleClock &clock)
+{
+    PRNG16 = (uint16_t)(PRNG16 * 2053) + 1384; // next 'random' number
+    clock.offset = PRNG16;                     // use that number as clock offset
+    PRNG16 = (uint16_t)(PRNG16 * 2053) + 1384; // next 'random' number
+    // use that number as clock speed adjustment factor (in 8ths, from 8/8ths to 23/8ths)
+    clock.speed = ((((PRNG16 & 0xFF) >> 4) + (PRNG16 & 0x0F)) & 0x0F) + 0x08;
+    clock.salt = PRNG16 >> 8; // get 'salt' value for this pixel
+    return PRNG16;
+}
+
+//  Work out the clock parameters for every pixel, the first time
+//  TwinkleFox is shown
+void drawTwinklesInit()
+{
+#if TWINKLE_CLOCK_CACHE == 1
+    if (twinkleClocksReady)
+        return;
+    uint16_t PRNG16 = 11337;
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+        PRNG16 = nextTwinkleClock(PRNG16, twinkleClocks[i]);
+    twinkleClocksReady = true;
+#endif
+}
+
 //  This function loops over each pixel, calculates the
 //  adjusted 'clock' that this pixel should use, and calls
 //  "CalculateOneTwinkle" on each pixel.  It then displays
 //  either the twinkle color of the background color,
 //  whichever is brighter.
-void drawTwinkles()
+void drawTwinkles(const PresetContext &ctx)
 {
-    twinkleFoxPalette = palettes[presetList[getConfig().presetIndex].paletteIndex];
-    // "PRNG16" is the pseudorandom number generator
-    // It MUST be reset to the same starting value each time
-    // this function is called, so that the sequence of 'random'
-    // numbers that it generates is (paradoxically) stable.
+#if TWINKLE_CLOCK_CACHE != 1
     uint16_t PRNG16 = 11337;
+#endif
 
-    uint32_t clock32 = millis();
+    uint32_t clock32 = ctx.now;
 
     // Set up the background color, "bg".
     // if AUTO_SELECT_BACKGROUND_COLOR == 1, and the first two colors of
@@ -193,9 +235,9 @@ void drawTwinkles()
     // that color is used for the background color
     CRGB bg;
     if ((AUTO_SELECT_BACKGROUND_COLOR == 1) &&
-        (twinkleFoxPalette[0] == twinkleFoxPalette[1]))
+        (ctx.palette[0] == ctx.palette[1]))
     {
-        bg = twinkleFoxPalette[0];
+        bg = ctx.palette[0];
         uint8_t bglight = bg.getAverageLight();
         if (bglight > 64)
         {
@@ -221,18 +263,19 @@ void drawTwinkles()
     {
         CRGB &pixel = leds[i];
 
-        PRNG16 = (uint16_t)(PRNG16 * 2053) + 1384; // next 'random' number
-        uint16_t myclockoffset16 = PRNG16;         // use that number as clock offset
-        PRNG16 = (uint16_t)(PRNG16 * 2053) + 1384; // next 'random' number
-        // use that number as clock speed adjustment factor (in 8ths, from 8/8ths to 23/8ths)
-        uint8_t myspeedmultiplierQ5_3 = ((((PRNG16 & 0xFF) >> 4) + (PRNG16 & 0x0F)) & 0x0F) + 0x08;
-        uint32_t myclock30 = (uint32_t)((clock32 * myspeedmultiplierQ5_3) >> 3) + myclockoffset16;
-        uint8_t myunique8 = PRNG16 >> 8; // get 'salt' value for this pixel
+#if TWINKLE_CLOCK_CACHE == 1
+        const TwinkleClock &clock = twinkleClocks[i];
+#else
+        TwinkleClock clock;
+        PRNG16 = nextTwinkleClock(PRNG16, clock);
+#endif
+        uint32_t myclock30 = (uint32_t)((clock32 * clock.speed) >> 3) + clock.offset;
+        uint8_t myunique8 = clock.salt;
 
         // We now have the adjusted 'clock' for this pixel, now we call
         // the function that computes what color the pixel should be based
         // on the "brightness = f( time )" idea.
-        CRGB c = computeOneTwinkle(myclock30, myunique8);
+        CRGB c = computeOneTwinkle(ctx, myclock30, myunique8);
 
         uint8_t cbright = c.getAverageLight();
         int16_t deltabright = cbright - backgroundBrightness;
@@ -7,13 +7,24 @@
 #define DENSITY 255
 
 extern CRGB leds[];
-extern PresetInfo presetList[];
-extern const CRGBPalette16 palettes[];
 
-CRGB w(85, 85, 85), W(CRGB::White);
-CRGBPalette16 SnowColours = CRGBPalette16(W, W, W, W, w, w, w, w, w, w, w, w, w, w, w, w);
-CRGB l(0xE1A024);
-CRGBPalette16 Incandescent = CRGBPalette16(l, l, l, l, l, l, l, l, l, l, l, l, l, l, l, l);
+void swarBrightenOrDarken(CRGB *leds, uint16_t count, const uint8_t *brighter, uint8_t up, uint8_t down);
+
+// Tables rather than CRGBPalette16s, so they're already there when palettes[] in
+// presets.cpp is set up from them, whichever file's globals are set up first
+#define Snow_White 0x555555
+extern const TProgmemRGBPalette16 SnowColours FL_PROGMEM =
+    {CRGB::White, CRGB::White, CRGB::White, CRGB::White,
+     Snow_White, Snow_White, Snow_White, Snow_White,
+     Snow_White, Snow_White, Snow_White, Snow_White,
+     Snow_White, Snow_White, Snow_White, Snow_White};
+
+#define Incandescent_Yellow 0xE1A024
+extern const TProgmemRGBPalette16 Incandescent FL_PROGMEM =
+    {Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow,
+     Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow,
+     Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow,
+     Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow, Incandescent_Yellow};
 
 enum
 {
@@ -21,20 +32,6 @@ enum
     GETTING_BRIGHTER = 1
 };
 
-CRGB makeBrighter(const CRGB &color, fract8 howMuchBrighter)
-{
-    CRGB incrementalColor = color;
-    incrementalColor.nscale8(howMuchBrighter);
-    return color + incrementalColor;
-}
-
-CRGB makeDarker(const CRGB &color, fract8 howMuchDarker)
-{
-    CRGB newcolor = color;
-    newcolor.nscale8(255 - howMuchDarker);
-    return newcolor;
-}
-
 // Compact implementation of
 // the directionFlags array, using just one BIT of RAM
 // per pixel.  This requires a bunch of bit wrangling,
@@ -42,6 +39,8 @@ CRGB makeDarker(const CRGB &color, fract8 howMuchDarker)
 // cycles and about 100 bytes of flash program memory.
 uint8_t directionFlags[(NUM_LEDS + 7) / 8];
 
+uint32_t twinkleMillis; // Time since the twinkles last changed
+
 bool getPixelDirection(uint16_t i)
 {
     uint16_t index = i / 8;
@@ -68,31 +67,34 @@ void setPixelDirection(uint16_t i, bool dir)
 
 void brightenOrDarkenEachPixel(fract8 fadeUpAmount, fract8 fadeDownAmount)
 {
+    // Make each pixel brighter (adding a fraction of itself) or darker (scaling it down),
+    // depending on its direction flag, four bytes at a time
+    swarBrightenOrDarken(leds, NUM_LEDS, directionFlags, fadeUpAmount, fadeDownAmount);
     for (uint16_t i = 0; i < NUM_LEDS; i++)
     {
-        if (getPixelDirection(i) == GETTING_DARKER)
-        {
-            // This pixel is getting darker
-            leds[i] = makeDarker(leds[i], fadeDownAmount);
-        }
-        else
+        // now check to see if the brightening ones have maxxed out the brightness
+        if (getPixelDirection(i) == GETTING_BRIGHTER &&
+            (leds[i].r == 255 || leds[i].g == 255 || leds[i].b == 255))
         {
-            // This pixel is getting brighter
-            leds[i] = makeBrighter(leds[i], fadeUpAmount);
-            // now check to see if we've maxxed out the brightness
-            if (leds[i].r == 255 || leds[i].g == 255 || leds[i].b == 255)
-            {
-                // if so, turn around and start getting darker
-                setPixelDirection(i, GETTING_DARKER);
-            }
+            // if so, turn around and start getting darker
+            setPixelDirection(i, GETTING_DARKER);
         }
     }
 }
 
-void colourTwinkles()
+/// Start with every pixel getting darker, as they would be if the LEDs were all off
+void colourTwinklesInit()
+{
+    memset(directionFlags, 0, sizeof(directionFlags));
+    twinkleMillis = 0;
+}
+
+void colourTwinkles(const PresetContext &ctx)
 {
-    EVERY_N_MILLIS(30)
+    twinkleMillis += ctx.delta;
+    if (twinkleMillis >= 30) // Every 30ms of the preset's time
     {
+        twinkleMillis = 0;
         // Make each pixel brighter or darker, depending on
         // its 'direction' flag.
         brightenOrDarkenEachPixel(FADE_IN_SPEED, FADE_OUT_SPEED);
@@ -103,7 +105,7 @@ void colourTwinkles()
             int pos = random16(NUM_LEDS);
             if (!leds[pos])
             {
-                leds[pos] = ColorFromPalette(palettes[presetList[getConfig().presetIndex].paletteIndex], random8(), STARTING_BRIGHTNESS, NOBLEND);
+                leds[pos] = ColorFromPalette(ctx.palette, random8(), STARTING_BRIGHTNESS, NOBLEND);
                 setPixelDirection(pos, GETTING_BRIGHTER);
             }
         }
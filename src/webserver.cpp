@@ -4,11 +4,20 @@
 bool handleFileRead(String path); // send the right file to the client (if it exists)
 void handleFileUpload();
 void handleResult();
+void beginTranscode(const char *path);
+bool transcodeChunk(const uint8_t *buf, size_t len);
+uint16_t endTranscode();
+void abortTranscode();
+void readBmpInfo(const char *path, FileInfo &info);
+uint32_t previewSize(const FileInfo &info);
+bool writePreview(const FileInfo &info, void (*write)(const uint8_t *buf, size_t len));
 
 // void handleBrowseWifi();
 int uploadSize;
+uint16_t uploadStatus; // Bitmap file status of the last upload
 
 String getContentType(String filename);
+bool sendPreview(const String &path);
 
 ESP8266WebServer server(80); // Create a webserver object that listens for HTTP request on port 80
 
@@ -64,6 +73,8 @@ bool handleFileRead(String path)
   {                                       // If the file exists, either as a compressed archive, or normal
     if (LittleFS.exists(pathWithGz))      // If there's a compressed version available
       path += ".gz";                      // Use the compressed verion
+    else if (path.startsWith("/bmp/") && sendPreview(path))
+      return true;                        // An uploaded bitmap, sent as a BMP the browser can show
     File file = LittleFS.open(path, "r"); // Open the file
     server.streamFile(file, contentType); // Send it to the client
 
@@ -76,6 +87,22 @@ bool handleFileRead(String path)
   return false;
 }
 
+/// Send a bitmap in the native format as a BMP, for the preview on the Images page.
+/// Returns false if it isn't one, so it can be sent as it is.
+bool sendPreview(const String &path)
+{
+  FileInfo info;
+
+  readBmpInfo(path.c_str(), info);
+  uint32_t size = previewSize(info);
+  if (!size)
+    return false;
+  server.setContentLength(size);
+  server.send(200, "image/bmp", "");
+  writePreview(info, [](const uint8_t *buf, size_t len) { server.sendContent((const char *)buf, len); });
+  return true;
+}
+
 String getContentType(String filename)
 { // convert the file extension to the MIME type
   if (filename.endsWith(".html"))
@@ -125,37 +152,45 @@ void handleResult()
   }
   else
   {
-    server.send(500, "text/plain", "Error: Problem uploading the file");
+    String s = F("Error: Problem uploading the file");
+    if (uploadStatus != VALID)
+    {
+      s += F(" - unable to use this bitmap (bitmap file error: ");
+      s += uploadStatus;
+      s += F(")");
+    }
+    server.send(500, "text/plain", s);
   }
 }
 
 void handleFileUpload() // upload a new file to the LittleFS
 {
-  static File fsUploadFile; // Has to be static as there are repeated calls to this function for upload
   String filename;
   HTTPUpload &upload = server.upload();
 
+  // Bitmaps are converted to the native playback format as they arrive, so there is
+  // no need to store the original file
   if (upload.status == UPLOAD_FILE_START)
   {
     uploadSize = 0;
+    uploadStatus = VALID;
     filename = upload.filename;
     if (!filename.startsWith("/bmp/"))
       filename = "/bmp/" + filename;
-    fsUploadFile = LittleFS.open(filename, "w"); // Open the file for writing in LittleFS (create if it doesn't exist)
+    beginTranscode(filename.c_str());
   }
   else if (upload.status == UPLOAD_FILE_WRITE)
   {
-    if (fsUploadFile)
-    {
-      fsUploadFile.write(upload.buf, upload.currentSize); // Write the received bytes to the file
-    }
+    transcodeChunk(upload.buf, upload.currentSize); // Once the file has been rejected, the rest of it is ignored
   }
   else if (upload.status == UPLOAD_FILE_END)
   {
-    if (fsUploadFile)
-    {                       // If the file was successfully created
-      fsUploadFile.close(); // Close the file
+    uploadStatus = endTranscode();
+    if (uploadStatus == VALID) // If the file was successfully converted
       uploadSize = upload.totalSize;
-    }
   }
-}
\ No newline at end of file
+  else if (upload.status == UPLOAD_FILE_ABORTED)
+  {
+    abortTranscode();
+  }
+}
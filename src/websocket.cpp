@@ -3,8 +3,8 @@
 String update(char *cmd);
 String getConfigJson();
 String getFixPresetJson();
-String getBMPList();
-String getSystemInfo();
+String getBMPList(uint16_t start);
+String getSystemInfo(uint16_t start);
 void webSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length);
 
 extern bool userChanges;
@@ -47,13 +47,13 @@ void webSocketEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length)
             s = "U";
             s += update((char *)(payload + 1));
             break;
-        case 'B': // Request a list of [B]itmap files (in /bmp/)
+        case 'B': // Request a list of [B]itmap files (in /bmp/), optionally followed by where to start
             s = "B";
-            s += getBMPList();
+            s += getBMPList(atoi((char *)payload + 1));
             break;
-        case 'S': // Request [S]ystem info
+        case 'S': // Request [S]ystem info, optionally followed by where to start the list of files
             s = "S";
-            s += getSystemInfo();
+            s += getSystemInfo(atoi((char *)payload + 1));
             break;
         case 'C': // Request [C]onfig data to initialise the web interface
             s = "C";